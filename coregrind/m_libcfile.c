@@ -436,6 +436,45 @@ Off64T VG_(lseek) ( Int fd, Off64T offset, Int whence )
       change all usage points. */
 }
 
+/* Returns 0 on success, -1 otherwise. */
+Int VG_(ftruncate) ( Int fd, Off64T length )
+{
+   SysRes res;
+   // on 32 bits platforms, the 64 bits length is passed in two
+   // registers, with the same padding and order as for pread64.
+#  if defined(VGP_x86_linux)
+   res = VG_(do_syscall3)(__NR_ftruncate64, fd,
+                          length & 0xffffffff, length >> 32); // Little endian long long
+#  elif defined(VGP_arm_linux)
+   res = VG_(do_syscall4)(__NR_ftruncate64, fd,
+                          0, // Padding needed on ARM EABI
+                          length & 0xffffffff, length >> 32);
+#  elif defined(VGP_ppc32_linux)
+   res = VG_(do_syscall4)(__NR_ftruncate64, fd,
+                          0, // Padding needed on PPC32
+                          length >> 32, length & 0xffffffff); // Big endian long long
+#  elif (defined(VGP_mips32_linux) || defined(VGP_nanomips_linux)) \
+     && (VKI_LITTLE_ENDIAN)
+   res = VG_(do_syscall4)(__NR_ftruncate64, fd,
+                          0, length & 0xffffffff, length >> 32);
+#  elif (defined(VGP_mips32_linux) || defined(VGP_nanomips_linux)) \
+     && (VKI_BIG_ENDIAN)
+   res = VG_(do_syscall4)(__NR_ftruncate64, fd,
+                          0, length >> 32, length & 0xffffffff);
+#  elif defined(VGP_amd64_linux) || defined(VGP_s390x_linux) \
+      || defined(VGP_ppc64be_linux)  || defined(VGP_ppc64le_linux) \
+      || defined(VGP_mips64_linux) || defined(VGP_arm64_linux) \
+      || defined(VGP_amd64_freebsd)
+   res = VG_(do_syscall2)(__NR_ftruncate, fd, length);
+#  elif defined(VGP_x86_freebsd)
+   res = VG_(do_syscall3)(__NR_ftruncate, fd,
+                          length & 0xffffffff, length >> 32);
+#  else
+   res = VG_(mk_SysRes_Error)(VKI_ENOSYS);
+#  endif
+   return sr_isError(res) ? (-1) : 0;
+}
+
 
 /* stat/fstat support.  It's uggerly.  We have impedance-match into a
    'struct vg_stat' in order to have a single structure that callers
@@ -246,12 +246,6 @@ extern SysRes VG_(am_mmap_anon_float_valgrind)( SizeT cszB );
 extern SysRes VG_(am_mmap_file_float_valgrind)
    ( SizeT length, UInt prot, Int fd, Off64T offset );
 
-/* Map shared a file at an unconstrained address for V, and update the
-   segment array accordingly.  This is used by V for communicating
-   with vgdb.  */
-extern SysRes VG_(am_shared_mmap_file_float_valgrind)
-   ( SizeT length, UInt prot, Int fd, Off64T offset );
-
 /* Similar to VG_(am_mmap_anon_float_client) but also
    marks the segment as containing the client heap. */
 extern SysRes VG_(am_mmap_client_heap) ( SizeT length, Int prot );
@@ -56,6 +56,32 @@ Bool bar_record_values = False;
 //! Data is copied to/from shadow memory via this buffer of 2x V256.
 V256* dg_bar_shadow_mem_buffer;
 
+//! Maximal number of operands passed via dg_bar_tape_staging_buffer.
+#define DG_BAR_STAGING_OPERANDS 4
+/*! Operands of n-ary statements are passed to the dirty call via this buffer,
+ *  as the lower layers, higher layers and partial derivatives of
+ *  DG_BAR_STAGING_OPERANDS-many indices, followed by the value of the result
+ *  if values are recorded. Statements with two operands use it as well if
+ *  values are recorded, so a single dirty call suffices.
+ */
+static ULong* dg_bar_tape_staging_buffer;
+
+//! Maximal number of operands of an operation recorded via dg_bar_writeToTapeLanes.
+#define DG_BAR_LANES_OPERANDS 3
+/*! All lanes of a SIMD operation are passed to a single dirty call via this
+ *  buffer. It contains, at the following byte offsets,
+ *  - the lower and higher layer of the index vector of operand k,
+ *  - the partial derivative of lane l w.r.t. operand k,
+ *  - the value of lane l, if values are recorded,
+ *  - the lower and higher layer of the index vector of the result.
+ */
+static UChar* dg_bar_tape_lane_buffer;
+#define DG_BAR_LANES_INDEX(k,hi) (32*(2*(k)+(hi)))
+#define DG_BAR_LANES_DIFF(l,k) (192+8*(DG_BAR_LANES_OPERANDS*(l)+(k)))
+#define DG_BAR_LANES_VALUE(l) (384+8*(l))
+#define DG_BAR_LANES_RESULT(hi) (448+32*(hi))
+#define DG_BAR_LANES_SIZE 512
+
 #define dg_rounding_mode IRExpr_Const(IRConst_U32(0))
 
 /* --- Define ExpressionHandling. --- */
@@ -296,10 +322,28 @@ ULong dg_bar_writeToTape_call(ULong index1Lo, ULong index1Hi, ULong index2Lo, UL
   return returnindex;
 }
 
-void dg_bar_writeToTape_value_call(ULong value, ULong index){
-  if(index!=0){
-    valuesAddStatement(*(double*)&value);
+/*! Record the statement and value staged in dg_bar_tape_staging_buffer by dg_bar_writeToTape.
+ */
+ULong dg_bar_writeToTapeValue_call(void){
+  ULong* staged = dg_bar_tape_staging_buffer;
+  ULong returnindex = dg_bar_writeToTape_call(staged[0], staged[DG_BAR_STAGING_OPERANDS],
+    staged[1], staged[DG_BAR_STAGING_OPERANDS+1],
+    staged[2*DG_BAR_STAGING_OPERANDS], staged[2*DG_BAR_STAGING_OPERANDS+1]);
+  if(returnindex!=0){
+    valuesAddStatement(*(double*)&staged[3*DG_BAR_STAGING_OPERANDS]);
   }
+  return returnindex;
+}
+
+/*! Add IR statements storing an expression into dg_bar_tape_staging_buffer.
+ */
+static void dg_bar_stage(DiffEnv* diffenv, UInt pos, IRExpr* expr){
+  #ifdef BUILD_32BIT
+  IRExpr* addr = IRExpr_Const(IRConst_U32((Addr)(dg_bar_tape_staging_buffer+pos)));
+  #else
+  IRExpr* addr = IRExpr_Const(IRConst_U64((Addr)(dg_bar_tape_staging_buffer+pos)));
+  #endif
+  addStmtToIRSB(diffenv->sb_out,IRStmt_Store(Iend_LE,addr,expr));
 }
 
 /*! Add dirty call writing to tape.
@@ -321,21 +365,87 @@ void dg_bar_writeToTape_value_call(ULong value, ULong index){
  */
 IRExpr** dg_bar_writeToTape(DiffEnv* diffenv, IRExpr* index1Lo, IRExpr* index1Hi, IRExpr* index2Lo, IRExpr* index2Hi, IRExpr* diff1, IRExpr* diff2, IRExpr* value){
   IRTemp returnindex = newIRTemp(diffenv->sb_out->tyenv,Ity_I64);
-  IRDirty* dd = unsafeIRDirty_1_N(
-        returnindex,
-        0, "dg_bar_writeToTape_call",
-        &dg_bar_writeToTape_call,
-        mkIRExprVec_6(index1Lo,index1Hi,index2Lo,index2Hi,
-          IRExpr_Unop(Iop_ReinterpF64asI64,diff1),
-          IRExpr_Unop(Iop_ReinterpF64asI64,diff2) )  );
+  IRDirty* dd;
+  if(bar_record_values){ // seven operands, pass them via the staging buffer
+    dg_bar_stage(diffenv, 0, index1Lo);
+    dg_bar_stage(diffenv, 1, index2Lo);
+    dg_bar_stage(diffenv, DG_BAR_STAGING_OPERANDS, index1Hi);
+    dg_bar_stage(diffenv, DG_BAR_STAGING_OPERANDS+1, index2Hi);
+    dg_bar_stage(diffenv, 2*DG_BAR_STAGING_OPERANDS, diff1);
+    dg_bar_stage(diffenv, 2*DG_BAR_STAGING_OPERANDS+1, diff2);
+    dg_bar_stage(diffenv, 3*DG_BAR_STAGING_OPERANDS, value);
+    dd = unsafeIRDirty_1_N(
+          returnindex,
+          0, "dg_bar_writeToTapeValue_call",
+          &dg_bar_writeToTapeValue_call,
+          mkIRExprVec_0() );
+  } else {
+    dd = unsafeIRDirty_1_N(
+          returnindex,
+          0, "dg_bar_writeToTape_call",
+          &dg_bar_writeToTape_call,
+          mkIRExprVec_6(index1Lo,index1Hi,index2Lo,index2Hi,
+            IRExpr_Unop(Iop_ReinterpF64asI64,diff1),
+            IRExpr_Unop(Iop_ReinterpF64asI64,diff2) )  );
+  }
   addStmtToIRSB(diffenv->sb_out, IRStmt_Dirty(dd));
+  // split I64 returnindex into two I32 layers
+  IRExpr* exLo_i32 = IRExpr_Unop(Iop_64to32, IRExpr_RdTmp(returnindex));
+  IRExpr* exHi_i32 = IRExpr_Unop(Iop_64HIto32, IRExpr_RdTmp(returnindex));
+  // convert to I64
+  IRExpr* exLo = IRExpr_Binop(Iop_32HLto64,IRExpr_Const(IRConst_U32(0)),exLo_i32);
+  IRExpr* exHi = IRExpr_Binop(Iop_32HLto64,IRExpr_Const(IRConst_U32(0)),exHi_i32);
+  return mkIRExprVec_2(exLo,exHi);
+}
+
+ULong dg_bar_writeToTapeN_call(ULong n){
+  ULong indices[DG_BAR_STAGING_OPERANDS];
+  for(ULong j=0; j<n; j++){
+    // assemble 8-byte indices from 4-byte beginnings in both shadow layers
+    UInt index[2];
+    index[0] = *(UInt*)&dg_bar_tape_staging_buffer[j];
+    index[1] = *(UInt*)&dg_bar_tape_staging_buffer[DG_BAR_STAGING_OPERANDS+j];
+    indices[j] = *(ULong*)index;
+  }
+  ULong returnindex = tapeAddStatementN(n, indices, (double*)(dg_bar_tape_staging_buffer+2*DG_BAR_STAGING_OPERANDS));
+  if(bar_record_values && returnindex!=0){
+    valuesAddStatement(*(double*)&dg_bar_tape_staging_buffer[3*DG_BAR_STAGING_OPERANDS]);
+  }
+  return returnindex;
+}
+
+/*! Add dirty call writing an operation with more than two operands to tape.
+ *
+ * The operands are stored into dg_bar_tape_staging_buffer, as dirty calls
+ * can have at most six arguments.
+ *
+ * \param diffenv - General setup.
+ * \param n - Number of operands, at most DG_BAR_STAGING_OPERANDS.
+ * \param indexLo - n IRExpr*'s of type I64 for the lower layers of the indices of the operands
+ * \param indexHi - n IRExpr*'s of type I64 for the higher layers of the indices of the operands
+ * \param diff - n IRExpr*'s of type F64 for the partial derivatives w.r.t. the operands
+ * \param value - IRExpr* of type F64 for the value of the result
+ * \returns Array of two IRExpr*'s of type I64 for the lower and higher layer of the
+ *   new index assigned to the result.
+ */
+IRExpr** dg_bar_writeToTapeN(DiffEnv* diffenv, UInt n, IRExpr** indexLo, IRExpr** indexHi, IRExpr** diff, IRExpr* value){
+  tl_assert(n<=DG_BAR_STAGING_OPERANDS);
+  for(UInt j=0; j<n; j++){
+    IRExpr* exprs[3] = {indexLo[j], indexHi[j], IRExpr_Unop(Iop_ReinterpF64asI64,diff[j])};
+    for(UInt k=0; k<3; k++){
+      dg_bar_stage(diffenv, k*DG_BAR_STAGING_OPERANDS+j, exprs[k]);
+    }
+  }
   if(bar_record_values){
-    IRDirty* dd_val = unsafeIRDirty_0_N(
-          0, "dg_bar_writeToTape_value_call",
-          &dg_bar_writeToTape_value_call,
-          mkIRExprVec_2(IRExpr_Unop(Iop_ReinterpF64asI64,value), IRExpr_RdTmp(returnindex)) );
-    addStmtToIRSB(diffenv->sb_out, IRStmt_Dirty(dd_val));
+    dg_bar_stage(diffenv, 3*DG_BAR_STAGING_OPERANDS, value);
   }
+  IRTemp returnindex = newIRTemp(diffenv->sb_out->tyenv,Ity_I64);
+  IRDirty* dd = unsafeIRDirty_1_N(
+        returnindex,
+        0, "dg_bar_writeToTapeN_call",
+        &dg_bar_writeToTapeN_call,
+        mkIRExprVec_1(IRExpr_Const(IRConst_U64(n))) );
+  addStmtToIRSB(diffenv->sb_out, IRStmt_Dirty(dd));
   // split I64 returnindex into two I32 layers
   IRExpr* exLo_i32 = IRExpr_Unop(Iop_64to32, IRExpr_RdTmp(returnindex));
   IRExpr* exHi_i32 = IRExpr_Unop(Iop_64HIto32, IRExpr_RdTmp(returnindex));
@@ -345,6 +455,86 @@ IRExpr** dg_bar_writeToTape(DiffEnv* diffenv, IRExpr* index1Lo, IRExpr* index1Hi
   return mkIRExprVec_2(exLo,exHi);
 }
 
+void dg_bar_writeToTapeLanes_call(ULong n, ULong fpsize, ULong simdsize){
+  UChar* buf = dg_bar_tape_lane_buffer;
+  for(ULong l=0; l<simdsize; l++){
+    ULong indices[DG_BAR_LANES_OPERANDS];
+    for(ULong k=0; k<n; k++){
+      // assemble 8-byte indices from 4-byte beginnings in both shadow layers
+      UInt index[2];
+      index[0] = *(UInt*)(buf+DG_BAR_LANES_INDEX(k,0)+l*fpsize);
+      index[1] = *(UInt*)(buf+DG_BAR_LANES_INDEX(k,1)+l*fpsize);
+      indices[k] = *(ULong*)index;
+    }
+    double* diffs = (double*)(buf+DG_BAR_LANES_DIFF(l,0));
+    ULong returnindex;
+    if(n==DG_BAR_LANES_OPERANDS)
+      returnindex = tapeAddStatementN(n, indices, diffs);
+    else
+      returnindex = tapeAddStatement(indices[0], n>1 ? indices[1] : 0, diffs[0], n>1 ? diffs[1] : 0.);
+    if(bar_record_values && returnindex!=0){
+      valuesAddStatement(*(double*)(buf+DG_BAR_LANES_VALUE(l)));
+    }
+    // split into both layers, with zeros in the upper four bytes of 8-byte lanes
+    UInt* returnindex_layers = (UInt*)&returnindex;
+    for(ULong hi=0; hi<2; hi++){
+      UInt* result = (UInt*)(buf+DG_BAR_LANES_RESULT(hi)+l*fpsize);
+      result[0] = returnindex_layers[hi];
+      if(fpsize==8) result[1] = 0;
+    }
+  }
+}
+
+/*! Add a single dirty call writing all lanes of a SIMD operation to tape.
+ *
+ * Compared to a call to dg_bar_writeToTape per lane, this saves the dirty
+ * call overhead, and the index vectors need not be split into lanes and
+ * reassembled. The operands are passed via dg_bar_tape_lane_buffer.
+ *
+ * \param diffenv - General setup.
+ * \param n - Number of operands, at most DG_BAR_LANES_OPERANDS.
+ * \param fpsize - Size of a lane in bytes, 4 or 8.
+ * \param simdsize - Number of lanes, at most 8.
+ * \param type - Type of the result.
+ * \param indexLo - n IRExpr*'s for the lower layers of the index vectors of the operands
+ * \param indexHi - n IRExpr*'s for the higher layers of the index vectors of the operands
+ * \param diff - n*simdsize IRExpr*'s of type F64 for the partial derivatives, lane by lane
+ * \param value - simdsize IRExpr*'s of type F64 for the values of the lanes of the result
+ * \returns Array of two IRExpr*'s of the given type for the lower and higher layer of the
+ *   index vector of the result.
+ */
+IRExpr** dg_bar_writeToTapeLanes(DiffEnv* diffenv, UInt n, UInt fpsize, UInt simdsize, IRType type, IRExpr** indexLo, IRExpr** indexHi, IRExpr** diff, IRExpr** value){
+  tl_assert(n<=DG_BAR_LANES_OPERANDS && fpsize*simdsize<=32);
+  #ifdef BUILD_32BIT
+  #define DG_BAR_LANES_ADDR(offset) IRExpr_Const(IRConst_U32((Addr)(dg_bar_tape_lane_buffer+(offset))))
+  #else
+  #define DG_BAR_LANES_ADDR(offset) IRExpr_Const(IRConst_U64((Addr)(dg_bar_tape_lane_buffer+(offset))))
+  #endif
+  for(UInt k=0; k<n; k++){
+    addStmtToIRSB(diffenv->sb_out,IRStmt_Store(Iend_LE,DG_BAR_LANES_ADDR(DG_BAR_LANES_INDEX(k,0)),indexLo[k]));
+    addStmtToIRSB(diffenv->sb_out,IRStmt_Store(Iend_LE,DG_BAR_LANES_ADDR(DG_BAR_LANES_INDEX(k,1)),indexHi[k]));
+  }
+  for(UInt l=0; l<simdsize; l++){
+    for(UInt k=0; k<n; k++){
+      addStmtToIRSB(diffenv->sb_out,IRStmt_Store(Iend_LE,DG_BAR_LANES_ADDR(DG_BAR_LANES_DIFF(l,k)),diff[l*n+k]));
+    }
+    if(bar_record_values){
+      addStmtToIRSB(diffenv->sb_out,IRStmt_Store(Iend_LE,DG_BAR_LANES_ADDR(DG_BAR_LANES_VALUE(l)),value[l]));
+    }
+  }
+  IRDirty* dd = unsafeIRDirty_0_N(
+        0, "dg_bar_writeToTapeLanes_call",
+        &dg_bar_writeToTapeLanes_call,
+        mkIRExprVec_3(IRExpr_Const(IRConst_U64(n)),IRExpr_Const(IRConst_U64(fpsize)),IRExpr_Const(IRConst_U64(simdsize))) );
+  addStmtToIRSB(diffenv->sb_out, IRStmt_Dirty(dd));
+  IRTemp exLo_tmp = newIRTemp(diffenv->sb_out->tyenv,type);
+  IRTemp exHi_tmp = newIRTemp(diffenv->sb_out->tyenv,type);
+  addStmtToIRSB(diffenv->sb_out,IRStmt_WrTmp(exLo_tmp,IRExpr_Load(Iend_LE,type,DG_BAR_LANES_ADDR(DG_BAR_LANES_RESULT(0)))));
+  addStmtToIRSB(diffenv->sb_out,IRStmt_WrTmp(exHi_tmp,IRExpr_Load(Iend_LE,type,DG_BAR_LANES_ADDR(DG_BAR_LANES_RESULT(1)))));
+  #undef DG_BAR_LANES_ADDR
+  return mkIRExprVec_2(IRExpr_RdTmp(exLo_tmp),IRExpr_RdTmp(exHi_tmp));
+}
+
 void* dg_bar_operation(DiffEnv* diffenv, IROp op,
                          IRExpr* arg1, IRExpr* arg2, IRExpr* arg3, IRExpr* arg4,
                          void* i1, void* i2, void* i3, void* i4){
@@ -395,11 +585,15 @@ void dg_bar_handle_statement(DiffEnv* diffenv, IRStmt* st_orig){
 
 void dg_bar_initialize(void){
   dg_bar_shadow_mem_buffer = VG_(malloc)("dg_bar_shadow_mem_buffer",2*sizeof(V256));
+  dg_bar_tape_staging_buffer = VG_(malloc)("dg_bar_tape_staging_buffer",(3*DG_BAR_STAGING_OPERANDS+1)*sizeof(ULong));
+  dg_bar_tape_lane_buffer = VG_(malloc)("dg_bar_tape_lane_buffer",DG_BAR_LANES_SIZE);
   dg_bar_shadowInit();
 }
 
 void dg_bar_finalize(void){
   VG_(free)(dg_bar_shadow_mem_buffer);
+  VG_(free)(dg_bar_tape_staging_buffer);
+  VG_(free)(dg_bar_tape_lane_buffer);
   dg_bar_shadowFini();
 }
 
@@ -0,0 +1,237 @@
+/*--------------------------------------------------------------------*/
+/*--- Recording-mode index management.              dg_bar_index.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_machine.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_oset.h"
+#include "pub_tool_guest.h"
+
+#include "dg_bar_index.h"
+#include "dg_bar_shadow.h"
+
+/*! \page index_reuse Index reuse
+ *
+ *  By default, every tape statement gets a new index, so the adjoint vector
+ *  needed for the evaluation is as large as the tape. With --index-reuse=yes,
+ *  indices that are no longer stored in shadow memory or shadow registers
+ *  are recycled for new statements, and the compact tape stores the index
+ *  of the left-hand side explicitly for every statement. The adjoint vector
+ *  then scales with the number of simultaneously live indices.
+ *
+ *  Indices that are not live anymore are found by a conservative
+ *  mark-and-sweep collection. It scans all 64 KiB chunks of shadow memory
+ *  that have ever been written, and the shadow registers of all threads,
+ *  and interprets the Lo and Hi layers at every byte offset as a potential
+ *  index. An index may thus be kept alive by accident. As shadow temporaries do not survive the end of a
+ *  superblock, the collection runs in a dirty call at the beginning of a
+ *  superblock, and only if the number of fresh indices handed out since the
+ *  last collection exceeds the number of indices that were live after it
+ *  (or a minimal threshold). Hence, the cost of the scans is amortized over
+ *  the recorded statements, as long as the written shadow memory is not
+ *  much larger than the set of live indices.
+ *
+ *  Indices that the client keeps only in ordinary memory cannot be found
+ *  by the scans. Therefore, an index returned by DG_NEW_INDEX or
+ *  DG_NEW_INDEX_N is held until the client stores it in shadow memory by
+ *  DG_SET_INDEX, as the math function wrappers do right away. Indices
+ *  never passed to DG_SET_INDEX, e.g. by DG_OUTPUT, stay held. Indices of
+ *  statements without operands, i.e. inputs, and indices written to the
+ *  input or output index files are pinned, i.e. never recycled.
+ */
+
+//! Minimal number of fresh indices between two collections.
+#define DG_INDEX_MIN_THRESHOLD (1ull<<22)
+//! Size of a chunk of shadow memory tracked by the index manager.
+#define DG_INDEX_CHUNKBITS 16
+#define DG_INDEX_CHUNKSIZE (1ul<<DG_INDEX_CHUNKBITS)
+#define DG_INDEX_PINNED 1 //!< Flag for indices that must never be recycled.
+#define DG_INDEX_LIVE 2 //!< Flag set by the mark phase.
+#define DG_INDEX_HELD 4 //!< Flag for indices that the client might keep outside of shadow memory.
+
+Bool dg_bar_index_track_writes = False;
+
+static ULong index_fresh = 1; //!< Smallest index that has never been handed out.
+static UChar* index_flags; //!< Flags of every index handed out so far.
+static ULong index_capacity = 0; //!< Allocated size of index_flags.
+static ULong* index_free; //!< Stack of indices that can be recycled.
+static ULong index_free_count = 0; //!< Number of indices in index_free.
+static ULong index_fresh_since_collection = 0;
+static ULong index_threshold = DG_INDEX_MIN_THRESHOLD;
+
+//! Set when enough fresh indices have been handed out, read by the guard of the collection.
+static UChar index_collection_requested = 0;
+
+static OSet* index_chunks; //!< Numbers of the shadow memory chunks that have been written.
+static Addr index_last_chunk = ~(Addr)0; //!< Most recently inserted chunk number.
+static UChar* index_scan_Lo; //!< Buffers for scans of shadow memory and registers.
+static UChar* index_scan_Hi;
+
+void dg_bar_index_initialize(void){
+  index_capacity = 1024*1024;
+  index_flags = VG_(malloc)("Index flags", index_capacity);
+  VG_(memset)(index_flags, 0, index_capacity);
+  index_free = VG_(malloc)("Free indices", index_capacity*sizeof(ULong));
+  index_chunks = VG_(OSetWord_Create)(VG_(malloc), "Written shadow memory chunks", VG_(free));
+  ULong scansize = DG_INDEX_CHUNKSIZE;
+  if(scansize < sizeof(VexGuestArchState)) scansize = sizeof(VexGuestArchState);
+  index_scan_Lo = VG_(malloc)("Index scan buffer", scansize+8);
+  index_scan_Hi = VG_(malloc)("Index scan buffer", scansize+8);
+  dg_bar_index_track_writes = True;
+}
+
+void dg_bar_index_finalize(void){
+  dg_bar_index_track_writes = False;
+  VG_(free)(index_flags);
+  VG_(free)(index_free);
+  VG_(OSetWord_Destroy)(index_chunks);
+  VG_(free)(index_scan_Lo);
+  VG_(free)(index_scan_Hi);
+}
+
+ULong dg_bar_index_new(Bool pin){
+  if(!pin && index_free_count>0){
+    return index_free[--index_free_count];
+  }
+  ULong index = index_fresh++;
+  if(index==index_capacity){
+    index_flags = VG_(realloc)("Index flags", index_flags, 2*index_capacity);
+    VG_(memset)(index_flags+index_capacity, 0, index_capacity);
+    index_capacity *= 2;
+    index_free = VG_(realloc)("Free indices", index_free, index_capacity*sizeof(ULong));
+  }
+  if(pin) index_flags[index] |= DG_INDEX_PINNED;
+  if(++index_fresh_since_collection >= index_threshold){
+    index_collection_requested = 1;
+  }
+  return index;
+}
+
+void dg_bar_index_pin(ULong index){
+  if(index>0 && index<index_fresh) index_flags[index] |= DG_INDEX_PINNED;
+}
+
+void dg_bar_index_hold(ULong index){
+  if(index>0 && index<index_fresh) index_flags[index] |= DG_INDEX_HELD;
+}
+
+void dg_bar_index_release(ULong index){
+  if(index>0 && index<index_fresh) index_flags[index] &= ~DG_INDEX_HELD;
+}
+
+ULong dg_bar_index_count(void){
+  return index_fresh;
+}
+
+void dg_bar_index_note_write(Addr sm_address, int size){
+  Addr first = sm_address >> DG_INDEX_CHUNKBITS;
+  Addr last = (sm_address+size-1) >> DG_INDEX_CHUNKBITS;
+  for(Addr chunk=first; chunk<=last; chunk++){
+    if(chunk!=index_last_chunk){
+      if(!VG_(OSetWord_Contains)(index_chunks, chunk)){
+        VG_(OSetWord_Insert)(index_chunks, chunk);
+      }
+      index_last_chunk = chunk;
+    }
+  }
+}
+
+/*! Mark all indices found at some byte offset in the Lo and Hi layers.
+ *  \param size - Number of offsets to be scanned; the buffers must
+ *    contain 7 more bytes.
+ */
+static void dg_bar_index_mark(ULong size){
+  for(ULong offset=0; offset<size; offset++){
+    UInt lo, hi;
+    VG_(memcpy)(&lo, index_scan_Lo+offset, 4);
+    VG_(memcpy)(&hi, index_scan_Hi+offset, 4);
+    ULong index = (ULong)lo | ((ULong)hi<<32);
+    if(index>0 && index<index_fresh) index_flags[index] |= DG_INDEX_LIVE;
+  }
+}
+
+/*! Determine the live indices and rebuild the stack of free indices.
+ */
+static VG_REGPARM(0) void dg_bar_index_collect(void){
+  for(ULong index=1; index<index_fresh; index++){
+    index_flags[index] &= ~DG_INDEX_LIVE;
+  }
+  // mark indices in shadow memory
+  UWord chunk;
+  VG_(OSetWord_ResetIter)(index_chunks);
+  while(VG_(OSetWord_Next)(index_chunks, &chunk)){
+    dg_bar_shadowGet((void*)(chunk<<DG_INDEX_CHUNKBITS), index_scan_Lo, index_scan_Hi, DG_INDEX_CHUNKSIZE+7);
+    dg_bar_index_mark(DG_INDEX_CHUNKSIZE);
+  }
+  // mark indices in shadow registers
+  ThreadId tid;
+  Addr stack_min, stack_max;
+  VG_(thread_stack_reset_iter)(&tid);
+  while(VG_(thread_stack_next)(&tid, &stack_min, &stack_max)){
+    VG_(memset)(index_scan_Lo, 0, sizeof(VexGuestArchState)+8);
+    VG_(memset)(index_scan_Hi, 0, sizeof(VexGuestArchState)+8);
+    VG_(get_shadow_regs_area)(tid, index_scan_Lo, 1, 0, sizeof(VexGuestArchState));
+    VG_(get_shadow_regs_area)(tid, index_scan_Hi, 2, 0, sizeof(VexGuestArchState));
+    dg_bar_index_mark(sizeof(VexGuestArchState));
+  }
+  // sweep
+  ULong live = 0;
+  index_free_count = 0;
+  for(ULong index=index_fresh-1; index>0; index--){
+    if(index_flags[index]!=0) live++;
+    else index_free[index_free_count++] = index;
+  }
+  index_fresh_since_collection = 0;
+  index_threshold = live > DG_INDEX_MIN_THRESHOLD ? live : DG_INDEX_MIN_THRESHOLD;
+  index_collection_requested = 0;
+}
+
+void dg_bar_index_add_collection(IRSB* sb_out){
+  IRTemp requested = newIRTemp(sb_out->tyenv, Ity_I8);
+  #ifdef BUILD_32BIT
+  IRExpr* requested_addr = IRExpr_Const(IRConst_U32((Addr)&index_collection_requested));
+  #else
+  IRExpr* requested_addr = IRExpr_Const(IRConst_U64((Addr)&index_collection_requested));
+  #endif
+  addStmtToIRSB(sb_out, IRStmt_WrTmp(requested, IRExpr_Load(Iend_LE, Ity_I8, requested_addr)));
+  IRTemp guard = newIRTemp(sb_out->tyenv, Ity_I1);
+  addStmtToIRSB(sb_out, IRStmt_WrTmp(guard,
+    IRExpr_Binop(Iop_CmpNE8, IRExpr_RdTmp(requested), IRExpr_Const(IRConst_U8(0)))));
+  IRDirty* dd = unsafeIRDirty_0_N(
+        0, "dg_bar_index_collect",
+        &dg_bar_index_collect,
+        mkIRExprVec_0());
+  dd->guard = IRExpr_RdTmp(guard);
+  addStmtToIRSB(sb_out, IRStmt_Dirty(dd));
+}
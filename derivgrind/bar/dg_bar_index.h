@@ -0,0 +1,97 @@
+/*--------------------------------------------------------------------*/
+/*--- Recording-mode index management.              dg_bar_index.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef DG_BAR_INDEX_H
+#define DG_BAR_INDEX_H
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! If true, dg_bar_shadowSet reports writes to dg_bar_index_note_write.
+ */
+extern Bool dg_bar_index_track_writes;
+
+/*! Prepare the index manager for --index-reuse=yes.
+ */
+void dg_bar_index_initialize(void);
+
+/*! Free the data structures of the index manager.
+ */
+void dg_bar_index_finalize(void);
+
+/*! Obtain an index for the result of a new tape statement.
+ *  \param pin - If true, the index is neither recycled nor ever freed.
+ *  \returns Recycled index if one is available, or a fresh index.
+ */
+ULong dg_bar_index_new(Bool pin);
+
+/*! Prevent an index from being recycled, because it has been
+ *  written to the input or output index file.
+ */
+void dg_bar_index_pin(ULong index);
+
+/*! Prevent an index from being recycled until dg_bar_index_release is
+ *  called, because it has been returned by a client request.
+ */
+void dg_bar_index_hold(ULong index);
+
+/*! Allow an index to be recycled again once it cannot be found
+ *  in shadow memory, because the client has stored it there.
+ */
+void dg_bar_index_release(ULong index);
+
+/*! Number of indices that have been handed out so far, plus one.
+ *
+ *  This is the size of the adjoint vector needed to evaluate the tape.
+ */
+ULong dg_bar_index_count(void);
+
+/*! Remember that shadow memory has been written, so the
+ *  garbage collector scans it for live indices.
+ *  \param sm_address - Address of the first written byte.
+ *  \param size - Number of written bytes.
+ */
+void dg_bar_index_note_write(Addr sm_address, int size);
+
+/*! Add a guarded dirty call to the beginning of a superblock that
+ *  collects unused indices if enough fresh indices have been handed out.
+ */
+void dg_bar_index_add_collection(IRSB* sb_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DG_BAR_INDEX_H
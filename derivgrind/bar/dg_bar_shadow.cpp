@@ -33,6 +33,7 @@
 #include "externals/flexible-shadow/flexible-shadow-valgrindstdlib.hpp"
 #include <pub_tool_libcbase.h>
 #include "dg_utils.h"
+#include "dg_bar_index.h"
 
 #ifndef SHADOW_LAYERS_32
   #define SHADOW_LAYERS_32 18,14
@@ -81,6 +82,7 @@ extern "C" void dg_bar_shadowGet(void* sm_address, void* real_address_Lo, void*
 }
 
 extern "C" void dg_bar_shadowSet(void* sm_address, void* real_address_Lo, void* real_address_Hi, int size){
+  if(dg_bar_index_track_writes) dg_bar_index_note_write((Addr)sm_address, size);
   ShadowLeafBar* leaf = sm_bar2->leaf_for_write((Addr)sm_address);
   Addr contiguousSize = sm_bar2->contiguousElements((Addr)sm_address);
   ULong index = sm_bar2->index((Addr)sm_address);
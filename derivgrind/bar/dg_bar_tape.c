@@ -33,9 +33,11 @@
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcfile.h"
+#include "pub_tool_libcproc.h"
 #include "pub_tool_vki.h"
 #include "pub_tool_libcfile.h"
 #include "pub_tool_libcprint.h"
+#include "pub_tool_aspacemgr.h"
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_stacktrace.h"
 #include "pub_tool_libcprint.h"
@@ -45,28 +47,645 @@
 
 
 #include "dg_bar_tape.h"
+#include "dg_bar_tape_format.h"
+#include "dg_bar_index.h"
 
 static ULong nextindex = 1;
 
 //! Number of tape blocks fitting into the buffer.
-#define BUFSIZE 1000000
+//! A power of two, so buffers can be mapped at page-aligned file offsets.
+#define BUFSIZE (1ull<<20)
 
 //! Buffer for tape blocks.
 static ULong* buffer_tape;
+//! Position of the next block in buffer_tape; block 0 is the dummy block.
+static ULong tape_pos = 1;
 
 //! Buffer for values.
 static ULong* buffer_values;
 
 static Int fd_tape;
 static Int fd_values;
-static VgFile *fp_inputs, *fp_outputs;
+//! Index files for inputs (0) and outputs (1), with --index-format=text.
+static VgFile* fp_indices[2];
+//! Index files for inputs (0) and outputs (1), with --index-format=binary.
+static Int fd_indices[2];
+//! Buffered indices for --index-format=binary.
+#define INDEXBUFSIZE 512
+static ULong index_buffer[2][INDEXBUFSIZE];
+static ULong index_count[2];
 
 extern Long* dg_disable;
 extern Bool typegrind;
 extern Bool bar_record_values;
 extern Bool tape_in_ram;
+extern Int tape_fd;
+extern Bool tape_background_writer;
+extern Bool tape_compact;
+extern Bool tape_index_reuse;
+extern Bool tape_per_thread;
+extern Bool tape_peephole;
+extern Bool index_binary;
 extern const ULong* recording_stop_indices;
 
+/*! \page compact_encoder Compact tape encoder
+ *
+ *  With --tape-format=compact, tape buffers are encoded as described in
+ *  dg_bar_tape_format.h right before they are written. Blocks are recorded
+ *  into buffer_tape in the raw layout as usual, so the encoding does not
+ *  slow the recording of a single operation down, and it is performed by
+ *  the writer process if there is one.
+ *
+ *  With --index-reuse=yes, every statement is staged with its left-hand
+ *  side index, and the encoder stores the latter before the tag byte.
+ */
+
+//! Size of the buffer for encoded blocks.
+#define COMPACT_BUFSIZE (1<<20)
+//! Upper bound for the number of bytes of an encoded statement with n operands.
+#define COMPACT_MAXBLOCKSIZE(n) (10+1+10+(n)*(1+10+8))
+
+static UChar* compact_buffer; //!< Encoded blocks that have not yet been written.
+static ULong compact_pos = 0; //!< Number of bytes in compact_buffer.
+static ULong compact_fileoffset = 0; //!< Number of bytes written to the tape file.
+static ULong compact_nextblock = 0; //!< Index of the next block to be encoded.
+static ULong* compact_chunkoffsets; //!< File offsets of the chunks encoded so far.
+static ULong compact_chunkcapacity = 0; //!< Allocated size of compact_chunkoffsets.
+static ULong compact_maxindex = 0; //!< Largest left-hand side index encoded so far.
+
+static void compact_putvarint(ULong value){
+  while(value>=0x80){
+    compact_buffer[compact_pos++] = (UChar)(value|0x80);
+    value >>= 7;
+  }
+  compact_buffer[compact_pos++] = (UChar)value;
+}
+
+static void compact_putraw(ULong value){
+  VG_(memcpy)(compact_buffer+compact_pos, &value, sizeof(ULong));
+  compact_pos += sizeof(ULong);
+}
+
+static UInt compact_diffclass(ULong index, ULong diff){
+  if(index==0) return DG_TAPE_TAG_ABSENT;
+  else if(diff==DG_TAPE_PLUSONE_BITS) return DG_TAPE_TAG_PLUSONE;
+  else if(diff==DG_TAPE_MINUSONE_BITS) return DG_TAPE_TAG_MINUSONE;
+  else return DG_TAPE_TAG_RAW;
+}
+
+static void compact_flush(Int fd){
+  VG_(write)(fd, compact_buffer, compact_pos);
+  compact_fileoffset += compact_pos;
+  compact_pos = 0;
+}
+
+/*! Allocate the encoder buffer and write the header of a compact tape.
+ */
+static void compact_initialize(Int fd){
+  compact_buffer = VG_(malloc)("Compact tape buffer", COMPACT_BUFSIZE);
+  compact_chunkcapacity = 1024;
+  compact_chunkoffsets = VG_(malloc)("Compact tape offsets", compact_chunkcapacity*sizeof(ULong));
+  ULong header[4] = {DG_TAPE_COMPACT_MAGIC, DG_TAPE_COMPACT_CHUNKSIZE, tape_index_reuse ? DG_TAPE_FLAG_EXPLICIT_LHS : 0, 0};
+  VG_(write)(fd, header, sizeof(header));
+  compact_fileoffset = sizeof(header);
+}
+
+/*! Encode a statement.
+ *  \param lhs - Index of the result.
+ *  \param n - Number of operands, including inactive ones.
+ *  \param indices - Operand indices.
+ *  \param diffs - Binary representations of the partial derivatives.
+ */
+static void compact_write_statement(Int fd, ULong lhs, ULong n, const ULong* indices, const ULong* diffs){
+  if(compact_pos > COMPACT_BUFSIZE-COMPACT_MAXBLOCKSIZE(n)) compact_flush(fd);
+  if(compact_nextblock%DG_TAPE_COMPACT_CHUNKSIZE==0){
+    ULong chunk = compact_nextblock/DG_TAPE_COMPACT_CHUNKSIZE;
+    if(chunk==compact_chunkcapacity){
+      compact_chunkcapacity *= 2;
+      compact_chunkoffsets = VG_(realloc)("Compact tape offsets", compact_chunkoffsets, compact_chunkcapacity*sizeof(ULong));
+    }
+    compact_chunkoffsets[chunk] = compact_fileoffset + compact_pos;
+  }
+  compact_nextblock++;
+  if(tape_index_reuse){
+    compact_putvarint(lhs);
+    if(lhs>compact_maxindex) compact_maxindex = lhs;
+  }
+  // inactive operands do not need to be stored
+  ULong active = 0;
+  for(ULong j=0; j<n; j++){
+    if(indices[j]!=0) active++;
+  }
+  if(active<=2 && n<=2){
+    ULong index1 = n>0 ? indices[0] : 0, index2 = n>1 ? indices[1] : 0;
+    ULong diff1 = n>0 ? diffs[0] : 0, diff2 = n>1 ? diffs[1] : 0;
+    UInt class1 = compact_diffclass(index1, diff1);
+    UInt class2 = compact_diffclass(index2, diff2);
+    UInt tag = class1 | (class2<<2);
+    if(index1>=lhs) tag |= DG_TAPE_TAG_INDEX1_ABS;
+    if(index2>=lhs) tag |= DG_TAPE_TAG_INDEX2_ABS;
+    compact_buffer[compact_pos++] = (UChar)tag;
+    if(class1!=DG_TAPE_TAG_ABSENT) compact_putvarint( (tag&DG_TAPE_TAG_INDEX1_ABS) ? index1 : lhs-index1 );
+    if(class2!=DG_TAPE_TAG_ABSENT) compact_putvarint( (tag&DG_TAPE_TAG_INDEX2_ABS) ? index2 : lhs-index2 );
+    if(class1==DG_TAPE_TAG_RAW) compact_putraw(diff1);
+    if(class2==DG_TAPE_TAG_RAW) compact_putraw(diff2);
+    return;
+  }
+  compact_buffer[compact_pos++] = (UChar)DG_TAPE_TAG_NARY;
+  compact_putvarint(active);
+  for(ULong j=0; j<n; j++){
+    ULong index = indices[j];
+    if(index==0) continue;
+    UInt diffclass = compact_diffclass(index, diffs[j]);
+    UInt abs = (index>=lhs) ? DG_TAPE_TAG_INDEX1_ABS : 0;
+    compact_buffer[compact_pos++] = (UChar)(diffclass|abs);
+    compact_putvarint( abs ? index : lhs-index );
+    if(diffclass==DG_TAPE_TAG_RAW) compact_putraw(diffs[j]);
+  }
+}
+
+/*! Encode blocks in the raw layout and write them to a compact tape.
+ *  \param fd - Tape file.
+ *  \param blocks - Raw blocks, 4 ULongs each, possibly including staged statements.
+ *  \param count - Number of blocks.
+ */
+static void compact_write(Int fd, const ULong* blocks, ULong count){
+  for(ULong b=0; b<count; b++){
+    if(blocks[4*b]==DG_TAPE_STAGING_NARY){
+      ULong n = blocks[4*b+1];
+      ULong lhs = blocks[4*b+2]!=0 ? blocks[4*b+2] : compact_nextblock;
+      const ULong* pairs = blocks+4*(b+1);
+      ULong indices[DG_TAPE_MAX_OPERANDS], diffs[DG_TAPE_MAX_OPERANDS];
+      for(ULong j=0; j<n; j++){
+        indices[j] = pairs[4*(j/2)+(j%2)];
+        diffs[j] = pairs[4*(j/2)+2+(j%2)];
+      }
+      compact_write_statement(fd, lhs, n, indices, diffs);
+      b += (n+1)/2;
+    } else {
+      compact_write_statement(fd, compact_nextblock, 2, blocks+4*b, blocks+4*b+2);
+    }
+  }
+}
+
+/*! Write the offset table and the footer of a compact tape.
+ */
+static void compact_finalize(Int fd){
+  compact_flush(fd);
+  ULong number_of_chunks = (compact_nextblock+DG_TAPE_COMPACT_CHUNKSIZE-1)/DG_TAPE_COMPACT_CHUNKSIZE;
+  ULong footer[4] = {compact_nextblock, number_of_chunks, compact_fileoffset, DG_TAPE_COMPACT_MAGIC};
+  VG_(write)(fd, compact_chunkoffsets, number_of_chunks*sizeof(ULong));
+  if(tape_index_reuse){
+    ULong number_of_indices = compact_maxindex+1;
+    VG_(write)(fd, &number_of_indices, sizeof(ULong));
+  }
+  VG_(write)(fd, footer, sizeof(footer));
+  VG_(free)(compact_chunkoffsets);
+  VG_(free)(compact_buffer);
+}
+
+/*! Write blocks in the raw layout to the tape file, encoding them if necessary.
+ */
+static void tape_write_blocks(Int fd, const ULong* blocks, ULong count){
+  if(tape_compact){
+    compact_write(fd, blocks, count);
+  } else {
+    VG_(write)(fd, blocks, count*4*sizeof(ULong));
+  }
+}
+
+/*! \page background_writer Background tape writer
+ *
+ *  With --tape-background-writer=yes, full tape and values buffers are
+ *  not written by the recording process itself. Instead, the buffers are
+ *  slots of a ring that lives in a shared mapping, and a writer process
+ *  forked in dg_bar_tape_initialize performs the VG_(write) calls.
+ *
+ *  When a buffer is full, the recording process sends the slot number to the
+ *  writer via a pipe and continues recording into the next slot. Only if the
+ *  next slot has not yet been written (i.e. the writer lags behind by
+ *  TAPE_WRITER_SLOTS buffers), the recording process waits for the writer's
+ *  acknowledgement on a second pipe. dg_bar_tape_finalize submits the
+ *  partially filled buffers, tells the writer to terminate, and waits
+ *  for it.
+ */
+
+//! Number of slots per stream in the ring shared with the writer process.
+#define TAPE_WRITER_SLOTS 4
+
+//! Streams handled by the writer process.
+enum { TAPE_STREAM_TAPE=0, TAPE_STREAM_VALUES=1, TAPE_STREAM_COUNT=2 };
+
+//! Message passed from the recording process to the writer process, and back.
+typedef struct {
+  UInt stream; //!< TAPE_STREAM_TAPE or TAPE_STREAM_VALUES.
+  UInt slot; //!< Slot within the stream's ring.
+  ULong size; //!< Number of bytes to be written; 0 terminates the writer.
+} TapeWriterMessage;
+
+static Int tape_writer_pid = 0;
+static Int tape_writer_cmd[2]; //!< Pipe from recording process to writer.
+static Int tape_writer_ack[2]; //!< Pipe from writer to recording process.
+static UChar* tape_writer_ring[TAPE_STREAM_COUNT]; //!< Slots of each stream, in the shared mapping.
+static ULong tape_writer_slotsize[TAPE_STREAM_COUNT]; //!< Size of a slot in bytes.
+static UInt tape_writer_current[TAPE_STREAM_COUNT]; //!< Slot currently filled by the recording process.
+static Bool tape_writer_busy[TAPE_STREAM_COUNT][TAPE_WRITER_SLOTS]; //!< Slot has been submitted but not yet written.
+
+/*! Main loop of the writer process, never returns.
+ */
+static void tape_writer_loop(void){
+  Int fd[TAPE_STREAM_COUNT] = {fd_tape, fd_values};
+  VG_(close)(tape_writer_cmd[1]);
+  VG_(close)(tape_writer_ack[0]);
+  while(True){
+    TapeWriterMessage msg;
+    if(VG_(read)(tape_writer_cmd[0],&msg,sizeof(msg))!=sizeof(msg)) break;
+    if(msg.size==0) break;
+    UChar* slot = tape_writer_ring[msg.stream]+msg.slot*tape_writer_slotsize[msg.stream];
+    if(msg.stream==TAPE_STREAM_TAPE){
+      tape_write_blocks(fd[msg.stream], (ULong*)slot, msg.size/(4*sizeof(ULong)));
+    } else {
+      VG_(write)(fd[msg.stream], slot, msg.size);
+    }
+    VG_(write)(tape_writer_ack[1],&msg,sizeof(msg));
+  }
+  if(tape_compact) compact_finalize(fd_tape);
+  VG_(exit)(0);
+}
+
+/*! Block until the writer has acknowledged at least one slot.
+ */
+static void tape_writer_wait(void){
+  TapeWriterMessage msg;
+  if(VG_(read)(tape_writer_ack[0],&msg,sizeof(msg))!=sizeof(msg)){
+    VG_(printf)("Background tape writer terminated unexpectedly.\n"); tl_assert(False);
+  }
+  tape_writer_busy[msg.stream][msg.slot] = False;
+}
+
+/*! Hand the current slot of a stream over to the writer process.
+ *  \param stream - TAPE_STREAM_TAPE or TAPE_STREAM_VALUES.
+ *  \param size - Number of bytes in the slot to be written.
+ *  \returns Pointer to the next slot, which is free to be filled.
+ */
+static void* tape_writer_submit(UInt stream, ULong size){
+  TapeWriterMessage msg = {stream, tape_writer_current[stream], size};
+  tape_writer_busy[stream][msg.slot] = True;
+  VG_(write)(tape_writer_cmd[1],&msg,sizeof(msg));
+  UInt next = (msg.slot+1)%TAPE_WRITER_SLOTS;
+  while(tape_writer_busy[stream][next]) tape_writer_wait();
+  tape_writer_current[stream] = next;
+  return tape_writer_ring[stream]+next*tape_writer_slotsize[stream];
+}
+
+/*! Allocate the shared ring and fork the writer process.
+ */
+static void tape_writer_initialize(void){
+  tape_writer_slotsize[TAPE_STREAM_TAPE] = BUFSIZE*4*sizeof(ULong);
+  tape_writer_slotsize[TAPE_STREAM_VALUES] = bar_record_values ? BUFSIZE*sizeof(ULong) : 0;
+  ULong ringsize = TAPE_WRITER_SLOTS*(tape_writer_slotsize[TAPE_STREAM_TAPE]+tape_writer_slotsize[TAPE_STREAM_VALUES]);
+  // The ring is a shared mapping of an unlinked temporary file, like the
+  // memory shared between Valgrind's gdbserver and vgdb.
+  HChar ringname[VG_(strlen)(VG_(tmpdir)())+100];
+  VG_(sprintf)(ringname, "%s/dg-tape-ring-%d", VG_(tmpdir)(), VG_(getpid)());
+  Int fd_ring = VG_(fd_open)(ringname,VKI_O_RDWR|VKI_O_CREAT|VKI_O_TRUNC,0600);
+  if(fd_ring==-1){
+    VG_(printf)("Cannot open ring file at path '%s'.\n", ringname); tl_assert(False);
+  }
+  UChar zero = 0;
+  VG_(lseek)(fd_ring, ringsize-1, VKI_SEEK_SET);
+  VG_(write)(fd_ring, &zero, 1);
+  SysRes res = VG_(am_shared_mmap_file_float_valgrind)(ringsize, VKI_PROT_READ|VKI_PROT_WRITE, fd_ring, 0);
+  VG_(close)(fd_ring);
+  VG_(unlink)(ringname);
+  if(sr_isError(res)){
+    VG_(printf)("Cannot map ring for background tape writer.\n"); tl_assert(False);
+  }
+  tape_writer_ring[TAPE_STREAM_TAPE] = (UChar*)sr_Res(res);
+  tape_writer_ring[TAPE_STREAM_VALUES] = tape_writer_ring[TAPE_STREAM_TAPE] + TAPE_WRITER_SLOTS*tape_writer_slotsize[TAPE_STREAM_TAPE];
+  for(UInt stream=0; stream<TAPE_STREAM_COUNT; stream++){
+    tape_writer_current[stream] = 0;
+    for(UInt slot=0; slot<TAPE_WRITER_SLOTS; slot++) tape_writer_busy[stream][slot] = False;
+  }
+
+  if(VG_(pipe)(tape_writer_cmd)!=0 || VG_(pipe)(tape_writer_ack)!=0){
+    VG_(printf)("Cannot create pipes for background tape writer.\n"); tl_assert(False);
+  }
+  tape_writer_pid = VG_(fork)();
+  if(tape_writer_pid<0){
+    VG_(printf)("Cannot fork background tape writer.\n"); tl_assert(False);
+  } else if(tape_writer_pid==0){
+    tape_writer_loop();
+  }
+  VG_(close)(tape_writer_cmd[0]);
+  VG_(close)(tape_writer_ack[1]);
+}
+
+/*! Submit the partially filled slots, terminate the writer and wait for it.
+ *  \param size_tape - Number of bytes in the current tape slot.
+ *  \param size_values - Number of bytes in the current values slot.
+ */
+static void tape_writer_finalize(ULong size_tape, ULong size_values){
+  if(size_tape>0) tape_writer_submit(TAPE_STREAM_TAPE, size_tape);
+  if(size_values>0) tape_writer_submit(TAPE_STREAM_VALUES, size_values);
+  TapeWriterMessage msg = {0,0,0};
+  VG_(write)(tape_writer_cmd[1],&msg,sizeof(msg));
+  VG_(close)(tape_writer_cmd[1]);
+  Int status;
+  VG_(waitpid)(tape_writer_pid, &status, 0);
+  VG_(close)(tape_writer_ack[0]);
+}
+
+/*! \page tape_in_ram In-RAM tape
+ *
+ *  With --tape-in-ram=yes and the raw format, the tape buffer is a shared
+ *  mapping of the tape file, so the blocks are recorded directly into its
+ *  pages and no write calls are needed. When the buffer is full, it is
+ *  unmapped, the file is extended and the next BUFSIZE blocks are mapped.
+ *  If the tape file is an inherited memfd (--tape-fd), the tape thus lives
+ *  in RAM only, and the evaluator can map the same pages at the end.
+ */
+
+//! File offset of the tape buffer mapped with --tape-in-ram=yes.
+static ULong tape_ram_offset = 0;
+
+/*! Extend the tape file by BUFSIZE blocks and map them as tape buffer.
+ */
+static void tape_ram_map(void){
+  ULong size = BUFSIZE*4*sizeof(ULong);
+  if(VG_(ftruncate)(fd_tape, tape_ram_offset+size)!=0){
+    VG_(printf)("Cannot extend in-RAM tape.\n"); tl_assert(False);
+  }
+  SysRes res = VG_(am_shared_mmap_file_float_valgrind)(size, VKI_PROT_READ|VKI_PROT_WRITE, fd_tape, tape_ram_offset);
+  if(sr_isError(res)){
+    VG_(printf)("Cannot map in-RAM tape.\n"); tl_assert(False);
+  }
+  buffer_tape = (ULong*)sr_Res(res);
+}
+
+/*! Unmap the tape buffer and cut the tape file after the recorded blocks.
+ */
+static void tape_ram_unmap(void){
+  VG_(am_munmap_valgrind)((Addr)buffer_tape, BUFSIZE*4*sizeof(ULong));
+  VG_(ftruncate)(fd_tape, tape_ram_offset+tape_pos*4*sizeof(ULong));
+}
+
+/*! Hand the filled part of the tape buffer over to the file or writer
+ *  process, and continue recording into an empty buffer.
+ */
+static void tape_flush_buffer(void){
+  if(tape_in_ram && !tape_compact){
+    tape_ram_unmap();
+    tape_ram_offset += tape_pos*4*sizeof(ULong);
+    tape_ram_map();
+  } else if(tape_writer_pid>0){
+    buffer_tape = tape_writer_submit(TAPE_STREAM_TAPE, tape_pos*4*sizeof(ULong));
+  } else {
+    tape_write_blocks(fd_tape,buffer_tape,tape_pos);
+  }
+  tape_pos = 0;
+}
+
+/*! \page record_stop Stopping the recording at given indices
+ *
+ *  The indices given by --record-stop are sorted, and tape_finish_statement
+ *  only compares the index of the current statement with the next stop
+ *  index next_stop_index, which is -1 if there are no more stop indices.
+ *  The list itself is only walked in tape_record_stop.
+ */
+
+//! Number of stop indices given by --record-stop.
+static ULong stop_count = 0;
+//! Smallest stop index not less than the index of the next statement, or -1.
+static ULong next_stop_index = 0xffffffffffffffff;
+
+/*! Set next_stop_index after the current index has changed.
+ *
+ *  The indices of a thread increase one by one, so a linear search would
+ *  do, but with --per-thread-tapes=yes the index may also jump backwards.
+ */
+static void tape_update_stop_index(ULong index){
+  ULong lo = 0, hi = stop_count;
+  while(lo<hi){
+    ULong mid = (lo+hi)/2;
+    if(recording_stop_indices[mid]<index) lo = mid+1;
+    else hi = mid;
+  }
+  next_stop_index = (lo<stop_count) ? recording_stop_indices[lo] : 0xffffffffffffffff;
+}
+
+/*! \page per_thread_tapes Per-thread tapes
+ *
+ *  With --per-thread-tapes=yes, every thread records into its own tape
+ *  buffer and file, and indices of thread t are offset by
+ *  (t-1)<<DG_TAPE_THREAD_SHIFT, see dg_bar_tape_format.h. The globals
+ *  buffer_tape, tape_pos, nextindex and fd_tape belong to the thread
+ *  tape_tid; when another thread records a statement, they are swapped
+ *  with the saved state of that thread.
+ *
+ *  Whenever the recording thread changes, the segment of statements
+ *  recorded by the previous thread is appended to dg-tape-order, together
+ *  with a mask of the other threads whose results it has used. The
+ *  evaluator processes segments of different threads concurrently
+ *  unless their masks overlap.
+ */
+
+//! Saved recording state of a thread with --per-thread-tapes=yes.
+typedef struct {
+  ULong* buffer; //!< Tape buffer, or NULL if the thread has not recorded anything yet.
+  ULong pos; //!< Position of the next block in the buffer.
+  ULong nextindex; //!< Local index of the next statement.
+  Int fd; //!< Tape file.
+} ThreadTape;
+
+static ThreadTape* thread_tapes; //!< Saved states, indexed by ThreadId.
+static ThreadId tape_tid = 1; //!< Thread whose state is in the globals.
+static ULong tape_thread_base = 0; //!< Offset of the indices of thread tape_tid.
+static ULong segment_begin = 1; //!< Local index of the first statement of the current segment.
+static ULong segment_mask = 0; //!< Threads whose results the current segment uses.
+static Int fd_order; //!< Ordering records.
+static HChar* tape_directory; //!< Copy of the recording directory.
+
+/*! Remember that the current segment uses an operand, if it has been recorded by another thread.
+ */
+static inline void tape_note_operand(ULong index){
+  if(index!=0 && index<0x8000000000000000){
+    ULong thread = (index>>DG_TAPE_THREAD_SHIFT)+1;
+    if(thread!=tape_tid) segment_mask |= 1ull<<(thread%64);
+  }
+}
+
+/*! Append the current segment to the ordering records, if it is not empty.
+ */
+static void tape_finish_segment(void){
+  if(nextindex>segment_begin){
+    ULong record[4] = {tape_tid, segment_begin, nextindex, segment_mask};
+    VG_(write)(fd_order, record, sizeof(record));
+  }
+  segment_begin = nextindex;
+  segment_mask = 0;
+}
+
+/*! Save the recording state of the current thread and switch to another thread's tape.
+ */
+static void tape_switch_thread(ThreadId tid){
+  tape_finish_segment();
+  ThreadTape* tt = &thread_tapes[tape_tid];
+  tt->buffer = buffer_tape;
+  tt->pos = tape_pos;
+  tt->nextindex = nextindex;
+  tt->fd = fd_tape;
+  tt = &thread_tapes[tid];
+  if(tt->buffer==NULL){ // first statement of this thread
+    HChar filename[VG_(strlen)(tape_directory)+100];
+    VG_(sprintf)(filename, "%s/dg-tape-%u", tape_directory, tid);
+    tt->fd = VG_(fd_open)(filename,VKI_O_WRONLY|VKI_O_CREAT|VKI_O_TRUNC|VKI_O_LARGEFILE,0777);
+    if(tt->fd==-1){
+      VG_(printf)("Cannot open tape file at path '%s'.", filename ); tl_assert(False);
+    }
+    tt->buffer = VG_(malloc)("Tape buffer", BUFSIZE*4*sizeof(ULong));
+    for(ULong i=0; i<4*BUFSIZE; i++){
+      tt->buffer[i] = 0;
+    }
+    tt->pos = 1;
+    tt->nextindex = 1;
+  }
+  buffer_tape = tt->buffer;
+  tape_pos = tt->pos;
+  nextindex = tt->nextindex;
+  fd_tape = tt->fd;
+  tape_tid = tid;
+  tape_thread_base = (ULong)(tid-1)<<DG_TAPE_THREAD_SHIFT;
+  segment_begin = nextindex;
+  if(recording_stop_indices) tape_update_stop_index(tape_thread_base+nextindex);
+}
+
+/*! Write the tapes of all threads but the current one, and the last ordering record.
+ */
+static void tape_finalize_threads(void){
+  tape_finish_segment();
+  for(ThreadId tid=1; tid<VG_N_THREADS+1; tid++){
+    ThreadTape* tt = &thread_tapes[tid];
+    if(tid==tape_tid || tt->buffer==NULL) continue;
+    if(tt->pos>0) tape_write_blocks(tt->fd, tt->buffer, tt->pos);
+    VG_(close)(tt->fd);
+    VG_(free)(tt->buffer);
+  }
+  VG_(close)(fd_order);
+  VG_(free)(thread_tapes);
+  VG_(free)(tape_directory);
+}
+
+/*! Stop in the debugger if the next index is a stop index, and advance next_stop_index.
+ */
+static void __attribute__((noinline)) tape_record_stop(void){
+  ULong index = tape_thread_base+nextindex;
+  if(index==next_stop_index){
+    VG_(message)(Vg_UserMsg, "User-specified index has been reached (--record-stop).\n");
+    VG_(message)(Vg_UserMsg, "Index %llu assigned at\n",index);
+    VG_(get_and_pp_StackTrace)(VG_(get_running_tid)(), 16);
+    VG_(message)(Vg_UserMsg, "\n");
+    VG_(gdbserver)(VG_(get_running_tid)());
+  }
+  tape_update_stop_index(index+1);
+}
+
+/*! \page tape_peephole Peephole optimization of statements
+ *
+ *  With --tape-peephole=yes, statements are simplified before they are
+ *  written into the tape buffer:
+ *  - Operands with a partial derivative of exactly zero are dropped.
+ *  - If no operand is left, the result is passive and no block is written.
+ *  - If a single operand with a partial derivative of exactly one is left,
+ *    the result gets the index of the operand, and no block is written.
+ *  Derivatives are unaffected, but output indices may coincide with input
+ *  indices or with each other.
+ */
+
+static ULong peephole_zero_edges = 0; //!< Number of operands dropped by the peephole stage.
+static ULong peephole_passive = 0; //!< Number of statements found to be passive.
+static ULong peephole_identities = 0; //!< Number of statements forwarding an operand index.
+
+/*! Simplify a statement with two operands.
+ *  \param index1, index2, diff1, diff2 - Operands, dropped operands are set to zero.
+ *  \param result - Index of the result, if no block needs to be written.
+ *  \returns Whether no block needs to be written.
+ */
+static inline Bool tape_peephole_statement(ULong* index1, ULong* index2, double* diff1, double* diff2, ULong* result){
+  if(*index1==0 && *index2==0) return False; // input or passive statement
+  if(*index1!=0 && *diff1==0.){ *index1 = 0; peephole_zero_edges++; }
+  if(*index2!=0 && *diff2==0.){ *index2 = 0; peephole_zero_edges++; }
+  if(*index1==0 && *index2==0){
+    peephole_passive++;
+    *result = 0;
+    return True;
+  }
+  if(*index2==0 && *diff1==1.){
+    peephole_identities++;
+    *result = *index1;
+    return True;
+  }
+  if(*index1==0 && *diff2==1.){
+    peephole_identities++;
+    *result = *index2;
+    return True;
+  }
+  return False;
+}
+
+/*! Assign the next index to the statement that has just been written into the tape buffer.
+ *  \param unwrapped_operand - Whether an operand is the result of an unwrapped operation.
+ *  \param lhs - Index of the result if it has been staged explicitly, or 0.
+ *  \returns Index of the result.
+ */
+static ULong tape_finish_statement(Bool unwrapped_operand, ULong lhs){
+  if(UNLIKELY(tape_thread_base+nextindex>=next_stop_index)) tape_record_stop();
+  nextindex++;
+  if(tape_pos==BUFSIZE){
+    tape_flush_buffer();
+  }
+  ULong index = lhs!=0 ? lhs : tape_thread_base+nextindex-1;
+  if(unwrapped_operand){
+    VG_(message)(Vg_UserMsg, "Result of unwrapped operation used as input of differentiable operation.\n");
+    VG_(message)(Vg_UserMsg, "Index of result of differentiable operation: %llu.\n",index);
+    VG_(get_and_pp_StackTrace)(VG_(get_running_tid)(), 16);
+    VG_(message)(Vg_UserMsg, "\n");
+  }
+  return typegrind ? 0 : index;
+}
+
+/*! Stage a statement for the compact format, see dg_bar_tape_format.h.
+ *  \param m - Number of operands, all of which are active.
+ *  \param indices - Operand indices.
+ *  \param diffs - Partial derivatives.
+ *  \returns Index of the result.
+ */
+static ULong tape_stage_statement(UInt m, const ULong* indices, const double* diffs){
+  ULong blocks = 1+(m+1)/2;
+  if(tape_pos+blocks>BUFSIZE){
+    tape_flush_buffer();
+  }
+  // results of statements without operands are usually inputs
+  ULong lhs = tape_index_reuse ? dg_bar_index_new(m==0) : 0;
+  ULong* block = buffer_tape+4*tape_pos;
+  block[0] = DG_TAPE_STAGING_NARY;
+  block[1] = m;
+  block[2] = lhs;
+  block[3] = 0;
+  Bool unwrapped_operand = False;
+  for(UInt j=0; j<m; j++){
+    block[4+4*(j/2)+(j%2)] = indices[j];
+    block[4+4*(j/2)+2+(j%2)] = *(const ULong*)&diffs[j];
+    if(indices[j]==0xffffffffffffffff) unwrapped_operand = True;
+  }
+  if(m%2==1){
+    block[4+4*(m/2)+1] = 0;
+    block[4+4*(m/2)+3] = 0;
+  }
+  tape_pos += blocks;
+  return tape_finish_statement(unwrapped_operand, lhs);
+}
+
 ULong tapeAddStatement(ULong index1,ULong index2,double diff1,double diff2){
   if(index1==0 && index2==0 && !typegrind) // activity analysis
     return 0;
@@ -75,44 +694,116 @@ ULong tapeAddStatement(ULong index1,ULong index2,double diff1,double diff2){
 }
 
 ULong tapeAddStatement_noActivityAnalysis(ULong index1,ULong index2,double diff1,double diff2){
-  if(dg_disable[VG_(get_running_tid)()]!=0) return typegrind ? 0xffffffffffffffff : 0;
-  ULong pos = (nextindex%BUFSIZE);
-  buffer_tape[4*pos] = index1;
-  buffer_tape[4*pos+1] = index2;
-  buffer_tape[4*pos+2] = *(ULong*)&diff1;
-  buffer_tape[4*pos+3] = *(ULong*)&diff2;
-  if(recording_stop_indices){
-    Int i=0;
-    ULong stop_index = recording_stop_indices[i];
-    while(stop_index!=0){
-      if(nextindex==stop_index){
-        VG_(message)(Vg_UserMsg, "User-specified index has been reached (--record-stop).\n");
-        VG_(message)(Vg_UserMsg, "Index %llu assigned at\n",nextindex);
-        VG_(get_and_pp_StackTrace)(VG_(get_running_tid)(), 16);
-        VG_(message)(Vg_UserMsg, "\n");
-        VG_(gdbserver)(VG_(get_running_tid)());
-      }
-      i++;
-      stop_index = recording_stop_indices[i];
+  ThreadId tid = VG_(get_running_tid)();
+  if(dg_disable[tid]!=0) return typegrind ? 0xffffffffffffffff : 0;
+  if(tape_peephole){
+    ULong result;
+    if(tape_peephole_statement(&index1, &index2, &diff1, &diff2, &result)) return result;
+  }
+  if(tape_per_thread){
+    if(tid!=tape_tid) tape_switch_thread(tid);
+    tape_note_operand(index1);
+    tape_note_operand(index2);
+  }
+  if(tape_index_reuse){
+    ULong indices[2] = {index1, index2};
+    double diffs[2] = {diff1, diff2};
+    if(index1==0){ indices[0] = index2; diffs[0] = diff2; }
+    return tape_stage_statement((index1!=0)+(index2!=0), indices, diffs);
+  }
+  ULong* block = buffer_tape+4*tape_pos;
+  block[0] = index1;
+  block[1] = index2;
+  block[2] = *(ULong*)&diff1;
+  block[3] = *(ULong*)&diff2;
+  tape_pos++;
+  return tape_finish_statement(index1==0xffffffffffffffff||index2==0xffffffffffffffff, 0);
+}
+
+ULong tapeAddStatementN(UInt n, const ULong* indices, const double* diffs){
+  for(UInt j=0; j<n; j++){
+    if(indices[j]!=0) return tapeAddStatementN_noActivityAnalysis(n,indices,diffs);
+  }
+  if(typegrind) // no activity analysis
+    return tapeAddStatementN_noActivityAnalysis(n,indices,diffs);
+  else
+    return 0;
+}
+
+ULong tapeAddStatementN_noActivityAnalysis(UInt n, const ULong* indices, const double* diffs){
+  tl_assert(n<=DG_TAPE_MAX_OPERANDS);
+  // inactive operands are not recorded
+  ULong active_indices[DG_TAPE_MAX_OPERANDS];
+  double active_diffs[DG_TAPE_MAX_OPERANDS];
+  UInt m = 0, dropped = 0;
+  for(UInt j=0; j<n; j++){
+    if(indices[j]!=0 && tape_peephole && diffs[j]==0.){
+      peephole_zero_edges++;
+      dropped++;
+    } else if(indices[j]!=0){
+      active_indices[m] = indices[j];
+      active_diffs[m] = diffs[j];
+      m++;
     }
   }
-  nextindex++;
-  if(nextindex%BUFSIZE==0){
-    if(tape_in_ram){
-      buffer_tape = VG_(malloc)("Tape buffer reallocation.",BUFSIZE*4*sizeof(ULong));
-      // The connection to previous tape buffers is lost and they will never be freed;
-      // note that --tape-to-ram=yes is only for benchmarking purposes.
-    } else {
-      VG_(write)(fd_tape,buffer_tape,4*BUFSIZE*sizeof(ULong));
+  if(m==0 && dropped>0){ // see tape_peephole_statement
+    peephole_passive++;
+    return 0;
+  }
+  if(m<=2 && !tape_index_reuse){
+    return tapeAddStatement_noActivityAnalysis(
+      m>0 ? active_indices[0] : 0, m>1 ? active_indices[1] : 0,
+      m>0 ? active_diffs[0] : 0., m>1 ? active_diffs[1] : 0. );
+  }
+  if(!tape_compact){
+    // In the raw format, the index of a statement is its block position,
+    // so we chain two-operand blocks with intermediate indices.
+    ULong index = tapeAddStatement_noActivityAnalysis(active_indices[0],active_indices[1],active_diffs[0],active_diffs[1]);
+    for(UInt j=2; j<m; j++){
+      if(bar_record_values && index!=0) valuesAddStatement(0.);
+      index = tapeAddStatement_noActivityAnalysis(index,active_indices[j],1.,active_diffs[j]);
     }
+    return index;
   }
-  if(index1==0xffffffffffffffff||index2==0xffffffffffffffff){
-    VG_(message)(Vg_UserMsg, "Result of unwrapped operation used as input of differentiable operation.\n");
-    VG_(message)(Vg_UserMsg, "Index of result of differentiable operation: %llu.\n",nextindex-1);
-    VG_(get_and_pp_StackTrace)(VG_(get_running_tid)(), 16);
-    VG_(message)(Vg_UserMsg, "\n");
+  if(dg_disable[VG_(get_running_tid)()]!=0) return typegrind ? 0xffffffffffffffff : 0;
+  return tape_stage_statement(m, active_indices, active_diffs);
+}
+
+/*! Open dg-input-indices (k=0) or dg-output-indices (k=1), and write the
+ *  header of the binary format if --index-format=binary.
+ */
+static Bool index_file_open(Int k, const HChar* filename){
+  if(!index_binary){
+    fp_indices[k] = VG_(fopen)(filename,VKI_O_WRONLY|VKI_O_CREAT|VKI_O_TRUNC,0777);
+    return fp_indices[k]!=NULL;
   }
-  return typegrind ? 0 : (nextindex-1);
+  fd_indices[k] = VG_(fd_open)(filename,VKI_O_WRONLY|VKI_O_CREAT|VKI_O_TRUNC|VKI_O_LARGEFILE,0777);
+  if(fd_indices[k]==-1) return False;
+  ULong header[2] = {DG_BINARY_MAGIC, 1};
+  VG_(write)(fd_indices[k],header,DG_BINARY_HEADERSIZE);
+  index_count[k] = 0;
+  return True;
+}
+
+static void index_file_write(Int k, ULong index){
+  if(!index_binary){
+    VG_(fprintf)(fp_indices[k],"%llu\n", index);
+    return;
+  }
+  index_buffer[k][index_count[k]++] = index;
+  if(index_count[k]==INDEXBUFSIZE){
+    VG_(write)(fd_indices[k],index_buffer[k],INDEXBUFSIZE*sizeof(ULong));
+    index_count[k] = 0;
+  }
+}
+
+static void index_file_close(Int k){
+  if(!index_binary){
+    VG_(fclose)(fp_indices[k]);
+    return;
+  }
+  if(index_count[k]>0) VG_(write)(fd_indices[k],index_buffer[k],index_count[k]*sizeof(ULong));
+  VG_(close)(fd_indices[k]);
 }
 
 void dg_bar_tape_initialize(const HChar* path){
@@ -124,10 +815,18 @@ void dg_bar_tape_initialize(const HChar* path){
   }
   VG_(memcpy)(filename,path,len+1);
 
-  VG_(strcpy)(filename+len, "/dg-tape");
-  fd_tape = VG_(fd_open)(filename,VKI_O_WRONLY|VKI_O_CREAT|VKI_O_TRUNC|VKI_O_LARGEFILE,0777);
-  if(fd_tape==-1){
-    VG_(printf)("Cannot open tape file at path '%s'.", filename ); tl_assert(False);
+  if(tape_fd>=0){ // inherited descriptor, e.g. a memfd
+    fd_tape = tape_fd;
+    if(VG_(ftruncate)(fd_tape,0)!=0 || VG_(lseek)(fd_tape,0,VKI_SEEK_SET)!=0){
+      VG_(printf)("Cannot use file descriptor %d as tape file.\n", tape_fd); tl_assert(False);
+    }
+  } else {
+    VG_(strcpy)(filename+len, "/dg-tape");
+    // shared mappings of the tape file need read permissions
+    fd_tape = VG_(fd_open)(filename,(tape_in_ram?VKI_O_RDWR:VKI_O_WRONLY)|VKI_O_CREAT|VKI_O_TRUNC|VKI_O_LARGEFILE,0777);
+    if(fd_tape==-1){
+      VG_(printf)("Cannot open tape file at path '%s'.", filename ); tl_assert(False);
+    }
   }
   if(bar_record_values){
     VG_(strcpy)(filename+len, "/dg-values");
@@ -137,21 +836,51 @@ void dg_bar_tape_initialize(const HChar* path){
     }
   }
   VG_(strcpy)(filename+len, "/dg-input-indices");
-  fp_inputs = VG_(fopen)(filename,VKI_O_WRONLY|VKI_O_CREAT|VKI_O_TRUNC,0777);
-  if(!fp_inputs){
+  if(!index_file_open(0,filename)){
     VG_(printf)("Cannot open input indices file at path '%s'.", filename ); tl_assert(False);
   }
   VG_(strcpy)(filename+len, "/dg-output-indices");
-  fp_outputs = VG_(fopen)(filename,VKI_O_WRONLY|VKI_O_CREAT|VKI_O_TRUNC,0777);
-  if(!fp_outputs){
+  if(!index_file_open(1,filename)){
     VG_(printf)("Cannot open output indices file at path '%s'.", filename ); tl_assert(False);
   }
+  if(tape_per_thread){
+    VG_(strcpy)(filename+len, "/dg-tape-order");
+    fd_order = VG_(fd_open)(filename,VKI_O_WRONLY|VKI_O_CREAT|VKI_O_TRUNC|VKI_O_LARGEFILE,0777);
+    if(fd_order==-1){
+      VG_(printf)("Cannot open tape order file at path '%s'.", filename ); tl_assert(False);
+    }
+    tape_directory = VG_(strdup)("Recording directory", path);
+    thread_tapes = VG_(malloc)("Per-thread tapes", (VG_N_THREADS+1)*sizeof(ThreadTape));
+    VG_(memset)(thread_tapes, 0, (VG_N_THREADS+1)*sizeof(ThreadTape));
+  }
+
   VG_(free)(filename);
 
-  // allocate and zero buffer for tape
-  buffer_tape = VG_(malloc)("Tape buffer", BUFSIZE*4*sizeof(ULong));
-  for(ULong i=0; i<4*BUFSIZE; i++){
-    buffer_tape[i] = 0;
+  if(recording_stop_indices){
+    while(recording_stop_indices[stop_count]!=0) stop_count++;
+    tape_update_stop_index(nextindex);
+  }
+
+  if(tape_compact) compact_initialize(fd_tape);
+  if(tape_index_reuse) dg_bar_index_initialize();
+
+  if(tape_background_writer){
+    // the ring has been zero-initialized by the file system
+    tape_writer_initialize();
+    buffer_tape = (ULong*)tape_writer_ring[TAPE_STREAM_TAPE];
+    buffer_values = (ULong*)tape_writer_ring[TAPE_STREAM_VALUES];
+    return;
+  }
+
+  if(tape_in_ram && !tape_compact){
+    // the file system provides zeros
+    tape_ram_map();
+  } else {
+    // allocate and zero buffer for tape
+    buffer_tape = VG_(malloc)("Tape buffer", BUFSIZE*4*sizeof(ULong));
+    for(ULong i=0; i<4*BUFSIZE; i++){
+      buffer_tape[i] = 0;
+    }
   }
   // allocate and zero buffer for values
   if(bar_record_values){
@@ -163,32 +892,53 @@ void dg_bar_tape_initialize(const HChar* path){
 }
 
 void dg_bar_tape_write_input_index(ULong index){
-  VG_(fprintf)(fp_inputs,"%llu\n", index);
+  if(tape_index_reuse) dg_bar_index_pin(index);
+  index_file_write(0,index);
 }
 void dg_bar_tape_write_output_index(ULong index){
-  VG_(fprintf)(fp_outputs,"%llu\n", index);
+  if(tape_index_reuse) dg_bar_index_pin(index);
+  index_file_write(1,index);
 }
 
 void valuesAddStatement(double value){
   ULong pos = ((nextindex-1)%BUFSIZE);
   buffer_values[pos] = *(ULong*)&value;
   if(nextindex%BUFSIZE==0){
-    VG_(write)(fd_values,buffer_values,BUFSIZE*sizeof(ULong));
+    if(tape_writer_pid>0){
+      buffer_values = tape_writer_submit(TAPE_STREAM_VALUES, BUFSIZE*sizeof(ULong));
+    } else {
+      VG_(write)(fd_values,buffer_values,BUFSIZE*sizeof(ULong));
+    }
   }
 }
 
 void dg_bar_tape_finalize(void){
   ULong pos = (nextindex%BUFSIZE);
-  if(pos>0){ // flush buffers
-    VG_(write)(fd_tape,buffer_tape,pos*4*sizeof(ULong));
-    if(bar_record_values) VG_(write)(fd_values,buffer_values,pos*sizeof(ULong));
+  if(tape_peephole){
+    VG_(message)(Vg_UserMsg, "Tape peephole optimization: %llu identity and %llu passive statements elided, %llu operands dropped.\n",
+      peephole_identities, peephole_passive, peephole_zero_edges);
+  }
+  if(tape_index_reuse) dg_bar_index_finalize();
+  if(tape_writer_pid>0){ // drain the queue of the writer process
+    tape_writer_finalize(tape_pos*4*sizeof(ULong), bar_record_values ? pos*sizeof(ULong) : 0);
+    VG_(close)(fd_tape);
+    if(bar_record_values) VG_(close)(fd_values);
+    index_file_close(0);
+    index_file_close(1);
+    return;
   }
+  // flush buffers
+  if(tape_in_ram && !tape_compact) tape_ram_unmap();
+  else if(tape_pos>0) tape_write_blocks(fd_tape,buffer_tape,tape_pos);
+  if(pos>0 && bar_record_values) VG_(write)(fd_values,buffer_values,pos*sizeof(ULong));
+  if(tape_compact) compact_finalize(fd_tape);
+  if(tape_per_thread) tape_finalize_threads();
   VG_(close)(fd_tape);
   VG_(close)(fd_values);
-  VG_(fclose)(fp_inputs);
-  VG_(fclose)(fp_outputs);
+  index_file_close(0);
+  index_file_close(1);
 
-  VG_(free)(buffer_tape);
+  if(!tape_in_ram || tape_compact) VG_(free)(buffer_tape);
   if(bar_record_values) VG_(free)(buffer_values);
 }
 
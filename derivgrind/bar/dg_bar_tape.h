@@ -52,6 +52,28 @@ ULong tapeAddStatement(ULong index1,ULong index2,double diff1,double diff2);
  */
 ULong tapeAddStatement_noActivityAnalysis(ULong index1,ULong index2,double diff1,double diff2);
 
+/*! Add one elementary operation with an arbitrary number of operands to the tape,
+ *  if an active variable is involved.
+ *
+ *  In the compact tape format, the operation is recorded as a single statement.
+ *  In the raw format, it is split into a chain of two-operand blocks.
+ *
+ *  \param n - Number of operands, at most DG_TAPE_MAX_OPERANDS.
+ *  \param indices - Indices of the operands.
+ *  \param diffs - Partial derivatives of the result w.r.t. the operands.
+ *  \returns Index of result of operation. May be 0 if no active variable is involved.
+ */
+ULong tapeAddStatementN(UInt n, const ULong* indices, const double* diffs);
+
+/*! Add one elementary operation with an arbitrary number of operands to the tape,
+ *  without activity analysis.
+ *  \param n - Number of operands, at most DG_TAPE_MAX_OPERANDS.
+ *  \param indices - Indices of the operands.
+ *  \param diffs - Partial derivatives of the result w.r.t. the operands.
+ *  \returns Index of result of operation, newly assigned and in particular non-zero.
+ */
+ULong tapeAddStatementN_noActivityAnalysis(UInt n, const ULong* indices, const double* diffs);
+
 /*! Write index to input-index file.
  */
 void dg_bar_tape_write_input_index(ULong index);
@@ -70,9 +92,9 @@ void dg_bar_tape_write_output_index(ULong index);
 void valuesAddStatement(double value);
 // Note: We did not merge valuesAddStatement into tapeAddStatement because the dirty call would
 // need seven parameters (both halves of two indices, two partial derivatives, plus the value),
-// which is currently not possible in Valgrind/VEX. So one must have two dirty calls, and
-// correspondingly two separate functions that they call. Actually, we need to emit the
-// dirty call for valuesAddStatement only if bar_record_values==True.
+// which is currently not possible in Valgrind/VEX. Instead, if bar_record_values==True, the
+// instrumentation stores the operands and the value into a staging buffer, and a single dirty
+// call without arguments calls both functions, see dg_bar_writeToTape in dg_bar.c.
 
 /*! Initialize tape.
  */
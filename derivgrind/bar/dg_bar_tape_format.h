@@ -0,0 +1,164 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_format.h) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_format.h) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_FORMAT_H
+#define DG_BAR_TAPE_FORMAT_H
+
+/*! \file dg_bar_tape_format.h
+ * Layout of tape files in the compact format (--tape-format=compact).
+ *
+ * This header is shared by the recording tool and the tape evaluator,
+ * so it must not include anything.
+ *
+ * In the default raw format, the tape file is an array of 32-byte blocks
+ * (index1, index2, diff1, diff2), and the block at position i describes
+ * the operation that produced index i. Block 0 is a dummy block filled
+ * with zeros.
+ *
+ * A tape in the compact format consists of
+ * - a 32-byte header (DG_TAPE_COMPACT_MAGIC, DG_TAPE_COMPACT_CHUNKSIZE, flags, 0),
+ * - the encoded blocks, starting with the dummy block 0,
+ * - an offset table containing, for every chunk of DG_TAPE_COMPACT_CHUNKSIZE
+ *   consecutive blocks, the file offset of the chunk's first block,
+ * - the number of indices, i.e. the size of the adjoint vector, if the
+ *   DG_TAPE_FLAG_EXPLICIT_LHS flag is set,
+ * - a 32-byte footer (number of blocks, number of chunks, file offset of
+ *   the offset table, DG_TAPE_COMPACT_MAGIC).
+ * As the first block of a raw tape is zero, the magic number in the header
+ * distinguishes both formats.
+ *
+ * Each block is encoded as a tag byte, followed by
+ * - a varint (7 bits per byte, least significant first, highest bit set
+ *   if more bytes follow) for index1, if present,
+ * - a varint for index2, if present,
+ * - the 8-byte diff1, if DG_TAPE_TAG_DIFF1(tag)==DG_TAPE_TAG_RAW,
+ * - the 8-byte diff2, if DG_TAPE_TAG_DIFF2(tag)==DG_TAPE_TAG_RAW.
+ * An operand is absent if its index is zero; its partial derivative is
+ * dropped as it does not contribute to any derivative. Otherwise, the varint
+ * stores the difference between the index of the block and the operand
+ * index, unless the respective DG_TAPE_TAG_INDEXi_ABS bit is set and the
+ * varint stores the operand index itself.
+ *
+ * A statement with more than two active operands, e.g. a fused multiply-add,
+ * is encoded as a single block with tag DG_TAPE_TAG_NARY, followed by a
+ * varint for the number of operands and, for each operand, an operand byte
+ * (class of the partial derivative in the lower two bits, DG_TAPE_TAG_INDEX1_ABS
+ * if the index is absolute), the varint for the index and the 8-byte partial
+ * derivative if its class is DG_TAPE_TAG_RAW. In the raw format, such
+ * statements are split into a chain of two-operand blocks.
+ *
+ * If the DG_TAPE_FLAG_EXPLICIT_LHS flag is set in the header, every block
+ * starts with a varint for the index of its result, which is then used in
+ * place of the block position for relative operand indices. Indices may
+ * be assigned multiple times in this case (--index-reuse=yes); the
+ * adjoint of the result must be reset after it has been propagated.
+ *
+ * The recording tool stages n-ary statements in its tape buffer as a header
+ * block (DG_TAPE_STAGING_NARY, number of operands, result index or 0, 0), followed by blocks
+ * with two (index, partial derivative) pairs each, (index, index', diff, diff').
+ * With --index-reuse=yes, all statements are staged in this way. Staged
+ * statements never appear in tape files.
+ *
+ * With --per-thread-tapes=yes, thread t records a raw tape dg-tape-t
+ * (dg-tape for the main thread t=1), each starting with its own dummy block,
+ * and the block at position i of thread t produces the index
+ * ((t-1)<<DG_TAPE_THREAD_SHIFT) + i. The file dg-tape-order contains a
+ * 32-byte record (t, first block, end block, mask) for every maximal
+ * sequence of blocks recorded by a single thread, in recording order;
+ * bit u%64 of the mask is set if the sequence uses results of thread u!=t.
+ *
+ * With --index-format=binary, the files dg-input-indices and dg-output-indices
+ * start with a 16-byte header (DG_BINARY_MAGIC, 1), followed by the indices as
+ * 8-byte little-endian integers. Files with dot or bar values in the binary
+ * format have the header (DG_BINARY_MAGIC, number of columns), followed by
+ * the rows of 8-byte doubles. tape-evaluation detects the format by the magic
+ * number, and writes its results in the format of the index file.
+ */
+
+//! First eight bytes of a tape in the compact format, "DGTAPEC1".
+#define DG_TAPE_COMPACT_MAGIC 0x3143455041544744ull
+//! Number of blocks per chunk of the offset table.
+#define DG_TAPE_COMPACT_CHUNKSIZE 4096ull
+//! Size of the header and of the footer, in bytes.
+#define DG_TAPE_COMPACT_HEADERSIZE 32ull
+#define DG_TAPE_COMPACT_FOOTERSIZE 32ull
+
+//! Flag in the header: Each block starts with the index of its result.
+#define DG_TAPE_FLAG_EXPLICIT_LHS 1ull
+
+//! Classes of partial derivatives stored in the tag byte.
+#define DG_TAPE_TAG_ABSENT 0u
+#define DG_TAPE_TAG_PLUSONE 1u
+#define DG_TAPE_TAG_MINUSONE 2u
+#define DG_TAPE_TAG_RAW 3u
+#define DG_TAPE_TAG_DIFF1(tag) ((tag)&3u)
+#define DG_TAPE_TAG_DIFF2(tag) (((tag)>>2)&3u)
+//! If set, the varint stores the operand index rather than its distance to the block index.
+#define DG_TAPE_TAG_INDEX1_ABS 0x10u
+#define DG_TAPE_TAG_INDEX2_ABS 0x20u
+//! Tag of a block encoding a statement with more than two operands.
+#define DG_TAPE_TAG_NARY 0x40u
+
+//! Maximal number of operands of a single tape statement.
+#define DG_TAPE_MAX_OPERANDS 256u
+//! First index of the header block of a staged n-ary statement.
+#define DG_TAPE_STAGING_NARY 0x7fffffffffffffffull
+
+//! Position of the thread number in indices recorded with --per-thread-tapes=yes.
+#define DG_TAPE_THREAD_SHIFT 48
+//! Mask for the thread-local part of such an index.
+#define DG_TAPE_THREAD_MASK ((1ull<<DG_TAPE_THREAD_SHIFT)-1)
+
+//! First eight bytes of a binary index or derivative file, "DGBINAR1".
+#define DG_BINARY_MAGIC 0x3152414e49424744ull
+//! Size of the header of a binary index or derivative file, in bytes.
+#define DG_BINARY_HEADERSIZE 16ull
+
+//! Binary representations of the partial derivatives +1.0 and -1.0.
+#define DG_TAPE_PLUSONE_BITS 0x3ff0000000000000ull
+#define DG_TAPE_MINUSONE_BITS 0xbff0000000000000ull
+
+#endif // DG_BAR_TAPE_FORMAT_H
@@ -76,6 +76,8 @@ typedef
       VG_USERREQ__GET_MODE,
       VG_USERREQ__GET_FLAGS,
       VG_USERREQ__SET_FLAGS,
+      VG_USERREQ__NEW_INDEX_N,
+      VG_USERREQ__NEW_INDEX_N_NOACTIVITYANALYSIS,
    } Vg_DerivgrindClientRequest;
 
 typedef enum {
@@ -202,6 +204,51 @@ static TapeBlockInfo tbi;
    )
 #define DERIVGRIND_NEW_INDEX_NOACTIVITYANALYSIS(_qzz_index1addr,_qzz_index2addr,_qzz_diff1addr,_qzz_diff2addr,_qzz_newindexaddr,_qzz_valueaddr) DG_NEW_INDEX_NOACTIVITYANALYSIS(_qzz_index1addr,_qzz_index2addr,_qzz_diff1addr,_qzz_diff2addr,_qzz_newindexaddr,_qzz_valueaddr)
 
+typedef struct {
+   unsigned long long count; //!< Number of operands, at most 256.
+   void const* indexaddr; //!< Address where the indices of the operands are read from, of type unsigned long long[count].
+   void const* diffaddr; //!< Address where the partial derivatives w.r.t. the operands are read from, of type double[count].
+   void* newindexaddr; //!< Address where the index of the result is written to, of type unsigned long long.
+   void const* valueaddr; //!< Address where the value of the result can be read from for debugging purposes, of type double.
+} TapeStatementInfo;
+
+static TapeStatementInfo tsi;
+/* Push new operation with an arbitrary number of operands to the tape, with activity analysis.
+* _qzz_count is the number of operands,
+* _qzz_indexaddr points to _qzz_count 8-byte indices,
+* _qzz_diffaddr points to _qzz_count 8-byte (double) partial derivatives,
+* _qzz_newindexaddr points to 8 byte for new index, which can be zero if input indices are zero,
+* _qzz_valueaddr points to double for value.
+*/
+#define DG_NEW_INDEX_N(_qzz_count,_qzz_indexaddr,_qzz_diffaddr,_qzz_newindexaddr,_qzz_valueaddr)  \
+   ( \
+     tsi.count = _qzz_count, \
+     tsi.indexaddr = _qzz_indexaddr, \
+     tsi.diffaddr = _qzz_diffaddr, \
+     tsi.newindexaddr = _qzz_newindexaddr, \
+     tsi.valueaddr = _qzz_valueaddr, \
+     VALGRIND_DO_CLIENT_REQUEST_EXPR(0 /* default return */,      \
+                            VG_USERREQ__NEW_INDEX_N,          \
+                            &tsi, 0, 0, 0, 0) \
+   )
+#define DERIVGRIND_NEW_INDEX_N(_qzz_count,_qzz_indexaddr,_qzz_diffaddr,_qzz_newindexaddr,_qzz_valueaddr) DG_NEW_INDEX_N(_qzz_count,_qzz_indexaddr,_qzz_diffaddr,_qzz_newindexaddr,_qzz_valueaddr)
+
+/* Push new operation with an arbitrary number of operands to the tape, without activity analysis.
+* Arguments as for DG_NEW_INDEX_N; the new index is non-zero.
+*/
+#define DG_NEW_INDEX_N_NOACTIVITYANALYSIS(_qzz_count,_qzz_indexaddr,_qzz_diffaddr,_qzz_newindexaddr,_qzz_valueaddr)  \
+   ( \
+     tsi.count = _qzz_count, \
+     tsi.indexaddr = _qzz_indexaddr, \
+     tsi.diffaddr = _qzz_diffaddr, \
+     tsi.newindexaddr = _qzz_newindexaddr, \
+     tsi.valueaddr = _qzz_valueaddr, \
+     VALGRIND_DO_CLIENT_REQUEST_EXPR(0 /* default return */,      \
+                            VG_USERREQ__NEW_INDEX_N_NOACTIVITYANALYSIS,          \
+                            &tsi, 0, 0, 0, 0) \
+   )
+#define DERIVGRIND_NEW_INDEX_N_NOACTIVITYANALYSIS(_qzz_count,_qzz_indexaddr,_qzz_diffaddr,_qzz_newindexaddr,_qzz_valueaddr) DG_NEW_INDEX_N_NOACTIVITYANALYSIS(_qzz_count,_qzz_indexaddr,_qzz_diffaddr,_qzz_newindexaddr,_qzz_valueaddr)
+
 /* Write index to an index file.
  */
 #define DG_INDEX_TO_FILE(_qzz_outputfile,_qzz_indexaddr)  \
@@ -49,6 +49,8 @@
 #include "dot/dg_dot.h"
 #include "bar/dg_bar.h"
 #include "bar/dg_bar_tape.h"
+#include "bar/dg_bar_tape_format.h"
+#include "bar/dg_bar_index.h"
 #include "trick/dg_trick.h"
 
 /*! \page storage_convention Storage convention for shadow memory
@@ -99,19 +101,60 @@ const HChar* recording_directory = NULL;
 /*! Comma-separated list of indices where the recording should be stopped.
  */
 const HChar* recording_stop_indices_str = NULL;
-/*! List indices where the recording should be stopped, 0-terminated.
+/*! List indices where the recording should be stopped, sorted in
+ *  ascending order and 0-terminated.
  */
 const ULong* recording_stop_indices = NULL;
 
-/*! If true, write tape to RAM instead of file.
- *  Only for benchmarking purposes!
+/*! If true, record the tape directly into a shared mapping of the
+ *  tape file instead of writing buffers to it.
  */
 Bool tape_in_ram = False;
 
+/*! If non-negative, inherited file descriptor receiving the tape
+ *  instead of the dg-tape file, e.g. a memfd.
+ */
+Int tape_fd = -1;
+
+/*! If true, write full tape buffers from a forked writer process,
+ *  so the recording does not wait for VG_(write).
+ */
+Bool tape_background_writer = False;
+
+/*! If true, write the tape in the compact format described in
+ *  bar/dg_bar_tape_format.h instead of the raw format.
+ */
+Bool tape_compact = False;
+
+/*! If true, recycle indices that are no longer live, and store the
+ *  left-hand side index of every statement in the compact tape.
+ */
+Bool tape_index_reuse = False;
+
+/*! If true, every thread records into its own raw tape, and the order
+ *  of the threads' statements is stored in dg-tape-order.
+ */
+Bool tape_per_thread = False;
+
+/*! If true, drop operands with zero partial derivative and forward the
+ *  operand index of identity statements instead of recording them.
+ */
+Bool tape_peephole = False;
+
+/*! If true, write dg-input-indices and dg-output-indices in the binary
+ *  format described in bar/dg_bar_tape_format.h instead of as text.
+ */
+Bool index_binary = False;
+
 /*! Warnlevel for bit-trick finder.
  */
 const HChar* bittrick_warnlevel = NULL;
 
+static Int dg_compare_indices(const void* a, const void* b){
+  ULong x = *(const ULong*)a, y = *(const ULong*)b;
+  return x<y ? -1 : (x>y ? 1 : 0);
+}
+
 static void dg_post_clo_init(void)
 {
   if(typegrind && mode!='b'){
@@ -129,6 +172,61 @@ static void dg_post_clo_init(void)
     tl_assert(False);
   }
 
+  if(tape_background_writer && mode!='b'){
+    VG_(printf)("Option --tape-background-writer=yes can only be used in recording mode (--record=path).\n");
+    tl_assert(False);
+  }
+
+  if(tape_fd>=0 && mode!='b'){
+    VG_(printf)("Option --tape-fd can only be used in recording mode (--record=path).\n");
+    tl_assert(False);
+  }
+
+  if(tape_compact && mode!='b'){
+    VG_(printf)("Option --tape-format=compact can only be used in recording mode (--record=path).\n");
+    tl_assert(False);
+  }
+
+  if(tape_index_reuse && !tape_compact){
+    VG_(printf)("Option --index-reuse=yes requires --tape-format=compact.\n");
+    tl_assert(False);
+  }
+
+  if(tape_index_reuse && (bar_record_values || recording_stop_indices_str)){
+    VG_(printf)("Option --index-reuse=yes cannot be combined with --record-values=yes or --record-stop.\n");
+    tl_assert(False);
+  }
+
+  if(tape_per_thread && mode!='b'){
+    VG_(printf)("Option --per-thread-tapes=yes can only be used in recording mode (--record=path).\n");
+    tl_assert(False);
+  }
+
+  if(tape_per_thread && (tape_compact || tape_in_ram || tape_fd>=0 || tape_background_writer || bar_record_values)){
+    VG_(printf)("Option --per-thread-tapes=yes cannot be combined with --tape-format=compact, --tape-in-ram=yes, --tape-fd, --tape-background-writer=yes or --record-values=yes.\n");
+    tl_assert(False);
+  }
+
+  if(tape_peephole && mode!='b'){
+    VG_(printf)("Option --tape-peephole=yes can only be used in recording mode (--record=path).\n");
+    tl_assert(False);
+  }
+
+  if(tape_peephole && (typegrind || bar_record_values)){
+    VG_(printf)("Option --tape-peephole=yes cannot be combined with --typegrind=yes or --record-values=yes.\n");
+    tl_assert(False);
+  }
+
+  if(index_binary && mode!='b'){
+    VG_(printf)("Option --index-format=binary can only be used in recording mode (--record=path).\n");
+    tl_assert(False);
+  }
+
+  if(tape_background_writer && tape_in_ram){
+    VG_(printf)("Options --tape-background-writer=yes and --tape-in-ram=yes cannot be combined.\n");
+    tl_assert(False);
+  }
+
   if(recording_stop_indices_str){ // parse the comma-separated list of indices
     HChar* recording_stop_indices_str_copy = VG_(malloc)("Stopping indices",VG_(strlen)(recording_stop_indices_str)+1);
     VG_(strcpy)(recording_stop_indices_str_copy, recording_stop_indices_str);
@@ -139,9 +237,11 @@ static void dg_post_clo_init(void)
     Int i=0;
     while(indexstr){
       indices[i] = VG_(strtoull10)(indexstr, NULL);
-      i++;
+      if(indices[i]!=0) i++; // index 0 is never assigned, and terminates the list
       indexstr = VG_(strtok_r)(NULL, ",", &ssaveptr);
     }
+    // sorted, so the tape only has to compare with the next stop index
+    VG_(ssort)(indices, i, sizeof(ULong), dg_compare_indices);
     indices[i] = 0;
     recording_stop_indices = indices;
     VG_(free)(recording_stop_indices_str_copy);
@@ -172,6 +272,15 @@ static Bool dg_process_cmd_line_option(const HChar* arg)
    else if VG_BOOL_CLO(arg, "--record-values", bar_record_values) { }
    else if VG_STR_CLO(arg, "--record-stop", recording_stop_indices_str) { }
    else if VG_BOOL_CLO(arg, "--tape-in-ram", tape_in_ram) { }
+   else if VG_INT_CLO(arg, "--tape-fd", tape_fd) { }
+   else if VG_BOOL_CLO(arg, "--tape-background-writer", tape_background_writer) { }
+   else if VG_XACT_CLO(arg, "--tape-format=raw", tape_compact, False) { }
+   else if VG_XACT_CLO(arg, "--tape-format=compact", tape_compact, True) { }
+   else if VG_BOOL_CLO(arg, "--index-reuse", tape_index_reuse) { }
+   else if VG_BOOL_CLO(arg, "--per-thread-tapes", tape_per_thread) { }
+   else if VG_BOOL_CLO(arg, "--tape-peephole", tape_peephole) { }
+   else if VG_XACT_CLO(arg, "--index-format=text", index_binary, False) { }
+   else if VG_XACT_CLO(arg, "--index-format=binary", index_binary, True) { }
    else return False;
    return True;
 }
@@ -185,6 +294,14 @@ static void dg_print_usage(void)
 "    --typegrind=no|yes         record index ff...f for results of unwrapped operations\n"
 "    --record-values=no|yes     record values of elementary operations for debugging purposes\n"
 "    --record-stop=<i1>,..,<ik> stop recording in debugger when the given indices are assigned\n"
+"    --tape-in-ram=no|yes       record the tape into a shared mapping of the tape file\n"
+"    --tape-fd=<n>              write the tape to inherited file descriptor n, e.g. a memfd\n"
+"    --tape-background-writer=no|yes  write tape buffers from a separate process\n"
+"    --tape-format=raw|compact  write 32-byte blocks or encoded blocks to the tape file\n"
+"    --index-reuse=no|yes       recycle indices of overwritten variables (needs compact format)\n"
+"    --per-thread-tapes=no|yes  record a separate raw tape for every thread\n"
+"    --tape-peephole=no|yes     do not record identities and operands with zero partial derivative\n"
+"    --index-format=text|binary write input and output indices as text or 8-byte integers\n"
    );
 }
 
@@ -397,6 +514,8 @@ Bool dg_handle_client_request(ThreadId tid, UWord* arg, UWord* ret){
     void* addr = (void*) arg[1];
     void* iaddr = (void*) arg[2];
     dg_bar_shadowSet((void*)addr,(void*)iaddr,(void*)iaddr+4,4);
+    // the mark phase finds the index in shadow memory from now on
+    if(tape_index_reuse) dg_bar_index_release(*(const ULong*)iaddr);
     *ret = 1; return True;
   } else if(arg[0]==VG_USERREQ__NEW_INDEX || arg[0]==VG_USERREQ__NEW_INDEX_NOACTIVITYANALYSIS) {
     if(mode!='b') return True;
@@ -412,6 +531,27 @@ Bool dg_handle_client_request(ThreadId tid, UWord* arg, UWord* ret){
     } else {
       *newindexaddr = tapeAddStatement_noActivityAnalysis(*index1addr,*index2addr,*diff1addr,*diff2addr);
     }
+    if(tape_index_reuse) dg_bar_index_hold(*newindexaddr);
+    if(bar_record_values && *newindexaddr!=0) valuesAddStatement(*valueaddr);
+    *ret = 1; return True;
+  } else if(arg[0]==VG_USERREQ__NEW_INDEX_N || arg[0]==VG_USERREQ__NEW_INDEX_N_NOACTIVITYANALYSIS) {
+    if(mode!='b') return True;
+    const TapeStatementInfo* info = (const TapeStatementInfo*)(arg[1]);
+    if(info->count>DG_TAPE_MAX_OPERANDS){
+      VG_(printf)("DG_NEW_INDEX_N supports at most %u operands.\n", DG_TAPE_MAX_OPERANDS);
+      tl_assert(False);
+    }
+    UInt count = (UInt) info->count;
+    const ULong* indexaddr = (const ULong*) info->indexaddr;
+    const double* diffaddr = (const double*) info->diffaddr;
+    ULong* newindexaddr = (ULong*) info->newindexaddr;
+    const double* valueaddr = (const double*) info->valueaddr;
+    if(arg[0]==VG_USERREQ__NEW_INDEX_N){
+      *newindexaddr = tapeAddStatementN(count,indexaddr,diffaddr);
+    } else {
+      *newindexaddr = tapeAddStatementN_noActivityAnalysis(count,indexaddr,diffaddr);
+    }
+    if(tape_index_reuse) dg_bar_index_hold(*newindexaddr);
     if(bar_record_values && *newindexaddr!=0) valuesAddStatement(*valueaddr);
     *ret = 1; return True;
   } else if(arg[0]==VG_USERREQ__INDEX_TO_FILE){
@@ -550,6 +690,8 @@ IRSB* dg_instrument ( VgCallbackClosure* closure,
      addStmtToIRSB(sb_out, sb_in->stmts[i]);
      i++;
   }
+  // no shadow temporaries are live yet, so unused indices can be collected
+  if(mode=='b' && tape_index_reuse) dg_bar_index_add_collection(sb_out);
   for (/* use current i*/; i < sb_in->stmts_used; i++) {
     stmt_counter++;
     IRStmt* st_orig = sb_in->stmts[i];
@@ -33,6 +33,7 @@ import re
 import time
 import os
 import stat
+import struct
 import json
 import numpy as np
 
@@ -67,6 +68,7 @@ def str_fortran(d):
 install_dir = "" # Valgrind installation directory
 temp_dir = "" # directory for temporary files produced by tests
 codi_dir = "" # CoDiPack include directory for validation in performance tests
+record_flags = [] # additional Valgrind flags for recording mode, e.g. ["--tape-format=compact"]
 
 class TestCase:
   """Basic data for a Derivgrind regression test case."""
@@ -92,6 +94,8 @@ class TestCase:
     self.test_vals = {} # Expected values of output variables computed by stmt
     self.test_dots = {} # Expected dot values of output variables computed by stmt
     self.test_bars = {} # Expected bar values of input variables computed by stmt
+    self.max_indices = None # Upper bound for the size of the adjoint vector, checked for tapes recorded with --index-reuse=yes
+    self.record_stop = None # Indices passed to --record-stop in recording mode, e.g. "12,5"; interactive tests expect a stop at each of them
     self.cflags = "" # Additional flags for the C compiler
     self.cflags_clang = None # Additional flags for the C compiler, if clang is used
     self.fflags = "" # Additional flags for the Fortran compiler
@@ -103,6 +107,7 @@ class TestCase:
     self.install_dir = install_dir # Valgrind installation directory
     self.temp_dir = temp_dir # directory of temporary files produced by tests
     self.codi_dir = codi_dir # CoDiPack include directory for validation in performance tests
+    self.record_flags = record_flags # additional Valgrind flags for recording mode
 
 class InteractiveTestCase(TestCase):
   """Methods to run a Derivgrind regression test case interactively in VGDB."""
@@ -192,7 +197,9 @@ class InteractiveTestCase(TestCase):
     self.valgrind_log = ""
     self.gdb_log = ""
     # start Valgrind and extract "target remote" line
-    maybereverse = ["--record="+self.temp_dir] if self.mode=='b' else []
+    maybereverse = ["--record="+self.temp_dir]+self.record_flags if self.mode=='b' else []
+    if self.mode=='b' and self.record_stop:
+      maybereverse.append("--record-stop="+self.record_stop)
     valgrind = subprocess.Popen([self.install_dir+"/bin/valgrind", "--tool=derivgrind", "--vgdb-error=0"]+maybereverse+[self.temp_dir+"/TestCase_exec"], stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,universal_newlines=True,bufsize=0)
     while True:
       line = valgrind.stdout.readline()
@@ -242,6 +249,10 @@ class InteractiveTestCase(TestCase):
           f.writelines([str(index)+"\n"])
     # execute statement
     gdb.stdin.write("continue\n")
+    # continue after each stop at an index given by --record-stop, in increasing order
+    stops = sorted(set(int(index) for index in self.record_stop.split(","))) if self.mode=='b' and self.record_stop else []
+    for index in stops:
+      gdb.stdin.write("continue\n")
     # check values
     for var in self.test_vals:
       gdb.stdin.write("print "+var+"\n")
@@ -302,6 +313,10 @@ class InteractiveTestCase(TestCase):
     self.valgrind_log += stdout_data
     (stdout_data, stderr_data) = gdb.communicate()
     self.gdb_log += stdout_data
+    if stops:
+      reached = [int(index) for index in re.findall(r"Index (\d+) assigned at", self.valgrind_log)]
+      if reached!=stops:
+        self.errmsg += f"RECORDING STOPPED AT WRONG INDICES: expected {stops}, stopped at {reached}\n"
     # for recording mode, evaluate tape
     if self.mode=='b':
       # reverse evaluation of tape
@@ -534,7 +549,7 @@ class ClientRequestTestCase(TestCase):
       environ["PYTHONPATH"] += ":"+self.install_dir+"/lib/python3/site-packages"
     else:
       commands = [self.temp_dir+"/TestCase_exec"]
-    maybereverse = ["--record="+self.temp_dir] if self.mode=='b' else []
+    maybereverse = ["--record="+self.temp_dir]+self.record_flags if self.mode=='b' else []
     valgrind = subprocess.run([self.install_dir+"/bin/valgrind", "--tool=derivgrind"]+maybereverse+commands,capture_output=True,env=environ)
     if valgrind.returncode!=0:
       self.errmsg +="VALGRIND STDOUT:\n"+valgrind.stdout.decode('utf-8')+"\n\nVALGRIND STDERR:\n"+valgrind.stderr.decode('utf-8')+"\n\n"
@@ -567,6 +582,29 @@ class ClientRequestTestCase(TestCase):
             dot = float(outputdots.readline())
             if dot < self.test_dots[var]-self.type["tol"] or dot > self.test_dots[var]+self.type["tol"]:
               self.errmsg += f"RECORDING-MODE DOT VALUES DISAGREE: {var} stored={self.test_dots[var]} computed={dot}\n"
+      # values recorded with --record-values=yes, one double per index
+      if "--record-values=yes" in self.record_flags:
+        with open(self.temp_dir+"/dg-values","rb") as valuesfile:
+          data = valuesfile.read()
+        values = struct.unpack('<%dd' % (len(data)//8), data)
+        with open(self.temp_dir+"/dg-output-indices","r") as outputindices:
+          for var in self.bars: # same order as in the client code
+            for i in range(repetitions):
+              index = int(outputindices.readline())
+              if var not in self.test_vals or index==0 or index>=0x8000000000000000:
+                continue
+              value = values[index] if index<len(values) else None
+              if value==None or value < self.test_vals[var]-self.type["tol"] or value > self.test_vals[var]+self.type["tol"]:
+                self.errmsg += f"RECORDED VALUES DISAGREE: {var} stored={self.test_vals[var]} recorded={value}\n"
+      # size of the adjoint vector, stored in front of the footer of a compact tape (see dg_bar_tape_format.h)
+      if self.max_indices!=None and "--index-reuse=yes" in self.record_flags:
+        with open(self.temp_dir+"/dg-tape","rb") as tape:
+          tape.seek(-32, os.SEEK_END)
+          number_of_blocks, number_of_chunks, tableoffset, magic = struct.unpack('<QQQQ', tape.read(32))
+          tape.seek(tableoffset+8*number_of_chunks)
+          number_of_indices = struct.unpack('<Q', tape.read(8))[0]
+        if number_of_indices > self.max_indices:
+          self.errmsg += f"TOO MANY INDICES: {number_of_indices} for {number_of_blocks} blocks, expected at most {self.max_indices}\n"
     
 
   def run(self):
@@ -594,7 +632,7 @@ class PerformanceTestCase(TestCase):
   def __init__(self,name):
     super().__init__(name)
     self.disable_codi = False # CoDiPack must be disabled for x86 tests with more than about 2.5 GB memory consumption for the tape.
-    self.tape_in_ram = False # Write tape to RAM instead of file system.
+    self.tape_in_ram = False # Record tape into a shared mapping of the tape file.
 
   def runCoDi(self,nrep):
     """Build with CoDiPack types and run."""
@@ -641,7 +679,7 @@ class PerformanceTestCase(TestCase):
       self.errmsg += "COMPILATION FOR DERIVGRIND FAILED:\n" + comp.stderr.decode('utf-8')
     self.results_dg = []
     for irep in range(nrep+2): # measurements for the first two iterations are not taken into account
-      maybereverse = ["--record="+self.temp_dir] if self.mode=='b' else []
+      maybereverse = ["--record="+self.temp_dir]+self.record_flags if self.mode=='b' else []
       maybetapeinram = ["--tape-in-ram=yes"] if self.tape_in_ram else []
       exe = subprocess.run(["/usr/bin/time", "-f", "time_output %e %M", self.install_dir+"/bin/valgrind", "--tool=derivgrind"]+maybereverse+maybetapeinram+[f"{self.temp_dir}/main_dg", f"{self.temp_dir}/dg-performance-result-dg.json"]+self.benchmarkargs.split(), capture_output=True)
       if exe.returncode!=0:
@@ -657,34 +695,31 @@ class PerformanceTestCase(TestCase):
       else:
         self.errmsg += "EXECUTION WITH DERIVGRIND FAILED: NO GNU TIME OUTPUT\n"
       if self.mode=='b': # reverse pass
-        if not self.tape_in_ram:
-          with open(self.temp_dir+"/dg-output-indices", "r") as f:
-            number_of_outputs = len(f.readlines())
-          with open(self.temp_dir+"/dg-output-bars", "w") as f:
-            f.writelines(["1.0\n"]*number_of_outputs)
-          try: # remove file with reverse evaluation run-time
-            os.remove(self.temp_dir+"/dg-perf-tapeeval-time")
-          except OSError:
-            pass
-          eva = subprocess.run([self.install_dir+"/bin/tape-evaluation", self.temp_dir], capture_output=True)
-          if eva.returncode!=0:
-            self.errmsg += "EVALUATION OF DERIVGRIND TAPE FAILED:\n" + "STDOUT:\n" + eva.stdout.decode('utf-8') + "\nSTDERR:\n" + eva.stderr.decode('utf-8')
-          result["input_bar"] = [float(bar) for bar in np.loadtxt(self.temp_dir+"/dg-input-bars")]
-          try:
-            result["reverse_time_in_s"] = np.loadtxt(self.temp_dir+"/dg-perf-tapeeval-time")
-          except OSError:
-            # need to set measure_evaluation_time to true, or
-            # increase bufsize, in tape-evaluation.cpp, and recompile
-            result["reverse_time_in_s"] = 0
-          # run tape-evaluation another time for statistics
-          eva = subprocess.run([self.install_dir+"/bin/tape-evaluation", self.temp_dir, "--stats"], capture_output=True)
-          if eva.returncode!=0:
-            self.errmsg += "EVALUATION OF DERIVGRIND TAPE STATS FAILED:\n" + "STDOUT:\n" + eva.stdout.decode('utf-8') + "\nSTDERR:\n" + eva.stderr.decode('utf-8')
-          nZero,nOne,nTwo = [int(n) for n in eva.stdout.decode('utf-8').strip().split()]
-          result["number_of_jacobians"] = nOne + 2*nTwo
-          result["tape_size_in_b"] = (nZero+nOne+nTwo)*32
-        else:
-          result["number_of_jacobians"] = 0
+        with open(self.temp_dir+"/dg-output-indices", "r") as f:
+          number_of_outputs = len(f.readlines())
+        with open(self.temp_dir+"/dg-output-bars", "w") as f:
+          f.writelines(["1.0\n"]*number_of_outputs)
+        try: # remove file with reverse evaluation run-time
+          os.remove(self.temp_dir+"/dg-perf-tapeeval-time")
+        except OSError:
+          pass
+        eva = subprocess.run([self.install_dir+"/bin/tape-evaluation", self.temp_dir], capture_output=True)
+        if eva.returncode!=0:
+          self.errmsg += "EVALUATION OF DERIVGRIND TAPE FAILED:\n" + "STDOUT:\n" + eva.stdout.decode('utf-8') + "\nSTDERR:\n" + eva.stderr.decode('utf-8')
+        result["input_bar"] = [float(bar) for bar in np.loadtxt(self.temp_dir+"/dg-input-bars")]
+        try:
+          result["reverse_time_in_s"] = np.loadtxt(self.temp_dir+"/dg-perf-tapeeval-time")
+        except OSError:
+          # need to set measure_evaluation_time to true, or
+          # increase bufsize, in tape-evaluation.cpp, and recompile
+          result["reverse_time_in_s"] = 0
+        # run tape-evaluation another time for statistics
+        eva = subprocess.run([self.install_dir+"/bin/tape-evaluation", self.temp_dir, "--stats"], capture_output=True)
+        if eva.returncode!=0:
+          self.errmsg += "EVALUATION OF DERIVGRIND TAPE STATS FAILED:\n" + "STDOUT:\n" + eva.stdout.decode('utf-8') + "\nSTDERR:\n" + eva.stderr.decode('utf-8')
+        nZero,nOne,nTwo = [int(n) for n in eva.stdout.decode('utf-8').strip().split()]
+        result["number_of_jacobians"] = nOne + 2*nTwo
+        result["tape_size_in_b"] = (nZero+nOne+nTwo)*32
       self.results_dg.append(result)
 
   def verifyGradient(self):
@@ -743,7 +778,7 @@ class PerformanceTestCase(TestCase):
       self.runNoAD(self.benchmarkreps)
     if self.errmsg=="":
       self.runDG(self.benchmarkreps)
-    if self.errmsg=="" and not self.disable_codi and not self.tape_in_ram:
+    if self.errmsg=="" and not self.disable_codi:
       if not self.verifyGradient():
         self.errmsg="DERIVATIVES DISAGREE\n"
     if self.errmsg=="":
@@ -0,0 +1,142 @@
+# -------------------------------------------------------------------- #
+# --- Benchmark of Jacobian accumulation.    jacobian_benchmark.py --- #
+# -------------------------------------------------------------------- #
+#
+#  This file is part of Derivgrind, an automatic differentiation
+#  tool applicable to compiled programs.
+#
+#  Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+#  Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+#  Homepage: https://www.scicomp.uni-kl.de
+#  Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+#
+#  Lead developer: Max Aehle
+#
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License as
+#  published by the Free Software Foundation; either version 2 of the
+#  License, or (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful, but
+#  WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#  General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, see <http://www.gnu.org/licenses/>.
+#
+#  The GNU General Public License is contained in the file COPYING.
+#
+
+# Compare the ways of tape-evaluation to compute a Jacobian on a synthetic
+# raw tape: one reverse sweep per output, one vector-mode reverse sweep,
+# --sparse-jacobian, and --jacobian with all elimination orders. All
+# Jacobians are checked against the one of the vector-mode sweep.
+
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+tape_evaluation = "../../../install/bin/tape-evaluation"
+number_of_statements = 300000
+number_of_inputs = 50
+number_of_outputs = 50
+selected_temp_dir = None
+for arg in sys.argv[1:]:
+  if arg.startswith('--tape-evaluation='):
+    tape_evaluation = arg[len('--tape-evaluation='):]
+  elif arg.startswith('--statements='):
+    number_of_statements = int(arg[len('--statements='):])
+  elif arg.startswith('--inputs='):
+    number_of_inputs = int(arg[len('--inputs='):])
+  elif arg.startswith('--outputs='):
+    number_of_outputs = int(arg[len('--outputs='):])
+  elif arg.startswith('--tempdir='):
+    selected_temp_dir = arg[len('--tempdir='):]
+  else:
+    print("Usage: "+sys.argv[0]+" [--tape-evaluation=path] [--statements=n] [--inputs=n] [--outputs=n] [--tempdir=path]")
+    exit(1)
+
+def generate_tape(path):
+  """Write a tape whose statements use a recent result and, with probability 1/2, an arbitrary earlier one."""
+  random.seed(1)
+  blocks = bytearray(struct.pack('<QQdd',0,0,0.,0.))
+  for index in range(1,number_of_inputs+1):
+    blocks += struct.pack('<QQdd',0,0,0.,0.)
+  for index in range(number_of_inputs+1,number_of_statements):
+    index1 = random.randint(max(1,index-50),index-1)
+    index2 = random.randint(1,index-1) if random.random()<0.5 else 0
+    blocks += struct.pack('<QQdd',index1,index2,random.uniform(-1.1,1.1),random.uniform(-1.1,1.1) if index2 else 0.)
+  with open(path+"/dg-tape","wb") as f:
+    f.write(blocks)
+  with open(path+"/dg-input-indices","w") as f:
+    f.write("".join(str(index)+"\n" for index in range(1,number_of_inputs+1)))
+  with open(path+"/dg-output-indices","w") as f:
+    f.write("".join(str(index)+"\n" for index in range(number_of_statements-number_of_outputs,number_of_statements)))
+
+def run(path, *args):
+  """Run tape-evaluation and return the wall-clock time."""
+  start = time.perf_counter()
+  subprocess.run([tape_evaluation,path]+list(args), check=True, stdout=subprocess.DEVNULL)
+  return time.perf_counter()-start
+
+def read_matrix_market(filename):
+  jacobian = {}
+  with open(filename) as f:
+    lines = [line for line in f if not line.startswith('%')]
+  for line in lines[1:]:
+    row, col, value = line.split()
+    jacobian[(int(row)-1,int(col)-1)] = float(value)
+  return jacobian
+
+def compare(jacobian, reference):
+  """Maximal difference of the entries, relative to the largest entry of the reference."""
+  scale = max([abs(value) for value in reference.values()]+[1e-300])
+  keys = set(jacobian.keys()) | set(reference.keys())
+  return max([abs(jacobian.get(key,0.)-reference.get(key,0.)) for key in keys]+[0.]) / scale
+
+with tempfile.TemporaryDirectory(dir=selected_temp_dir) as path:
+  generate_tape(path)
+  results = []
+
+  # one vector-mode reverse sweep, whose result serves as reference
+  with open(path+"/dg-output-bars","w") as f:
+    for i in range(number_of_outputs):
+      f.write(" ".join("1.0" if j==i else "0.0" for j in range(number_of_outputs))+"\n")
+  seconds = run(path)
+  reference = {}
+  with open(path+"/dg-input-bars") as f:
+    for j, line in enumerate(f):
+      for i, value in enumerate(line.split()):
+        if float(value)!=0.:
+          reference[(i,j)] = float(value)
+  results.append(("vector reverse sweep", seconds, 0.))
+
+  # one scalar reverse sweep per output
+  seconds = 0.
+  jacobian = {}
+  for i in range(number_of_outputs):
+    with open(path+"/dg-output-bars","w") as f:
+      f.write("".join("1.0\n" if k==i else "0.0\n" for k in range(number_of_outputs)))
+    seconds += run(path)
+    with open(path+"/dg-input-bars") as f:
+      for j, line in enumerate(f):
+        if float(line)!=0.:
+          jacobian[(i,j)] = float(line)
+  results.append(("repeated reverse sweeps", seconds, compare(jacobian, reference)))
+
+  for option in ["--sparse-jacobian", "--jacobian", "--jacobian=forward", "--jacobian=reverse", "--jacobian=markowitz"]:
+    seconds = run(path, option)
+    results.append((option, seconds, compare(read_matrix_market(path+"/dg-jacobian.mtx"), reference)))
+
+  print("%d statements, %d inputs, %d outputs" % (number_of_statements, number_of_inputs, number_of_outputs))
+  print("%-24s %10s %12s" % ("method", "time [s]", "rel. error"))
+  for name, seconds, error in results:
+    print("%-24s %10.3f %12.2e" % (name, seconds, error))
+  if max(error for name, seconds, error in results) > 1e-10:
+    print("Jacobians differ.")
+    exit(1)
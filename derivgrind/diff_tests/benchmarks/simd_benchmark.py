@@ -0,0 +1,112 @@
+# -------------------------------------------------------------------- #
+# --- Benchmark of the SIMD reverse sweep.         simd_benchmark.py --- #
+# -------------------------------------------------------------------- #
+#
+#  This file is part of Derivgrind, an automatic differentiation
+#  tool applicable to compiled programs.
+#
+#  Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+#  Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+#  Homepage: https://www.scicomp.uni-kl.de
+#  Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+#
+#  Lead developer: Max Aehle
+#
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License as
+#  published by the Free Software Foundation; either version 2 of the
+#  License, or (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful, but
+#  WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#  General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, see <http://www.gnu.org/licenses/>.
+#
+#  The GNU General Public License is contained in the file COPYING.
+#
+
+# Compare the reverse sweep of tape-evaluation with and without --simd on
+# two synthetic raw tapes: one whose statements only use inputs, so that
+# every group of consecutive statements is independent, and one whose
+# statements use recent results, as on recorded tapes. Each sweep is run
+# several times and the best wall-clock time is reported. The bar values
+# computed with --simd must be identical to those of the scalar sweep.
+
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+tape_evaluation = "../../../install/bin/tape-evaluation"
+number_of_statements = 4000000
+number_of_inputs = 1000
+repetitions = 5
+selected_temp_dir = None
+DG_BINARY_MAGIC = 0x3152414e49424744 # from dg_bar_tape_format.h
+for arg in sys.argv[1:]:
+  if arg.startswith('--tape-evaluation='):
+    tape_evaluation = arg[len('--tape-evaluation='):]
+  elif arg.startswith('--statements='):
+    number_of_statements = int(arg[len('--statements='):])
+  elif arg.startswith('--inputs='):
+    number_of_inputs = int(arg[len('--inputs='):])
+  elif arg.startswith('--repetitions='):
+    repetitions = int(arg[len('--repetitions='):])
+  elif arg.startswith('--tempdir='):
+    selected_temp_dir = arg[len('--tempdir='):]
+  else:
+    print("Usage: "+sys.argv[0]+" [--tape-evaluation=path] [--statements=n] [--inputs=n] [--repetitions=n] [--tempdir=path]")
+    exit(1)
+
+def generate_tape(path, independent):
+  """Write a tape of two-operand statements, using only inputs if independent, or recent results otherwise."""
+  random.seed(1)
+  blocks = bytearray(struct.pack('<QQdd',0,0,0.,0.))
+  for index in range(1,number_of_inputs+1):
+    blocks += struct.pack('<QQdd',0,0,0.,0.)
+  for index in range(number_of_inputs+1,number_of_statements):
+    if independent:
+      index1, index2 = random.randint(1,number_of_inputs), random.randint(1,number_of_inputs)
+    else:
+      index1, index2 = random.randint(max(1,index-50),index-1), random.randint(1,index-1)
+    blocks += struct.pack('<QQdd',index1,index2,random.uniform(-1.1,1.1),random.uniform(-1.1,1.1))
+  with open(path+"/dg-tape","wb") as f:
+    f.write(blocks)
+  # seed all results, so that no statement is skipped because of a zero bar value;
+  # binary files keep the time for reading and writing them small
+  outputs = range(number_of_inputs+1,number_of_statements)
+  with open(path+"/dg-input-indices","wb") as f:
+    f.write(struct.pack('<QQ',DG_BINARY_MAGIC,1)+b"".join(struct.pack('<Q',index) for index in range(1,number_of_inputs+1)))
+  with open(path+"/dg-output-indices","wb") as f:
+    f.write(struct.pack('<QQ',DG_BINARY_MAGIC,1)+b"".join(struct.pack('<Q',index) for index in outputs))
+  with open(path+"/dg-output-bars","wb") as f:
+    f.write(struct.pack('<QQ',DG_BINARY_MAGIC,1)+b"".join(struct.pack('<d',random.uniform(-1,1)) for index in outputs))
+
+def run(path, *args):
+  """Run tape-evaluation several times, and return the best wall-clock time and the input bar values."""
+  seconds = float('inf')
+  for repetition in range(repetitions):
+    start = time.perf_counter()
+    subprocess.run([tape_evaluation,path]+list(args), check=True, stdout=subprocess.DEVNULL)
+    seconds = min(seconds, time.perf_counter()-start)
+  with open(path+"/dg-input-bars","rb") as f:
+    return seconds, f.read()
+
+print("%d statements, %d inputs, best of %d runs" % (number_of_statements, number_of_inputs, repetitions))
+print("%-12s %12s %12s" % ("tape", "scalar [s]", "--simd [s]"))
+identical = True
+for name, independent in [("independent", True), ("chained", False)]:
+  with tempfile.TemporaryDirectory(dir=selected_temp_dir) as path:
+    generate_tape(path, independent)
+    scalar_seconds, scalar_bars = run(path)
+    simd_seconds, simd_bars = run(path, "--simd")
+    print("%-12s %12.3f %12.3f" % (name, scalar_seconds, simd_seconds))
+    identical = identical and scalar_bars==simd_bars
+if not identical:
+  print("Bar values differ.")
+  exit(1)
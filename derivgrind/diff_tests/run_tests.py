@@ -40,14 +40,16 @@ import tempfile
 selected_install_dir = "../../install"
 selected_temp_dir = None
 selected_codi_dir = os.path.dirname(__file__)+"/../externals/CoDiPack/include/"
+selected_record_flags = []
 selected_testcase = None
-if len(sys.argv)>5:
+if len(sys.argv)>6:
   print("Usage: "+sys.argv[0]+" [options]                   - Run all testcases.")
   print("       "+sys.argv[0]+" [options] name_of_testcase  - Run single testcase.")
   print("Options:")
   print("  --prefix=path    Valgrind installation directory.")
   print("  --tempdir=path   Directory for temporary files produced by tests.")
   print("  --codidir=path   Include directory of CoDiPack for performance tests.")
+  print("  --record-flags=f Comma-separated additional Valgrind flags for recording mode.")
   exit(1)
 for i in range(1,len(sys.argv)):
   arg = sys.argv[i]
@@ -57,6 +59,8 @@ for i in range(1,len(sys.argv)):
     selected_temp_dir = arg[len('--tempdir='):]
   elif arg.startswith('--codidir='):
     selected_codi_dir = arg[len('--codidir='):]
+  elif arg.startswith('--record-flags='):
+    selected_record_flags = arg[len('--record-flags='):].split(',')
   else:
     selected_testcase = arg
 TestCase.install_dir = selected_install_dir
@@ -65,6 +69,7 @@ if selected_temp_dir == None:
   selected_temp_dir = tempdir.name
 TestCase.temp_dir = selected_temp_dir
 TestCase.codi_dir = selected_codi_dir
+TestCase.record_flags = selected_record_flags
 
 # We first define a list of "basic" tests.
 # The actual testlist is derived from it by additionally
@@ -1239,6 +1244,36 @@ regression_templates.append(exception)
 
 
 
+# With --index-reuse=yes, the indices of the results of math functions, which
+# are obtained via DG_NEW_INDEX_N, must be recycled. The loop records more statements
+# than the minimal number of fresh indices between two collections (4M).
+sin_loop = ClientRequestTestCase("sin_loop")
+sin_loop.include = "#include <math.h>"
+sin_loop.ldflags = '-lm'
+sin_loop.stmtd = "double c = a; for(long i=0; i<10000000; i++){ c = c + 0.0*sin(c); }"
+sin_loop.vals = {'a':1.5}
+sin_loop.bars = {'c':2.0}
+sin_loop.test_vals = {'c':1.5}
+sin_loop.test_bars = {'a':2.0}
+sin_loop.max_indices = 1<<23
+sin_loop.disable = lambda mode, arch, compiler, typename : mode!="bar" or arch!="amd64" or compiler!="gcc" or "--index-reuse=yes" not in TestCase.record_flags
+regression_templates.append(sin_loop)
+
+# With --tape-format=compact --index-reuse=yes, inputs are staged as statements without
+# operands. Input d is registered after statements with operands have been staged, and must
+# not be recorded with a stale operand, which would overwrite its bar value.
+input_after_statements = ClientRequestTestCase("input_after_statements")
+input_after_statements.stmtd = "double c = a*b; double d = c+1.0; DG_INPUTF(d); double e = c*d;"
+input_after_statements.vals = {'a':2.0,'b':3.0}
+input_after_statements.dots = {'a':1.0,'b':1.0,'d':1.0}
+input_after_statements.bars = {'e':1.0}
+input_after_statements.test_vals = {'e':42.0}
+input_after_statements.test_dots = {'e':41.0}
+input_after_statements.test_bars = {'a':21.0,'b':14.0,'d':6.0}
+input_after_statements.record_flags = ["--tape-format=compact","--index-reuse=yes"]
+input_after_statements.disable = lambda mode, arch, compiler, typename : mode!="bar" or compiler not in ["gcc","g++"] or typename!="double" or TestCase.record_flags!=[]
+regression_templates.append(input_after_statements)
+
 ### Interactive tests ###
 addition_interactive = InteractiveTestCase("addition_interactive")
 addition_interactive.stmtd = "double c = a+b;"
@@ -1284,6 +1319,21 @@ sin_100_interactive.test_dots = {'c':np.cos(100)*3.1}
 sin_100_interactive.test_bars = {'a':np.cos(100)*3.1}
 regression_templates.append(sin_100_interactive)
 
+# With --record-stop, Valgrind stops in the debugger whenever one of the given indices is
+# assigned. The inputs get the indices 1 and 2, and every multiplication a new index. The list
+# is unsorted and contains a duplicate, so the run must stop at 5, 8 and 12, once each.
+record_stop_interactive = InteractiveTestCase("record_stop_interactive")
+record_stop_interactive.stmtd = "double c = a; for(int i=0; i<20; i++){ c = c*b; }"
+record_stop_interactive.vals = {'a':1.5,'b':1.0}
+record_stop_interactive.dots = {'a':1.0,'b':1.0}
+record_stop_interactive.bars = {'c':1.0}
+record_stop_interactive.test_vals = {'c':1.5}
+record_stop_interactive.test_dots = {'c':31.0}
+record_stop_interactive.test_bars = {'a':1.0,'b':30.0}
+record_stop_interactive.record_stop = "12,5,12,8"
+record_stop_interactive.disable = lambda mode, arch, compiler, typename : mode!="bar" or arch!="amd64" or compiler!="gcc" or typename!="double" or "--index-reuse=yes" in TestCase.record_flags
+regression_templates.append(record_stop_interactive)
+
 ### Performance Tests ###
 
 performance_templates = []
@@ -0,0 +1,640 @@
+# -------------------------------------------------------------------- #
+# --- Tests of tape-evaluation options.  tape_evaluation_tests.py --- #
+# -------------------------------------------------------------------- #
+#
+#  This file is part of Derivgrind, an automatic differentiation
+#  tool applicable to compiled programs.
+#
+#  Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+#  Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+#  Homepage: https://www.scicomp.uni-kl.de
+#  Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+#
+#  Lead developer: Max Aehle
+#
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License as
+#  published by the Free Software Foundation; either version 2 of the
+#  License, or (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful, but
+#  WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#  General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, see <http://www.gnu.org/licenses/>.
+#
+#  The GNU General Public License is contained in the file COPYING.
+#
+
+# Run tape-evaluation with its options on synthetic tapes, and compare the
+# results with the plain reverse and forward sweeps over a raw tape. Options
+# that are documented to reproduce the plain sweeps exactly are required to
+# give bit-identical results, the others are compared with a tolerance.
+# The plain sweeps are compared with a sweep implemented in Python.
+# The tapes are written directly, so Valgrind is not needed.
+
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import fnmatch
+
+selected_install_dir = "../../install"
+selected_temp_dir = None
+selected_testcase = None
+require_codipack = False
+if len(sys.argv)>5:
+  print("Usage: "+sys.argv[0]+" [options]                   - Run all testcases.")
+  print("       "+sys.argv[0]+" [options] name_of_testcase  - Run single testcase.")
+  print("Options:")
+  print("  --prefix=path    Valgrind installation directory.")
+  print("  --tempdir=path   Directory for temporary files produced by tests.")
+  print("  --require-codipack  Fail instead of skipping the --codipack tests if tape-evaluation lacks CoDiPack.")
+  exit(1)
+for i in range(1,len(sys.argv)):
+  arg = sys.argv[i]
+  if arg.startswith('--prefix='):
+    selected_install_dir = arg[len('--prefix='):]
+  elif arg.startswith('--tempdir='):
+    selected_temp_dir = arg[len('--tempdir='):]
+  elif arg=='--require-codipack':
+    require_codipack = True
+  else:
+    selected_testcase = arg
+tape_evaluation = selected_install_dir+"/bin/tape-evaluation"
+
+# Constants from dg_bar_tape_format.h.
+DG_TAPE_COMPACT_MAGIC = 0x3143455041544744
+DG_TAPE_COMPACT_CHUNKSIZE = 4096
+DG_TAPE_FLAG_EXPLICIT_LHS = 1
+DG_TAPE_TAG_ABSENT, DG_TAPE_TAG_PLUSONE, DG_TAPE_TAG_MINUSONE, DG_TAPE_TAG_RAW = 0, 1, 2, 3
+DG_TAPE_TAG_INDEX1_ABS = 0x10
+DG_TAPE_TAG_INDEX2_ABS = 0x20
+DG_TAPE_TAG_NARY = 0x40
+DG_TAPE_THREAD_SHIFT = 48
+DG_BINARY_MAGIC = 0x3152414e49424744
+
+class Computation:
+  """Synthetic computation with statements 1,...,n, each given by a list of (operand, partial derivative) pairs.
+
+  Inputs are statements without operands. All other statements use the result of a recent statement,
+  and maybe one or more other results, some of them far back.
+  """
+  def __init__(self, number_of_statements, number_of_inputs, number_of_outputs, max_operands, seed):
+    random.seed(seed)
+    self.statements = [None] + [[] for i in range(number_of_inputs)]
+    for k in range(number_of_inputs+1, number_of_statements+1):
+      operands = [random.randint(max(1,k-20),k-1)]
+      while len(operands)<max_operands and random.random()<0.5:
+        operands.append(random.randint(1,k-1) if random.random()<0.2 else random.randint(max(1,k-100),k-1))
+      self.statements.append([(operand, random.choice([1.0,-1.0]) if random.random()<0.2 else random.uniform(-1.1,1.1)) for operand in operands])
+    self.inputs = list(range(1,number_of_inputs+1))
+    self.outputs = list(range(number_of_statements-number_of_outputs+1,number_of_statements+1))
+
+  def reverse(self, outputbars):
+    bars = [0.]*len(self.statements)
+    for output, bar in zip(self.outputs, outputbars):
+      bars[output] += bar
+    for k in range(len(self.statements)-1,0,-1):
+      for operand, partial in self.statements[k]:
+        bars[operand] += bars[k]*partial
+    return [bars[i] for i in self.inputs]
+
+  def forward(self, inputdots):
+    dots = [0.]*len(self.statements)
+    for i, dot in zip(self.inputs, inputdots):
+      dots[i] = dot
+    for k in range(1,len(self.statements)):
+      if self.statements[k]:
+        dots[k] = sum(dots[operand]*partial for operand, partial in self.statements[k])
+    return [dots[o] for o in self.outputs]
+
+class GivenComputation(Computation):
+  """Computation with the given statements, inputs and outputs."""
+  def __init__(self, statements, inputs, outputs):
+    self.statements = statements
+    self.inputs = inputs
+    self.outputs = outputs
+
+def write_indices(filename, indices, binary=False):
+  with open(filename,"wb" if binary else "w") as f:
+    if binary:
+      f.write(struct.pack('<QQ',DG_BINARY_MAGIC,1)+b"".join(struct.pack('<Q',i) for i in indices))
+    else:
+      f.write("".join(str(i)+"\n" for i in indices))
+
+def write_seeds(filename, rows, binary=False):
+  """Write a list of rows of dot or bar values."""
+  with open(filename,"wb" if binary else "w") as f:
+    if binary:
+      f.write(struct.pack('<QQ',DG_BINARY_MAGIC,len(rows[0]))+b"".join(struct.pack('<d',v) for row in rows for v in row))
+    else:
+      f.write("".join(" ".join(repr(v) for v in row)+"\n" for row in rows))
+
+def read_results(filename):
+  """Read a list of rows of dot or bar values, in the text or binary format."""
+  with open(filename,"rb") as f:
+    data = f.read()
+  if len(data)>=16 and struct.unpack('<Q',data[:8])[0]==DG_BINARY_MAGIC:
+    columns = struct.unpack('<Q',data[8:16])[0]
+    values = struct.unpack('<%dd' % ((len(data)-16)//8), data[16:])
+    return [list(values[i:i+columns]) for i in range(0,len(values),columns)]
+  return [[float(v) for v in line.split()] for line in data.decode().splitlines() if line.strip()!=""]
+
+def write_raw_tape(path, computation, binary=False):
+  """Write a raw tape, splitting statements with more than two operands into chains of blocks."""
+  blocks = [(0,0,0.,0.)]
+  position = [0]*len(computation.statements)
+  for k in range(1,len(computation.statements)):
+    operands = [(position[operand], partial) for operand, partial in computation.statements[k]]
+    if len(operands)<=2:
+      operands += [(0,0.)]*(2-len(operands))
+      blocks.append((operands[0][0],operands[1][0],operands[0][1],operands[1][1]))
+    else:
+      blocks.append((operands[0][0],operands[1][0],operands[0][1],operands[1][1]))
+      for operand, partial in operands[2:]:
+        blocks.append((len(blocks)-1,operand,1.0,partial))
+    position[k] = len(blocks)-1
+  os.makedirs(path, exist_ok=True)
+  with open(path+"/dg-tape","wb") as f:
+    f.write(b"".join(struct.pack('<QQdd',*block) for block in blocks))
+  write_indices(path+"/dg-input-indices", [position[i] for i in computation.inputs], binary)
+  write_indices(path+"/dg-output-indices", [position[o] for o in computation.outputs], binary)
+
+def varint(v):
+  encoded = bytearray()
+  while v>=0x80:
+    encoded.append((v&0x7f)|0x80)
+    v >>= 7
+  encoded.append(v)
+  return bytes(encoded)
+
+def diff_class(partial):
+  return DG_TAPE_TAG_PLUSONE if partial==1.0 else DG_TAPE_TAG_MINUSONE if partial==-1.0 else DG_TAPE_TAG_RAW
+
+def write_compact_tape(path, computation, index_reuse=False):
+  """Write a tape in the compact format.
+
+  With index_reuse, the index of a result that is not used anymore is assigned
+  again, as with --index-reuse=yes; inputs and outputs are never reassigned.
+  """
+  statements = computation.statements
+  lastuse = list(range(len(statements)))
+  for k in range(1,len(statements)):
+    for operand, partial in statements[k]:
+      lastuse[operand] = k
+  keep = set(computation.inputs) | set(computation.outputs)
+  index = list(range(len(statements)))
+  number_of_indices = len(statements)
+  if index_reuse:
+    free = []
+    number_of_indices = 1
+    for k in range(1,len(statements)):
+      # release operands first, so that a result may overwrite one of its operands
+      for operand in sorted(set(operand for operand, partial in statements[k])):
+        if lastuse[operand]==k and operand not in keep:
+          free.append(index[operand])
+      if free:
+        index[k] = free.pop()
+      else:
+        index[k] = number_of_indices
+        number_of_indices += 1
+      if lastuse[k]==k and k not in keep:
+        free.append(index[k])
+  data = bytearray(struct.pack('<QQQQ',DG_TAPE_COMPACT_MAGIC,DG_TAPE_COMPACT_CHUNKSIZE,DG_TAPE_FLAG_EXPLICIT_LHS if index_reuse else 0,0))
+  offsets = []
+  for k in range(len(statements)):
+    if k%DG_TAPE_COMPACT_CHUNKSIZE==0:
+      offsets.append(len(data))
+    lhs = index[k]
+    if index_reuse:
+      data += varint(lhs)
+    operands = [(index[operand], partial) for operand, partial in (statements[k] or [])]
+    if len(operands)<=2:
+      tag = 0
+      for j, (operand, partial) in enumerate(operands):
+        tag |= diff_class(partial) << (2*j)
+        if operand>=lhs:
+          tag |= DG_TAPE_TAG_INDEX1_ABS if j==0 else DG_TAPE_TAG_INDEX2_ABS
+      data.append(tag)
+      for operand, partial in operands:
+        data += varint(operand if operand>=lhs else lhs-operand)
+      for operand, partial in operands:
+        if diff_class(partial)==DG_TAPE_TAG_RAW:
+          data += struct.pack('<d',partial)
+    else:
+      data.append(DG_TAPE_TAG_NARY)
+      data += varint(len(operands))
+      for operand, partial in operands:
+        data.append(diff_class(partial) | (DG_TAPE_TAG_INDEX1_ABS if operand>=lhs else 0))
+        data += varint(operand if operand>=lhs else lhs-operand)
+        if diff_class(partial)==DG_TAPE_TAG_RAW:
+          data += struct.pack('<d',partial)
+  tableoffset = len(data)
+  data += b"".join(struct.pack('<Q',offset) for offset in offsets)
+  if index_reuse:
+    data += struct.pack('<Q',number_of_indices)
+  data += struct.pack('<QQQQ',len(statements),len(offsets),tableoffset,DG_TAPE_COMPACT_MAGIC)
+  os.makedirs(path, exist_ok=True)
+  with open(path+"/dg-tape","wb") as f:
+    f.write(data)
+  write_indices(path+"/dg-input-indices", [index[i] for i in computation.inputs])
+  write_indices(path+"/dg-output-indices", [index[o] for o in computation.outputs])
+
+def write_thread_tapes(path, computation, number_of_threads, seed):
+  """Distribute the statements over threads and write tapes as with --per-thread-tapes=yes."""
+  random.seed(seed)
+  tapes = {t:[(0,0,0.,0.)] for t in range(1,number_of_threads+1)}
+  index = [0]*len(computation.statements)
+  order = [] # records (thread, first block, end block, mask)
+  t = 1
+  for k in range(1,len(computation.statements)):
+    if random.random()<0.05:
+      t = random.randint(1,number_of_threads)
+    operands = [(index[operand], partial) for operand, partial in computation.statements[k]]
+    assert len(operands)<=2
+    operands += [(0,0.)]*(2-len(operands))
+    mask = 0
+    for operand, partial in operands:
+      if operand!=0 and (operand>>DG_TAPE_THREAD_SHIFT)+1!=t:
+        mask |= 1<<(((operand>>DG_TAPE_THREAD_SHIFT)+1)%64)
+    if order and order[-1][0]==t:
+      order[-1][2] += 1
+      order[-1][3] |= mask
+    else:
+      order.append([t,len(tapes[t]),len(tapes[t])+1,mask])
+    tapes[t].append((operands[0][0],operands[1][0],operands[0][1],operands[1][1]))
+    index[k] = ((t-1)<<DG_TAPE_THREAD_SHIFT) + len(tapes[t])-1
+  os.makedirs(path, exist_ok=True)
+  for t in tapes:
+    with open(path+("/dg-tape" if t==1 else "/dg-tape-%d" % t),"wb") as f:
+      f.write(b"".join(struct.pack('<QQdd',*block) for block in tapes[t]))
+  with open(path+"/dg-tape-order","wb") as f:
+    f.write(b"".join(struct.pack('<QQQQ',*record) for record in order))
+  write_indices(path+"/dg-input-indices", [index[i] for i in computation.inputs])
+  write_indices(path+"/dg-output-indices", [index[o] for o in computation.outputs])
+
+class EvaluationError(Exception):
+  pass
+
+def run(path, *args):
+  """Run tape-evaluation, and return its standard output."""
+  process = subprocess.run([tape_evaluation,path]+list(args), capture_output=True)
+  if process.returncode!=0:
+    raise EvaluationError("tape-evaluation "+path+" "+" ".join(args)+" failed:\n"+process.stdout.decode()+process.stderr.decode())
+  return process.stdout.decode()
+
+def reverse(path, outputbars, *args, binary=False):
+  """Seed the outputs with a list of rows of bar values, and return the rows of input bar values."""
+  write_seeds(path+"/dg-output-bars", outputbars, binary)
+  run(path, *args)
+  return read_results(path+"/dg-input-bars")
+
+def forward(path, inputdots, *args, binary=False):
+  """Seed the inputs with a list of rows of dot values, and return the rows of output dot values."""
+  write_seeds(path+"/dg-input-dots", inputdots, binary)
+  run(path, "--forward", *args)
+  return read_results(path+"/dg-output-dots")
+
+def difference(rows, reference):
+  """Maximal difference of the entries, relative to the largest entry of the reference."""
+  values = [v for row in rows for v in row]
+  referencevalues = [v for row in reference for v in row]
+  if len(values)!=len(referencevalues):
+    return float('inf')
+  scale = max([abs(v) for v in referencevalues]+[1e-300])
+  return max([abs(v-w) for v,w in zip(values,referencevalues)]+[0.]) / scale
+
+def compare(what, rows, reference, tol):
+  """Return an error message if the results differ by more than tol, or at all if tol is 0."""
+  if tol==0 and rows==reference:
+    return ""
+  error = difference(rows, reference)
+  if tol>0 and error<=tol:
+    return ""
+  return f"{what.upper()} DISAGREE: relative difference {error}, tolerance {tol}\n"
+
+def read_matrix_market(filename):
+  jacobian = {}
+  with open(filename) as f:
+    lines = [line for line in f if not line.startswith('%')]
+  for line in lines[1:]:
+    row, col, value = line.split()
+    jacobian[(int(row)-1,int(col)-1)] = float(value)
+  return jacobian
+
+def has_avx2():
+  try:
+    with open("/proc/cpuinfo") as f:
+      return " avx2" in f.read()
+  except OSError:
+    return False
+
+### Tapes and seeds ###
+if selected_temp_dir == None:
+  tempdir = tempfile.TemporaryDirectory()
+  selected_temp_dir = tempdir.name
+
+computation = Computation(20000, 20, 10, 2, 1)
+nary_computation = Computation(20000, 20, 10, 5, 2)
+outputbars = [[random.uniform(-1,1)] for o in computation.outputs]
+inputdots = [[random.uniform(-1,1)] for i in computation.inputs]
+width = 3
+vector_outputbars = [[random.uniform(-1,1) for k in range(width)] for o in computation.outputs]
+vector_inputdots = [[random.uniform(-1,1) for k in range(width)] for i in computation.inputs]
+
+raw = selected_temp_dir+"/raw"
+write_raw_tape(raw, computation)
+reference_bars = reverse(raw, outputbars)
+reference_dots = forward(raw, inputdots)
+nary_raw = selected_temp_dir+"/nary-raw"
+write_raw_tape(nary_raw, nary_computation)
+nary_reference_bars = reverse(nary_raw, outputbars)
+nary_reference_dots = forward(nary_raw, inputdots)
+
+def fresh(name):
+  """Directory for the files of a test."""
+  path = selected_temp_dir+"/"+name
+  shutil.rmtree(path, ignore_errors=True)
+  os.makedirs(path)
+  return path
+
+def copy_of_raw(name):
+  path = fresh(name)
+  for filename in ["dg-tape", "dg-input-indices", "dg-output-indices"]:
+    shutil.copy(raw+"/"+filename, path+"/"+filename)
+  return path
+
+### Testcases ###
+# Each testcase returns an error message, which is empty if it has passed, or None if it has been skipped.
+
+def test_python_sweep():
+  return compare("reverse bar values", reference_bars, [[v] for v in computation.reverse([row[0] for row in outputbars])], 1e-12) \
+       + compare("forward dot values", reference_dots, [[v] for v in computation.forward([row[0] for row in inputdots])], 1e-12) \
+       + compare("nary reverse bar values", nary_reference_bars, [[v] for v in nary_computation.reverse([row[0] for row in outputbars])], 1e-12) \
+       + compare("nary forward dot values", nary_reference_dots, [[v] for v in nary_computation.forward([row[0] for row in inputdots])], 1e-12)
+
+def test_compact():
+  path = fresh("compact")
+  write_compact_tape(path, computation)
+  return compare("reverse bar values", reverse(path, outputbars), reference_bars, 1e-12) \
+       + compare("forward dot values", forward(path, inputdots), reference_dots, 1e-12)
+
+def test_compact_nary():
+  path = fresh("compact-nary")
+  write_compact_tape(path, nary_computation)
+  return compare("reverse bar values", reverse(path, outputbars), nary_reference_bars, 1e-12) \
+       + compare("forward dot values", forward(path, inputdots), nary_reference_dots, 1e-12)
+
+def test_compact_index_reuse():
+  path = fresh("compact-index-reuse")
+  write_compact_tape(path, nary_computation, index_reuse=True)
+  return compare("reverse bar values", reverse(path, outputbars), nary_reference_bars, 1e-12) \
+       + compare("forward dot values", forward(path, inputdots), nary_reference_dots, 1e-12)
+
+def test_per_thread_tapes():
+  path = fresh("per-thread")
+  write_thread_tapes(path, computation, 3, 3)
+  return compare("reverse bar values", reverse(path, outputbars), reference_bars, 1e-12) \
+       + compare("forward dot values", forward(path, inputdots), reference_dots, 1e-12)
+
+def test_chunks():
+  path = copy_of_raw("chunks")
+  return compare("reverse bar values", reverse(path, outputbars, "--chunk-size=1000"), reference_bars, 0) \
+       + compare("forward dot values", forward(path, inputdots, "--chunk-size=1000"), reference_dots, 0)
+
+def test_vector_reverse():
+  path = copy_of_raw("vector-reverse")
+  errmsg = ""
+  bars = reverse(path, vector_outputbars)
+  for k in range(width):
+    errmsg += compare("reverse bar values of column "+str(k), [[row[k]] for row in bars], reverse(path, [[row[k]] for row in vector_outputbars]), 0)
+  return errmsg
+
+def test_vector_forward():
+  path = copy_of_raw("vector-forward")
+  errmsg = ""
+  dots = forward(path, vector_inputdots)
+  for k in range(width):
+    errmsg += compare("forward dot values of column "+str(k), [[row[k]] for row in dots], forward(path, [[row[k]] for row in vector_inputdots]), 0)
+  return errmsg
+
+def test_threads():
+  path = copy_of_raw("threads")
+  errmsg = compare("reverse bar values", reverse(path, outputbars, "--threads=4"), reference_bars, 1e-12) \
+         + compare("forward dot values", forward(path, inputdots, "--threads=4"), reference_dots, 1e-12)
+  # levels of 4000 statements are shared among the threads
+  random.seed(4)
+  statements = [None] + [[] for i in range(100)]
+  for k in range(101, 12101):
+    previous = 1 if k<=4100 else (k-101)//4000*4000-3899
+    statements.append([(random.randint(previous,previous+3999 if k>4100 else 100), random.uniform(-1.1,1.1)) for j in range(2)])
+  wide = GivenComputation(statements, list(range(1,101)), list(range(12091,12101)))
+  path = fresh("threads-wide")
+  write_raw_tape(path, wide)
+  wide_inputdots = [[random.uniform(-1,1)] for i in wide.inputs]
+  bars = [[v] for v in wide.reverse([row[0] for row in outputbars])]
+  dots = [[v] for v in wide.forward([row[0] for row in wide_inputdots])]
+  return errmsg + compare("wide reverse bar values", reverse(path, outputbars, "--threads=4"), bars, 1e-12) \
+       + compare("wide forward dot values", forward(path, wide_inputdots, "--threads=4"), dots, 1e-12)
+
+def test_threads_chain():
+  # A chain of statements has as many levels as statements, which are too narrow
+  # to be shared among the threads, so --threads must not be slower than the plain sweep.
+  chain = GivenComputation([None,[]]+[[(k-1,0.5)] for k in range(2,200001)], [1], [200000])
+  path = fresh("threads-chain")
+  write_raw_tape(path, chain)
+  write_seeds(path+"/dg-output-bars", [[1.0]])
+  def seconds(*args):
+    best = float('inf')
+    for repetition in range(3):
+      start = time.perf_counter()
+      run(path, *args)
+      best = min(best, time.perf_counter()-start)
+    return best
+  run(path, "--threads=4") # analyse the levels and cache them
+  plain, threaded = seconds(), seconds("--threads=4")
+  errmsg = compare("reverse bar values", reverse(path, [[1.0]], "--threads=4"), reverse(path, [[1.0]]), 0)
+  if threaded > 2*plain+0.05:
+    errmsg += f"--threads=4 took {threaded} s, the plain sweep {plain} s\n"
+  return errmsg
+
+def test_binary_files():
+  path = fresh("binary")
+  write_raw_tape(path, computation, binary=True)
+  # text files contain 16 significant digits
+  text = lambda rows: [[float("%.16g" % v) for v in row] for row in rows]
+  return compare("reverse bar values", text(reverse(path, outputbars, binary=True)), reference_bars, 0) \
+       + compare("forward dot values", text(forward(path, inputdots, binary=True)), reference_dots, 0)
+
+def test_read_ahead():
+  path = copy_of_raw("read-ahead")
+  return compare("reverse bar values", reverse(path, outputbars, "--chunk-size=1000", "--read-ahead=3"), reference_bars, 0) \
+       + compare("forward dot values", forward(path, inputdots, "--chunk-size=1000", "--read-ahead=3"), reference_dots, 0)
+
+def test_rewritten(mode, tol):
+  def test():
+    newpath = fresh(mode)
+    run(raw, "--"+mode, newpath)
+    return compare("reverse bar values", reverse(newpath, outputbars), reference_bars, tol) \
+         + compare("forward dot values", forward(newpath, inputdots), reference_dots, tol)
+  return test
+
+def test_jacobian(option):
+  def test():
+    path = copy_of_raw(option.strip("-").replace("=","-"))
+    number_of_outputs = len(computation.outputs)
+    bars = reverse(path, [[1.0 if i==j else 0.0 for j in range(number_of_outputs)] for i in range(number_of_outputs)])
+    reference = {}
+    for j, row in enumerate(bars):
+      for i, value in enumerate(row):
+        if value!=0.:
+          reference[(i,j)] = value
+    run(path, option)
+    jacobian = read_matrix_market(path+"/dg-jacobian.mtx")
+    keys = sorted(set(jacobian.keys()) | set(reference.keys()))
+    return compare("jacobian entries", [[jacobian.get(key,0.) for key in keys]], [[reference.get(key,0.) for key in keys]], 1e-12)
+  return test
+
+def test_out_of_core():
+  path = copy_of_raw("out-of-core")
+  return compare("reverse bar values", reverse(path, outputbars, "--out-of-core=1000"), reference_bars, 0) \
+       + compare("forward dot values", forward(path, inputdots, "--out-of-core=1000"), reference_dots, 0)
+
+def test_precision(precision, tol):
+  def test():
+    path = copy_of_raw("precision-"+precision)
+    return compare("reverse bar values", reverse(path, outputbars, "--precision="+precision), reference_bars, tol) \
+         + compare("forward dot values", forward(path, inputdots, "--precision="+precision), reference_dots, tol)
+  return test
+
+def test_precision_cancellation():
+  # With the seeds 2^53, 1, 1, -2^53, the sums are 2, but the ones are lost in double precision.
+  # The sum of the dot values is taken in one statement, the sum of the bar values over four statements.
+  big = 2.0**53
+  ill = GivenComputation([None,[],[],[],[],[(1,1.0),(2,1.0),(3,1.0),(4,1.0)],[(5,1.0)],[(5,1.0)],[(5,1.0)],[(5,1.0)]], [1,2,3,4], [6,7,8,9])
+  path = fresh("precision-cancellation")
+  write_compact_tape(path, ill)
+  dots = [[big],[1.0],[1.0],[-big]]
+  bars = [[-big],[1.0],[1.0],[big]] # added up from the last output to the first
+  errmsg = compare("double reverse bar values", reverse(path, bars), [[0.0]]*4, 0) \
+         + compare("double forward dot values", forward(path, dots), [[0.0]]*4, 0)
+  for precision in ["kahan", "double-double"]:
+    errmsg += compare(precision+" reverse bar values", reverse(path, bars, "--precision="+precision), [[2.0]]*4, 0) \
+            + compare(precision+" forward dot values", forward(path, dots, "--precision="+precision), [[2.0]]*4, 0)
+  return errmsg
+
+def test_simd():
+  if not has_avx2():
+    return None
+  path = copy_of_raw("simd")
+  return compare("reverse bar values", reverse(path, outputbars, "--simd"), reference_bars, 0)
+
+def test_codipack(tape):
+  def test():
+    # on compact tapes with index reuse and on renumbered tapes, results overwrite operands
+    seeds_bars, seeds_dots = outputbars, inputdots
+    if tape=="raw":
+      path = copy_of_raw("codipack")
+      bars, dots = reference_bars, reference_dots
+    elif tape=="compact-index-reuse":
+      path = fresh("codipack-compact-index-reuse")
+      write_compact_tape(path, nary_computation, index_reuse=True)
+      bars, dots = nary_reference_bars, nary_reference_dots
+    elif tape=="renumber":
+      path = fresh("codipack-renumber")
+      run(raw, "--renumber", path)
+      bars, dots = reference_bars, reference_dots
+    elif tape=="many-operands":
+      # statements with up to DG_TAPE_MAX_OPERANDS operands exceed CoDiPack's 8-bit argument count
+      random.seed(5)
+      statements = [None] + [[] for i in range(300)]
+      for n in [256, 255, 129, 128, 127, 2]:
+        statements.append([(operand, random.uniform(-1.1,1.1)) for operand in random.sample(range(1,len(statements)), n)])
+      many = GivenComputation(statements, list(range(1,301)), list(range(301,307)))
+      path = fresh("codipack-many-operands")
+      write_compact_tape(path, many)
+      seeds_bars, seeds_dots = outputbars[:6], [[random.uniform(-1,1)] for i in many.inputs]
+      bars = [[v] for v in many.reverse([row[0] for row in seeds_bars])]
+      dots = [[v] for v in many.forward([row[0] for row in seeds_dots])]
+    write_seeds(path+"/dg-output-bars", seeds_bars)
+    process = subprocess.run([tape_evaluation, path, "--codipack"], capture_output=True)
+    if "compiled without CoDiPack" in process.stderr.decode():
+      return "tape-evaluation has been compiled without CoDiPack.\n" if require_codipack else None
+    return compare("reverse bar values", reverse(path, seeds_bars, "--codipack"), bars, 1e-12) \
+         + compare("forward dot values", forward(path, seeds_dots, "--codipack"), dots, 1e-12)
+  return test
+
+testlist = [
+  ("python_sweep", test_python_sweep),
+  ("compact", test_compact),
+  ("compact_nary", test_compact_nary),
+  ("compact_index_reuse", test_compact_index_reuse),
+  ("per_thread_tapes", test_per_thread_tapes),
+  ("chunks", test_chunks),
+  ("vector_reverse", test_vector_reverse),
+  ("vector_forward", test_vector_forward),
+  ("threads", test_threads),
+  ("threads_chain", test_threads_chain),
+  ("binary_files", test_binary_files),
+  ("read_ahead", test_read_ahead),
+  ("prune", test_rewritten("prune", 1e-12)),
+  ("collapse", test_rewritten("collapse", 1e-12)),
+  ("sparse_jacobian", test_jacobian("--sparse-jacobian")),
+  ("jacobian", test_jacobian("--jacobian")),
+  ("jacobian_forward", test_jacobian("--jacobian=forward")),
+  ("jacobian_reverse", test_jacobian("--jacobian=reverse")),
+  ("jacobian_markowitz", test_jacobian("--jacobian=markowitz")),
+  ("out_of_core", test_out_of_core),
+  ("precision_float", test_precision("float", 1e-4)),
+  ("precision_kahan", test_precision("kahan", 1e-12)),
+  ("precision_long_double", test_precision("long-double", 1e-12)),
+  ("precision_double_double", test_precision("double-double", 1e-12)),
+  ("precision_cancellation", test_precision_cancellation),
+  ("simd", test_simd),
+  ("renumber", test_rewritten("renumber", 0)),
+  ("codipack", test_codipack("raw")),
+  ("codipack_compact_index_reuse", test_codipack("compact-index-reuse")),
+  ("codipack_renumber", test_codipack("renumber")),
+  ("codipack_many_operands", test_codipack("many-operands")),
+]
+
+### Run testcases ###
+if not selected_testcase:
+  selected_testcase = "*"
+outcomes = []
+for name, test in testlist:
+  if fnmatch.fnmatchcase(name, selected_testcase):
+    print("##### Running tape-evaluation test '"+name+"'... #####", flush=True)
+    try:
+      errmsg = test()
+    except EvaluationError as e:
+      errmsg = str(e)
+    if errmsg==None:
+      print("Skipped.\n")
+    elif errmsg=="":
+      print("OK.\n")
+    else:
+      print("FAIL:")
+      print(errmsg)
+    outcomes.append((name, errmsg))
+
+print("Summary:")
+number_of_failed_tests = 0
+for testname,errmsg in outcomes:
+  if errmsg==None:
+    print("  "+testname+" : SKIPPED")
+  elif errmsg=="":
+    print("  "+testname+" : PASSED")
+  else:
+    print("* "+testname+" : FAILED")
+    number_of_failed_tests += 1
+print(f"Ran {len(outcomes)} tests, {number_of_failed_tests} failed.")
+
+exit(number_of_failed_tests)
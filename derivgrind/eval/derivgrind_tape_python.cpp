@@ -47,57 +47,152 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/eigen.h>
 #include "dg_bar_tape_eval.hpp"
+#include "dg_bar_tape_compact.hpp"
+#include "dg_bar_tape_elimination.hpp"
+#include "dg_bar_tape_mapping.hpp"
+#include "dg_bar_tape_precision.hpp"
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <stdexcept>
 
 namespace py = pybind11;
 using ull = unsigned long long;
 
-// Chunks with bufsize-many blocks are loaded from the tape file into the heap.
-static constexpr ull bufsize = 100;
+// Chunks with bufsize-many blocks are loaded from the tape file into the heap,
+// unless another chunk size is set with TapeFile.set_chunk_size.
+static constexpr ull bufsize = 4096;
 
 
 struct LoadedFile {
   std::ifstream file;
+  std::unique_ptr<CompactTapeReader> compact; // only for compact tape files
+  std::unique_ptr<MappedTape> mapped; // only for raw tapes
 
   LoadedFile(std::string filename){
     file.open(filename,std::ios::binary);
     if(!file.good()){
       std::cerr << "Cannot open tape file '" << filename << "/dg-tape'." << std::endl;
+    } else if(CompactTapeReader::isCompact(file)){
+      compact.reset(new CompactTapeReader(file));
+    } else {
+      mapped.reset(new MappedTape(filename));
     }
   }
 
-  std::function<void(ull,ull,void*)> make_loadfun(){
-    return [this](ull i, ull count, void* tape_buf) -> void {
+  // tape recorded with --tape-in-ram=yes --tape-fd=fd
+  LoadedFile(int fd){
+    file.open(tapePathFromFd(fd),std::ios::binary);
+    if(!file.good()){
+      std::cerr << "Cannot open tape passed as file descriptor " << fd << "." << std::endl;
+    } else if(CompactTapeReader::isCompact(file)){
+      compact.reset(new CompactTapeReader(file));
+    } else {
+      mapped.reset(new MappedTape(fd));
+    }
+  }
+
+  std::vector<ull> tape_buf; // raw blocks of the chunk that is being loaded
+
+  std::function<void(ull,ull,TapeChunk&)> make_loadfun(){
+    if(compact){
+      return [this](ull i, ull count, TapeChunk& chunk) -> void {
+        compact->load(i,count,chunk);
+      };
+    }
+    if(mapped){
+      return [this](ull i, ull count, TapeChunk& chunk) -> void {
+        mapped->load(i,count,chunk);
+      };
+    }
+    return [this](ull i, ull count, TapeChunk& chunk) -> void {
+      tape_buf.resize(4*count);
       file.seekg(i*4*sizeof(double), std::ios::beg);
-      file.read(reinterpret_cast<char*>(tape_buf), count*4*sizeof(double));
+      file.read(reinterpret_cast<char*>(tape_buf.data()), count*4*sizeof(double));
+      chunk.addBlocks(tape_buf.data(), count);
     };
   }
 
   ull number_of_blocks(){
+    if(compact) return compact->number_of_blocks();
+    if(mapped) return mapped->number_of_blocks();
     file.seekg(0,std::ios::end);
     return file.tellg() / 32;
   }
 
+  // size of the vectors passed to evaluateBackward and evaluateForward
+  ull number_of_indices(){
+    if(compact) return compact->number_of_indices();
+    return number_of_blocks();
+  }
+
+  bool explicit_lhs(){
+    return compact && compact->explicit_lhs();
+  }
+
 };
 
+// Evaluate the tape with a derivative vector of the given precision, see dg_bar_tape_precision.hpp.
+template<bool forward, typename TF>
+void evaluateWithPrecision(TF* tape, Eigen::Ref<Eigen::VectorXd> derivativevec, std::string const& name){
+  DerivativePrecision precision;
+  if(!parsePrecision(name, precision)) throw std::invalid_argument("Unknown precision '"+name+"'.");
+  if(precision==DoublePrecision){
+    if(forward) tape->evaluateForward(derivativevec);
+    else tape->evaluateBackward(derivativevec);
+    return;
+  }
+  dispatchPrecision(precision, [tape,&derivativevec](auto zero){
+    std::vector<decltype(zero)> converted(derivativevec.size(), zero);
+    for(ull i=0; i<converted.size(); i++) converted[i] = derivativevec[i];
+    if(forward) tape->evaluateForward(converted);
+    else tape->evaluateBackward(converted);
+    for(ull i=0; i<converted.size(); i++) derivativevec[i] = converted[i];
+  });
+}
 
 PYBIND11_MODULE(derivgrind_tape, m){
   m.doc() = "Python bindings for the Derivgrind tape evaluator.";
 
   py::class_<LoadedFile>(m, "LoadedFile")
     .def(py::init<std::string>())
-    .def("number_of_blocks", &LoadedFile::number_of_blocks) ;
+    .def(py::init<int>())
+    .def("number_of_blocks", &LoadedFile::number_of_blocks)
+    .def("number_of_indices", &LoadedFile::number_of_indices) ;
 
-  using TF = Tapefile<bufsize,std::function<void(ull,ull,void*)>,nullptr>;
+  using TF = Tapefile<bufsize,std::function<void(ull,ull,TapeChunk&)>,nullptr>;
   py::class_<TF>(m, "TapeFile")
     .def(py::init<>( [](LoadedFile& file){
         auto loadfun = file.make_loadfun();
-        TF* tape = new TF(loadfun,file.number_of_blocks());
+        TF* tape = new TF(loadfun,file.number_of_blocks(),file.explicit_lhs());
         return tape;
       } ) )
-    .def("evaluateBackward", &TF::evaluateBackward<Eigen::Ref<Eigen::VectorXd> >)
-    .def("evaluateForward", &TF::evaluateForward<Eigen::Ref<Eigen::VectorXd> >)
+    .def("evaluateBackward", &evaluateWithPrecision<false,TF>, py::arg("derivativevec"), py::arg("precision")="double")
+    .def("evaluateForward", &evaluateWithPrecision<true,TF>, py::arg("derivativevec"), py::arg("precision")="double")
+    // rows of the matrix are the bar or dot values of the indices, for several seeds
+    .def("evaluateBackwardVector", [](TF* tape, Eigen::Ref<Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor>> derivativemat){
+        tape->evaluateBackwardVector(derivativemat.data(), derivativemat.cols());
+      })
+    .def("evaluateForwardVector", [](TF* tape, Eigen::Ref<Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor>> derivativemat){
+        tape->evaluateForwardVector(derivativemat.data(), derivativemat.cols());
+      })
+    // dense Jacobian by vertex elimination, with a row per output and a column per input;
+    // not for tapes recorded with --index-reuse=yes or renumbered tapes
+    .def("jacobian", [](TF* tape, Eigen::Ref<Eigen::Matrix<ull,Eigen::Dynamic,1>> inputindices, Eigen::Ref<Eigen::Matrix<ull,Eigen::Dynamic,1>> outputindices, std::string order){
+        if(order!="default" && order!="markowitz" && order!="forward" && order!="reverse") throw std::invalid_argument("Unknown elimination order '"+order+"'.");
+        if(tape->get_explicit_lhs()) throw std::invalid_argument("Vertex elimination on tapes recorded with --index-reuse=yes is not supported.");
+        std::vector<ull> in(inputindices.data(), inputindices.data()+inputindices.size());
+        std::vector<ull> out(outputindices.data(), outputindices.data()+outputindices.size());
+        EliminationOrder eliminationorder = order=="markowitz" ? MarkowitzOrder : order=="forward" ? ForwardOrder : order=="reverse" ? ReverseOrder : DefaultOrder;
+        EliminatedJacobian jacobian(*tape, tape->get_number_of_blocks(), in, out, eliminationorder);
+        Eigen::MatrixXd result = Eigen::MatrixXd::Zero(out.size(), in.size());
+        for(ull k=0; k<jacobian.values.size(); k++){
+          result(jacobian.rows[k], jacobian.cols[k]) = jacobian.values[k];
+        }
+        return result;
+      }, py::arg("inputindices"), py::arg("outputindices"), py::arg("order")="default")
+    .def("set_chunk_size", &TF::set_chunk_size)
+    .def("set_read_ahead", &TF::set_read_ahead)
     .def("stats", [](TF* tape){
         unsigned long long nZero, nOne, nTwo; 
         tape->stats(nZero,nOne,nTwo);
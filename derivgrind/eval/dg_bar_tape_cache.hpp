@@ -0,0 +1,111 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_cache.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_cache.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_CACHE_HPP
+#define DG_BAR_TAPE_CACHE_HPP
+
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+/*! \file dg_bar_tape_cache.hpp
+ * Cache files for analyses of a tape.
+ *
+ * Analyses that are done once per tape, like the level schedule for
+ * multi-threaded evaluation, are stored beside the tape and reused as long
+ * as the tape does not change. A cache file starts with a header of 8-byte
+ * words, consisting of a magic number identifying the analysis, its
+ * parameters, and the size, inode and modification time in nanoseconds of
+ * the tape file, followed by the results of the analysis. The cache is
+ * only used if the header matches exactly, so a tape that is recorded
+ * again in the same second is not mistaken for the old one.
+ */
+
+/*! Append the size, inode and modification time of the tape file to a header.
+ *
+ * \returns False if the tape file cannot be accessed.
+ */
+inline bool addTapeFingerprint(std::vector<unsigned long long>& header, std::string const& tapepath){
+  struct stat tapestat;
+  if(stat(tapepath.c_str(), &tapestat)!=0) return false;
+  header.push_back(tapestat.st_size);
+  header.push_back(tapestat.st_ino);
+  header.push_back(tapestat.st_mtim.tv_sec);
+  header.push_back(tapestat.st_mtim.tv_nsec);
+  return true;
+}
+
+/*! Open a cache file for reading.
+ *
+ * \param cachefile Stream, positioned after the header if the cache can be used.
+ * \param cachepath Path of the cache file.
+ * \param tapepath Tape file.
+ * \param header Magic number and parameters of the analysis.
+ * \returns Whether the cache file belongs to the current tape file and has the expected header.
+ */
+inline bool openTapeCache(std::ifstream& cachefile, std::string const& cachepath, std::string const& tapepath, std::vector<unsigned long long> header){
+  if(!addTapeFingerprint(header, tapepath)) return false;
+  cachefile.open(cachepath, std::ios::binary);
+  std::vector<unsigned long long> stored(header.size());
+  if(!cachefile.read(reinterpret_cast<char*>(stored.data()), stored.size()*sizeof(unsigned long long))) return false;
+  return stored==header;
+}
+
+/*! Create a cache file and write its header.
+ *
+ * \param cachefile Stream, positioned after the header.
+ * \param cachepath Path of the cache file.
+ * \param tapepath Tape file.
+ * \param header Magic number and parameters of the analysis.
+ */
+inline void createTapeCache(std::ofstream& cachefile, std::string const& cachepath, std::string const& tapepath, std::vector<unsigned long long> header){
+  if(!addTapeFingerprint(header, tapepath)) return;
+  cachefile.open(cachepath, std::ios::binary);
+  cachefile.write(reinterpret_cast<char const*>(header.data()), header.size()*sizeof(unsigned long long));
+}
+
+#endif
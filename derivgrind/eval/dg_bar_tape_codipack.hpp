@@ -0,0 +1,179 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_codipack.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_codipack.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_CODIPACK_HPP
+#define DG_BAR_TAPE_CODIPACK_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include "dg_bar_tape_eval.hpp"
+
+/*! \file dg_bar_tape_codipack.hpp
+ * Conversion of tapes into CoDiPack Jacobian tapes.
+ *
+ * Every statement of the Derivgrind tape is pushed onto the tape of a
+ * CoDiPack active type by the manual statement push interface, with the
+ * partial derivatives as Jacobians. Statements producing an input index
+ * register the corresponding CoDiPack variable as an input instead. The
+ * CoDiPack tape can then be evaluated by CoDiPack's forward and reverse
+ * evaluators, including the vector modes, e.g.
+ *
+ *     codi::RealReverse::Tape& codiTape = codi::RealReverse::getTape();
+ *     codiTape.setActive();
+ *     CoDiPackTape<codi::RealReverse> converted(tape, number_of_blocks, number_of_indices, inputindices);
+ *     codiTape.setPassive();
+ *     for(ull i=0; i<outputindices.size(); i++) converted[outputindices[i]] = outputbars[i];
+ *     codiTape.evaluate();
+ *     for(ull j=0; j<inputindices.size(); j++) inputbars[j] = converted[inputindices[j]];
+ *
+ * This header does not include CoDiPack itself. Only Jacobian tapes are
+ * supported, as the primal values are not recorded by Derivgrind.
+ *
+ * CoDiPack stores the number of arguments of a statement in 8 bits, while
+ * Derivgrind statements can have up to DG_TAPE_MAX_OPERANDS operands.
+ * Statements with more than CoDiPackTape::max_arguments operands are
+ * therefore pushed as a chain of statements, each of which passes the
+ * previous one on with partial derivative 1 and adds further operands.
+ */
+
+/*! Derivgrind tape converted into the tape of a CoDiPack active type.
+ *
+ * For every Derivgrind index, a variable of the active type holds the
+ * CoDiPack identifier that has been assigned to the index last. The
+ * variables are kept alive as long as this object exists, so the
+ * conversion works with CoDiPack's index reuse as well. For tapes
+ * recorded with --index-reuse=yes, indices assigned multiple times are
+ * assigned multiple times on the CoDiPack tape as well.
+ *
+ * \tparam Type CoDiPack active type with a Jacobian tape, e.g. codi::RealReverse.
+ */
+template<typename Type>
+class CoDiPackTape {
+  using ull = unsigned long long;
+  using Tape = typename Type::Tape;
+  using Real = typename Type::Real;
+  using Gradient = typename Type::Gradient;
+  using Identifier = typename Type::Identifier;
+
+  //! CoDiPack variable of every Derivgrind index. Copying it would push statements.
+  std::vector<Type> variables;
+
+public:
+  //! Maximal number of arguments of a CoDiPack statement, well below the 8-bit limit.
+  static constexpr ull max_arguments = 128;
+
+  /*! Push the statements of a Derivgrind tape onto the tape of the active type.
+   *
+   * The CoDiPack tape must be active.
+   * \param tape Derivgrind tape.
+   * \param number_of_blocks Number of statements on the tape.
+   * \param number_of_indices Size of the derivative vector of the tape.
+   * \param inputindices Indices of the inputs.
+   */
+  template<typename tape_t>
+  CoDiPackTape(tape_t& tape, ull number_of_blocks, ull number_of_indices, std::vector<ull> const& inputindices)
+    : variables(number_of_indices) {
+    std::vector<char> is_input(number_of_indices, 0);
+    for(ull index : inputindices){
+      if(validIndex(index)) is_input[index] = 1;
+    }
+    Tape& codiTape = Type::getTape();
+    std::vector<Identifier> operands; // identifiers of the operands of the current statement
+    std::vector<double> jacobians; // partial derivatives w.r.t. these operands
+    tape.iterate(0, number_of_blocks-1, [this,&is_input,&codiTape,&operands,&jacobians](ull index, ull n, ull const* indices, double const* diffs){
+      if(index==0) return; // dummy block
+      if(is_input[index]){
+        codiTape.registerInput(variables[index]);
+        return;
+      }
+      // The result index may be among the operands, e.g. on renumbered tapes or tapes
+      // recorded with --index-reuse=yes, so the operand identifiers must be read before
+      // storeManual assigns a new identifier to the result.
+      operands.clear();
+      jacobians.clear();
+      for(ull j=0; j<n; j++){
+        if(validIndex(indices[j])){
+          operands.push_back(variables[indices[j]].getIdentifier());
+          jacobians.push_back(diffs[j]);
+        }
+      }
+      // links of the chain for statements with more than max_arguments operands
+      ull m = operands.size();
+      std::vector<Type> links(m>max_arguments ? (m-2)/(max_arguments-1) : 0);
+      ull pos = 0;
+      for(ull l=0; l<=links.size(); l++){
+        Type& result = l<links.size() ? links[l] : variables[index];
+        ull count = std::min(m-pos, l>0 ? max_arguments-1 : max_arguments);
+        codiTape.storeManual(Real(), result.getIdentifier(), l>0 ? count+1 : count);
+        if(l>0) codiTape.pushJacobianManual(1.0, Real(), links[l-1].getIdentifier());
+        for(ull j=pos; j<pos+count; j++){
+          codiTape.pushJacobianManual(jacobians[j], Real(), operands[j]);
+        }
+        pos += count;
+      }
+    });
+  }
+
+  CoDiPackTape(CoDiPackTape const&) = delete;
+  CoDiPackTape& operator=(CoDiPackTape const&) = delete;
+
+  //! CoDiPack variable assigned to a Derivgrind index last.
+  Type const& variable(ull index) const { return variables[index]; }
+
+  //! CoDiPack identifier assigned to a Derivgrind index last.
+  Identifier identifier(ull index) const { return variables[index].getIdentifier(); }
+
+  /*! Dot or bar value of a Derivgrind index on the CoDiPack tape.
+   *
+   * With these operators, the object can be passed to seedGradientVectorFromTextFile
+   * and readGradientVectorToTextFile like a derivative vector.
+   */
+  Gradient& operator[](ull index){ return Type::getTape().gradient(variables[index].getIdentifier()); }
+  Gradient const& operator[](ull index) const { return Type::getTape().getGradient(variables[index].getIdentifier()); }
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_collapse.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_collapse.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_COLLAPSE_HPP
+#define DG_BAR_TAPE_COLLAPSE_HPP
+
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+#include "dg_bar_tape_eval.hpp"
+#include "dg_bar_tape_prune.hpp"
+
+/*! \file dg_bar_tape_collapse.hpp
+ * Statement-level preaccumulation of a tape.
+ *
+ * In forward order, an operand j of a statement is replaced by the
+ * operands of j, with the partial derivatives multiplied, if
+ * - j has at most one operand, like a conversion, negation or scaling, or
+ * - j is used only once and the statement keeps at most two operands,
+ * unless j is an input or an output. Operands appearing several times are
+ * merged. As the operands of j have been replaced in the same way before,
+ * chains of such statements collapse into a single statement.
+ * Afterwards, statements that are no longer used, and are neither inputs
+ * nor outputs, are removed, and the remaining statements are written
+ * to a raw tape with consecutive indices.
+ */
+
+/*! Write a collapsed copy of a tape.
+ *
+ * \param tape Tape whose statements produce the index of their position,
+ *   i.e. not recorded with --index-reuse=yes or --per-thread-tapes=yes.
+ * \param number_of_blocks Number of statements on the tape.
+ * \param inputindices Indices of the inputs, replaced by their indices on the collapsed tape.
+ * \param outputindices Indices of the outputs, replaced by their indices on the collapsed tape.
+ * \param tapefile Stream to which the collapsed raw tape is written.
+ * \returns Number of blocks of the collapsed tape, including the dummy block.
+ */
+template<typename tape_t>
+unsigned long long collapseTape(tape_t& tape, unsigned long long number_of_blocks, std::vector<unsigned long long>& inputindices, std::vector<unsigned long long>& outputindices, std::ostream& tapefile){
+  using ull = unsigned long long;
+  std::vector<char> keep(number_of_blocks, 0); // inputs and outputs, later all statements that are used
+  for(ull index : inputindices){
+    if(validIndex(index)) keep[index] = 1;
+  }
+  for(ull index : outputindices){
+    if(validIndex(index)) keep[index] = 1;
+  }
+  std::vector<ull> uses(number_of_blocks, 0);
+  tape.iterate(0, number_of_blocks-1, [&uses](ull index, ull n, ull const* indices, double const* diffs){
+    for(ull j=0; j<n; j++){
+      if(validIndex(indices[j])) uses[indices[j]]++;
+    }
+  });
+
+  // collapsed statements
+  std::vector<ull> begin(1, 0), operands;
+  std::vector<double> partials;
+  begin.reserve(number_of_blocks+1);
+  std::vector<ull> newoperands; // collapsed operands of the current statement
+  std::vector<double> newpartials;
+  // uses counts the occurrences in collapsed statements, and in original statements not collapsed yet
+  auto add = [&newoperands,&newpartials,&uses](ull index, double diff){
+    auto it = std::find(newoperands.begin(), newoperands.end(), index);
+    if(it==newoperands.end()){
+      newoperands.push_back(index);
+      newpartials.push_back(diff);
+    } else {
+      newpartials[it-newoperands.begin()] += diff;
+      uses[index]--;
+    }
+  };
+  tape.iterate(0, number_of_blocks-1, [&](ull index, ull n, ull const* indices, double const* diffs){
+    newoperands.clear();
+    newpartials.clear();
+    for(ull j=0; j<n; j++){
+      if(validIndex(indices[j])) add(indices[j], diffs[j]);
+    }
+    for(ull k=0; k<newoperands.size(); ){
+      ull op = newoperands[k];
+      ull op_n = begin[op+1]-begin[op];
+      if(!keep[op] && (op_n<=1 || (uses[op]==1 && newoperands.size()-1+op_n<=2))){
+        double diff = newpartials[k];
+        newoperands.erase(newoperands.begin()+k);
+        newpartials.erase(newpartials.begin()+k);
+        uses[op]--;
+        for(ull j=begin[op]; j<begin[op+1]; j++){
+          uses[operands[j]]++;
+          add(operands[j], diff*partials[j]);
+        }
+      } else {
+        k++;
+      }
+    }
+    operands.insert(operands.end(), newoperands.begin(), newoperands.end());
+    partials.insert(partials.end(), newpartials.begin(), newpartials.end());
+    begin.push_back(operands.size());
+  });
+
+  // keep the statements used by inputs, outputs and other kept statements
+  for(ull index=number_of_blocks-1; index>0; index--){
+    if(!keep[index]) continue;
+    for(ull j=begin[index]; j<begin[index+1]; j++) keep[operands[j]] = 1;
+  }
+
+  std::vector<ull> newindex(number_of_blocks, 0);
+  RawTapeWriter writer(tapefile);
+  for(ull index=1; index<number_of_blocks; index++){
+    if(!keep[index]) continue;
+    newoperands.clear();
+    for(ull j=begin[index]; j<begin[index+1]; j++) newoperands.push_back(newindex[operands[j]]);
+    newindex[index] = writer.addStatement(newoperands.size(), newoperands.data(), partials.data()+begin[index]);
+  }
+  writer.flush();
+
+  for(ull& index : inputindices) index = validIndex(index) ? newindex[index] : 0;
+  for(ull& index : outputindices) index = validIndex(index) ? newindex[index] : 0;
+  return writer.number_of_blocks();
+}
+
+#endif
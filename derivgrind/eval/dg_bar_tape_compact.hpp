@@ -0,0 +1,359 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_compact.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_compact.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_COMPACT_HPP
+#define DG_BAR_TAPE_COMPACT_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <ostream>
+#include <vector>
+
+#include "../bar/dg_bar_tape_format.h"
+#include "dg_bar_tape_eval.hpp"
+
+/*! \file dg_bar_tape_compact.hpp
+ * Decoder and encoder for tape files written with --tape-format=compact.
+ *
+ * The decoder appends the statements to a TapeChunk, so it can be
+ * used as the loadfun of a Tapefile. The encoder is used to write
+ * transformed tapes.
+ */
+
+/*! Reads blocks from a compact tape file.
+ *
+ * Blocks are decoded chunk-wise, and the most recently decoded chunk
+ * is cached, so both forward and reverse sweeps decode every chunk once.
+ */
+class CompactTapeReader {
+  using ull = unsigned long long;
+  std::ifstream& file;
+  ull nblocks; //!< Number of blocks including the dummy block 0.
+  ull tableoffset; //!< File offset of the offset table.
+  ull flags; //!< Flags from the header.
+  ull nindices; //!< Number of indices, i.e. size of the adjoint vector.
+  std::vector<ull> chunkoffsets; //!< File offsets of all chunks.
+  std::vector<unsigned char> encoded; //!< Encoded bytes of the cached chunk.
+  TapeChunk decoded; //!< Cached chunk.
+  ull cachedchunk; //!< Index of the cached chunk, or -1.
+
+  static ull readvarint(unsigned char const*& p){
+    ull value = 0;
+    unsigned shift = 0;
+    while(*p & 0x80){
+      value |= ull(*p++ & 0x7f) << shift;
+      shift += 7;
+    }
+    value |= ull(*p++) << shift;
+    return value;
+  }
+
+  static ull diffbits(unsigned diffclass, unsigned char const*& p){
+    ull bits = 0;
+    switch(diffclass){
+      case DG_TAPE_TAG_PLUSONE: bits = DG_TAPE_PLUSONE_BITS; break;
+      case DG_TAPE_TAG_MINUSONE: bits = DG_TAPE_MINUSONE_BITS; break;
+      case DG_TAPE_TAG_RAW: std::memcpy(&bits, p, sizeof(ull)); p += sizeof(ull); break;
+    }
+    return bits;
+  }
+
+  static double asdouble(ull bits){
+    double value;
+    std::memcpy(&value, &bits, sizeof(double));
+    return value;
+  }
+
+  void decodeChunk(ull chunk){
+    ull begin = chunkoffsets[chunk];
+    ull end = (chunk+1<chunkoffsets.size()) ? chunkoffsets[chunk+1] : tableoffset;
+    encoded.resize(end-begin);
+    file.clear();
+    file.seekg(begin, std::ios::beg);
+    file.read(reinterpret_cast<char*>(encoded.data()), end-begin);
+    unsigned char const* p = encoded.data();
+    ull first = chunk*DG_TAPE_COMPACT_CHUNKSIZE;
+    ull last = std::min(first+DG_TAPE_COMPACT_CHUNKSIZE, nblocks);
+    decoded.clear();
+    for(ull block=first; block<last; block++){
+      ull index = block;
+      if(flags & DG_TAPE_FLAG_EXPLICIT_LHS){
+        index = readvarint(p);
+        decoded.setLhs(index);
+      }
+      unsigned tag = *p++;
+      if(tag==DG_TAPE_TAG_NARY){
+        ull n = readvarint(p);
+        for(ull j=0; j<n; j++){
+          unsigned operandtag = *p++;
+          ull v = readvarint(p);
+          ull bits = diffbits(DG_TAPE_TAG_DIFF1(operandtag), p);
+          decoded.addOperand((operandtag&DG_TAPE_TAG_INDEX1_ABS) ? v : index-v, asdouble(bits));
+        }
+        decoded.endStatement();
+        continue;
+      }
+      unsigned class1 = DG_TAPE_TAG_DIFF1(tag), class2 = DG_TAPE_TAG_DIFF2(tag);
+      ull index1 = 0, index2 = 0;
+      if(class1!=DG_TAPE_TAG_ABSENT){
+        ull v = readvarint(p);
+        index1 = (tag&DG_TAPE_TAG_INDEX1_ABS) ? v : index-v;
+      }
+      if(class2!=DG_TAPE_TAG_ABSENT){
+        ull v = readvarint(p);
+        index2 = (tag&DG_TAPE_TAG_INDEX2_ABS) ? v : index-v;
+      }
+      ull bits1 = diffbits(class1, p);
+      ull bits2 = diffbits(class2, p);
+      decoded.addOperand(index1, asdouble(bits1));
+      decoded.addOperand(index2, asdouble(bits2));
+      decoded.endStatement();
+    }
+    cachedchunk = chunk;
+  }
+
+public:
+  /*! Check whether a tape file has been written in the compact format.
+   *
+   * A raw tape starts with the dummy block 0, whose first index is zero,
+   * so it cannot be mistaken for the magic number.
+   */
+  static bool isCompact(std::ifstream& file){
+    ull magic = 0;
+    file.clear();
+    file.seekg(0, std::ios::beg);
+    file.read(reinterpret_cast<char*>(&magic), sizeof(ull));
+    bool ret = file.good() && magic==DG_TAPE_COMPACT_MAGIC;
+    file.clear();
+    file.seekg(0, std::ios::beg);
+    return ret;
+  }
+
+  CompactTapeReader(std::ifstream& file) : file(file), cachedchunk(-1) {
+    ull footer[4];
+    file.clear();
+    file.seekg(-(long long)DG_TAPE_COMPACT_FOOTERSIZE, std::ios::end);
+    file.read(reinterpret_cast<char*>(footer), sizeof(footer));
+    if(!file.good() || footer[3]!=DG_TAPE_COMPACT_MAGIC){
+      std::cerr << "Compact tape file has no valid footer, it might be truncated." << std::endl;
+      exit(1);
+    }
+    nblocks = footer[0];
+    tableoffset = footer[2];
+    chunkoffsets.resize(footer[1]);
+    file.seekg(tableoffset, std::ios::beg);
+    file.read(reinterpret_cast<char*>(chunkoffsets.data()), footer[1]*sizeof(ull));
+    nindices = nblocks;
+    ull header[4];
+    file.seekg(0, std::ios::beg);
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    flags = header[2];
+    if(flags & DG_TAPE_FLAG_EXPLICIT_LHS){
+      file.seekg(tableoffset+footer[1]*sizeof(ull), std::ios::beg);
+      file.read(reinterpret_cast<char*>(&nindices), sizeof(ull));
+    }
+  }
+
+  ull number_of_blocks() const { return nblocks; }
+  //! Size of the adjoint vector needed to evaluate the tape.
+  ull number_of_indices() const { return nindices; }
+  //! Whether the tape stores result indices explicitly, see DG_TAPE_FLAG_EXPLICIT_LHS.
+  bool explicit_lhs() const { return flags & DG_TAPE_FLAG_EXPLICIT_LHS; }
+
+  /*! Decode count-many statements starting at index i and append them to a chunk.
+   */
+  void load(ull i, ull count, TapeChunk& out){
+    while(count>0){
+      ull chunk = i/DG_TAPE_COMPACT_CHUNKSIZE;
+      if(chunk!=cachedchunk) decodeChunk(chunk);
+      ull offset = i - chunk*DG_TAPE_COMPACT_CHUNKSIZE;
+      ull n = std::min(count, DG_TAPE_COMPACT_CHUNKSIZE-offset);
+      ull operand_begin = decoded.begin[offset], operand_end = decoded.begin[offset+n];
+      ull shift = out.indices.size() - operand_begin;
+      out.indices.insert(out.indices.end(), decoded.indices.begin()+operand_begin, decoded.indices.begin()+operand_end);
+      out.diffs.insert(out.diffs.end(), decoded.diffs.begin()+operand_begin, decoded.diffs.begin()+operand_end);
+      for(ull k=offset+1; k<=offset+n; k++){
+        out.begin.push_back(decoded.begin[k]+shift);
+      }
+      if(!decoded.lhs.empty()){
+        out.lhs.insert(out.lhs.end(), decoded.lhs.begin()+offset, decoded.lhs.begin()+offset+n);
+      }
+      i += n; count -= n;
+    }
+  }
+};
+
+/*! Writes statements to a compact tape file.
+ *
+ * Like the recording tool, statements with up to two operands are encoded
+ * as a single block and others with DG_TAPE_TAG_NARY.
+ */
+class CompactTapeWriter {
+  using ull = unsigned long long;
+  std::ostream& tapefile;
+  bool explicit_lhs;
+  std::vector<unsigned char> buffer; //!< Encoded blocks that have not been written yet.
+  ull fileoffset = 0; //!< Number of bytes written to the tape file.
+  ull nblocks = 0;
+  std::vector<ull> chunkoffsets; //!< File offsets of the chunks encoded so far.
+  ull maxindex = 0; //!< Largest result index encoded so far.
+
+  void putvarint(ull value){
+    while(value>=0x80){
+      buffer.push_back((unsigned char)(value|0x80));
+      value >>= 7;
+    }
+    buffer.push_back((unsigned char)value);
+  }
+
+  void putraw(ull bits){
+    unsigned char const* p = reinterpret_cast<unsigned char const*>(&bits);
+    buffer.insert(buffer.end(), p, p+sizeof(ull));
+  }
+
+  static ull asbits(double value){
+    ull bits;
+    std::memcpy(&bits, &value, sizeof(ull));
+    return bits;
+  }
+
+  static unsigned diffclass(ull index, ull bits){
+    if(index==0) return DG_TAPE_TAG_ABSENT;
+    else if(bits==DG_TAPE_PLUSONE_BITS) return DG_TAPE_TAG_PLUSONE;
+    else if(bits==DG_TAPE_MINUSONE_BITS) return DG_TAPE_TAG_MINUSONE;
+    else return DG_TAPE_TAG_RAW;
+  }
+
+  void flush(){
+    tapefile.write(reinterpret_cast<char const*>(buffer.data()), buffer.size());
+    fileoffset += buffer.size();
+    buffer.clear();
+  }
+
+public:
+  /*! Write the header.
+   *
+   * \param tapefile Stream to which the compact tape is written.
+   * \param explicit_lhs Whether every block stores the index of its result, see DG_TAPE_FLAG_EXPLICIT_LHS.
+   */
+  CompactTapeWriter(std::ostream& tapefile, bool explicit_lhs) : tapefile(tapefile), explicit_lhs(explicit_lhs) {
+    ull header[4] = {DG_TAPE_COMPACT_MAGIC, DG_TAPE_COMPACT_CHUNKSIZE, explicit_lhs ? DG_TAPE_FLAG_EXPLICIT_LHS : 0, 0};
+    tapefile.write(reinterpret_cast<char const*>(header), sizeof(header));
+    fileoffset = sizeof(header);
+  }
+
+  /*! Append a statement.
+   *
+   * \param lhs Index of the result, ignored unless explicit_lhs is set.
+   * \param n Number of operands.
+   * \param indices Operand indices; zero for inactive operands.
+   * \param diffs Partial derivatives.
+   */
+  void addStatement(ull lhs, ull n, ull const* indices, double const* diffs){
+    if(nblocks%DG_TAPE_COMPACT_CHUNKSIZE==0) chunkoffsets.push_back(fileoffset+buffer.size());
+    if(explicit_lhs){
+      putvarint(lhs);
+      maxindex = std::max(maxindex, lhs);
+    } else {
+      lhs = nblocks;
+    }
+    nblocks++;
+    ull active = 0;
+    for(ull j=0; j<n; j++){
+      if(indices[j]!=0) active++;
+    }
+    if(active<=2 && n<=2){
+      ull index1 = n>0 ? indices[0] : 0, index2 = n>1 ? indices[1] : 0;
+      ull diff1 = n>0 ? asbits(diffs[0]) : 0, diff2 = n>1 ? asbits(diffs[1]) : 0;
+      unsigned class1 = diffclass(index1, diff1), class2 = diffclass(index2, diff2);
+      unsigned tag = class1 | (class2<<2);
+      if(index1>=lhs) tag |= DG_TAPE_TAG_INDEX1_ABS;
+      if(index2>=lhs) tag |= DG_TAPE_TAG_INDEX2_ABS;
+      buffer.push_back((unsigned char)tag);
+      if(class1!=DG_TAPE_TAG_ABSENT) putvarint( (tag&DG_TAPE_TAG_INDEX1_ABS) ? index1 : lhs-index1 );
+      if(class2!=DG_TAPE_TAG_ABSENT) putvarint( (tag&DG_TAPE_TAG_INDEX2_ABS) ? index2 : lhs-index2 );
+      if(class1==DG_TAPE_TAG_RAW) putraw(diff1);
+      if(class2==DG_TAPE_TAG_RAW) putraw(diff2);
+    } else {
+      buffer.push_back((unsigned char)DG_TAPE_TAG_NARY);
+      putvarint(active);
+      for(ull j=0; j<n; j++){
+        ull index = indices[j];
+        if(index==0) continue;
+        ull bits = asbits(diffs[j]);
+        unsigned cls = diffclass(index, bits);
+        unsigned abs = (index>=lhs) ? DG_TAPE_TAG_INDEX1_ABS : 0;
+        buffer.push_back((unsigned char)(cls|abs));
+        putvarint( abs ? index : lhs-index );
+        if(cls==DG_TAPE_TAG_RAW) putraw(bits);
+      }
+    }
+    if(buffer.size() >= (1ull<<20)) flush();
+  }
+
+  /*! Write the offset table and the footer.
+   *
+   * \param min_indices Lower bound for the number of indices, e.g. if some inputs are not on the tape.
+   * \returns Number of indices, i.e. size of the adjoint vector needed to evaluate the tape.
+   */
+  ull finish(ull min_indices=0){
+    flush();
+    ull number_of_chunks = chunkoffsets.size();
+    ull footer[4] = {nblocks, number_of_chunks, fileoffset, DG_TAPE_COMPACT_MAGIC};
+    tapefile.write(reinterpret_cast<char const*>(chunkoffsets.data()), number_of_chunks*sizeof(ull));
+    ull number_of_indices = std::max(explicit_lhs ? maxindex+1 : nblocks, min_indices);
+    if(explicit_lhs) tapefile.write(reinterpret_cast<char const*>(&number_of_indices), sizeof(ull));
+    tapefile.write(reinterpret_cast<char const*>(footer), sizeof(footer));
+    tapefile.flush();
+    return number_of_indices;
+  }
+
+  ull number_of_blocks() const { return nblocks; }
+};
+
+#endif
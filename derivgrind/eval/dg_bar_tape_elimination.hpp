@@ -0,0 +1,262 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_elimination.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_elimination.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_ELIMINATION_HPP
+#define DG_BAR_TAPE_ELIMINATION_HPP
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dg_bar_tape_eval.hpp"
+#include "dg_bar_tape_jacobian.hpp"
+
+/*! \file dg_bar_tape_elimination.hpp
+ * Jacobian accumulation by vertex elimination.
+ *
+ * The statements of the tape that depend on an input and influence an
+ * output are loaded as a computational graph, with an edge from every
+ * operand to the result, labelled with the partial derivative. An
+ * intermediate vertex v is eliminated by adding an edge u->w with label
+ * c_wv*c_vu for every pair of edges u->v and v->w, or adding c_wv*c_vu to
+ * the label of an existing edge u->w, and removing v. Afterwards, only
+ * inputs and outputs remain, and the Jacobian is read off the edges.
+ *
+ * By default, vertices are eliminated in tape order if there are at most
+ * as many inputs as outputs, and in reverse tape order otherwise. The
+ * Markowitz order, i.e. the vertex with the fewest products
+ * |predecessors|*|successors| first, needs fewer multiplications on some
+ * graphs, but maintaining the priorities and the fill-in usually make it
+ * slower on long tapes.
+ */
+
+/*! \enum EliminationOrder
+ * Order in which intermediate vertices are eliminated. Eliminating in
+ * forward (reverse) order needs as many multiplications as a forward
+ * (reverse) evaluation with a seed for every input (output).
+ */
+enum EliminationOrder {
+  DefaultOrder, //!< ForwardOrder if there are at most as many inputs as outputs, ReverseOrder otherwise.
+  MarkowitzOrder,
+  ForwardOrder,
+  ReverseOrder
+};
+
+/*! Jacobian accumulated by vertex elimination.
+ */
+class EliminatedJacobian : public JacobianEntries {
+  //! Incoming edges of a vertex, mapping the operand to the partial derivative.
+  std::vector<std::unordered_map<ull,double>> preds;
+  //! Outgoing edges of a vertex, possibly to vertices that have been eliminated in the meantime.
+  std::vector<std::vector<ull>> succs;
+  //! Number of outgoing edges of a vertex.
+  std::vector<ull> nsuccs;
+  //! 0: eliminated or irrelevant, 1: intermediate, 2: input or output.
+  std::vector<char> kind;
+  EliminationOrder order;
+
+  static double* find(std::vector<std::pair<ull,double>>& entries, ull u){
+    for(auto& entry : entries){
+      if(entry.first==u) return &entry.second;
+    }
+    return nullptr;
+  }
+
+  void eliminate(ull v){
+    for(auto const& pred : preds[v]){
+      nsuccs[pred.first]--;
+    }
+    for(ull w : succs[v]){
+      if(kind[w]==0) continue;
+      std::unordered_map<ull,double>& edges = preds[w];
+      auto vw = edges.find(v);
+      double c_wv = vw->second;
+      edges.erase(vw);
+      for(auto const& pred : preds[v]){
+        auto uw = edges.find(pred.first);
+        if(uw!=edges.end()){
+          uw->second += c_wv * pred.second;
+        } else {
+          edges.emplace(pred.first, c_wv * pred.second);
+          succs[pred.first].push_back(w);
+          nsuccs[pred.first]++;
+        }
+      }
+    }
+    kind[v] = 0;
+    std::unordered_map<ull,double>().swap(preds[v]);
+    std::vector<ull>().swap(succs[v]);
+  }
+
+  //! Vertices with lower cost are eliminated first.
+  ull cost(ull v) const {
+    switch(order){
+      case ForwardOrder: return v;
+      case ReverseOrder: return ~v;
+      default: return preds[v].size() * nsuccs[v];
+    }
+  }
+
+public:
+  ull number_of_vertices; //!< Number of vertices of the graph before the elimination.
+  ull number_of_eliminations; //!< Number of eliminated intermediate vertices.
+
+  /*! Compute the Jacobian.
+   *
+   * \param tape Tape whose statements produce the index of their position,
+   *   i.e. not recorded with --index-reuse=yes or --per-thread-tapes=yes.
+   * \param number_of_blocks Number of statements on the tape.
+   * \param inputindices Indices of the inputs.
+   * \param outputindices Indices of the outputs.
+   * \param order Elimination order.
+   */
+  template<typename tape_t>
+  EliminatedJacobian(tape_t& tape, ull number_of_blocks, std::vector<ull> const& inputindices, std::vector<ull> const& outputindices, EliminationOrder order=DefaultOrder)
+    : JacobianEntries(outputindices.size(), inputindices.size()), preds(number_of_blocks), succs(number_of_blocks), nsuccs(number_of_blocks, 0), kind(number_of_blocks, 0),
+      order(order!=DefaultOrder ? order : inputindices.size()<=outputindices.size() ? ForwardOrder : ReverseOrder) {
+    std::vector<char> active(number_of_blocks, 0);
+    for(ull index : inputindices){
+      if(validIndex(index)) active[index] = 1;
+    }
+    tape.iterate(0, number_of_blocks-1, [this,&active](ull index, ull n, ull const* indices, double const* diffs){
+      if(active[index]) return; // inputs do not depend on their operands
+      for(ull j=0; j<n; j++){
+        if(validIndex(indices[j]) && active[indices[j]]){
+          active[index] = 1;
+          preds[index][indices[j]] += diffs[j];
+        }
+      }
+    });
+    for(ull index : outputindices){
+      if(validIndex(index) && active[index]) kind[index] = 2;
+    }
+    for(ull index=number_of_blocks-1; index>0; index--){
+      if(kind[index]==0) continue;
+      for(auto const& pred : preds[index]){
+        if(kind[pred.first]==0) kind[pred.first] = 1;
+      }
+    }
+    for(ull index : inputindices){
+      if(validIndex(index)) kind[index] = 2;
+    }
+    number_of_vertices = 0;
+    for(ull index=1; index<number_of_blocks; index++){
+      if(kind[index]==0){
+        std::unordered_map<ull,double>().swap(preds[index]);
+        continue;
+      }
+      number_of_vertices++;
+      for(auto const& pred : preds[index]){
+        succs[pred.first].push_back(index);
+        nsuccs[pred.first]++;
+      }
+    }
+
+    // eliminate intermediate vertices, with lazily updated costs
+    using entry = std::pair<ull,ull>; // cost, vertex
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> queue;
+    for(ull index=1; index<number_of_blocks; index++){
+      if(kind[index]==1) queue.push({cost(index), index});
+    }
+    number_of_eliminations = 0;
+    std::vector<ull> neighbours;
+    while(!queue.empty()){
+      entry e = queue.top();
+      queue.pop();
+      ull v = e.second;
+      if(kind[v]!=1) continue;
+      if(e.first!=cost(v)){
+        queue.push({cost(v), v});
+        continue;
+      }
+      neighbours.clear();
+      if(order==MarkowitzOrder){
+        for(auto const& pred : preds[v]) neighbours.push_back(pred.first);
+        neighbours.insert(neighbours.end(), succs[v].begin(), succs[v].end());
+      }
+      eliminate(v);
+      number_of_eliminations++;
+      for(ull u : neighbours){
+        if(kind[u]==1) queue.push({cost(u), u});
+      }
+    }
+
+    // Outputs might still depend on other outputs. Accumulate the rows of
+    // all remaining vertices in increasing index order.
+    std::vector<std::vector<std::pair<ull,double>>> jacobianrows(number_of_blocks);
+    for(ull j=0; j<ncols; j++){
+      if(validIndex(inputindices[j])) jacobianrows[inputindices[j]].push_back({j, 1.});
+    }
+    for(ull index=1; index<number_of_blocks; index++){
+      if(kind[index]!=2) continue;
+      for(auto const& pred : preds[index]){
+        for(auto const& element : jacobianrows[pred.first]){
+          double* c = find(jacobianrows[index], element.first);
+          if(c){
+            *c += pred.second * element.second;
+          } else {
+            jacobianrows[index].push_back({element.first, pred.second * element.second});
+          }
+        }
+      }
+    }
+    for(ull i=0; i<nrows; i++){
+      if(!validIndex(outputindices[i])) continue;
+      std::vector<std::pair<ull,double>> row = jacobianrows[outputindices[i]];
+      std::sort(row.begin(), row.end());
+      for(auto const& element : row){
+        rows.push_back(i);
+        cols.push_back(element.first);
+        values.push_back(element.second);
+      }
+    }
+  }
+};
+
+#endif
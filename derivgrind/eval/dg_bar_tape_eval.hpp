@@ -44,6 +44,16 @@
    ----------------------------------------------------------------
 */
 
+#ifndef DG_BAR_TAPE_EVAL_HPP
+#define DG_BAR_TAPE_EVAL_HPP
+
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
 /*! \enum TapefileEvents
  * Event types passed to an optional event handler template argument
  * of Tapefile, to enable performance measurements.
@@ -53,52 +63,290 @@ enum TapefileEvent {
   EvaluateChunkEnd
 };
 
+/*! Whether an operand index carries derivatives.
+ *
+ * Index zero denotes a passive operand, and operands produced by
+ * unrecognized operations have indices with the highest bit set.
+ */
+inline bool validIndex(unsigned long long index){
+  return index!=0 && index<0x8000000000000000;
+}
+
+/*! Consecutive statements of the tape, with their operands stored contiguously.
+ *
+ * The operands of the k-th statement are indices[begin[k]], ..., indices[begin[k+1]-1],
+ * with partial derivatives diffs[begin[k]], ..., diffs[begin[k+1]-1]. Operands with
+ * index zero are not stored. If the tape stores the index of the result of each
+ * statement explicitly, it is found in lhs[k]; otherwise, lhs is empty and the
+ * index is the position of the statement on the tape.
+ */
+struct TapeChunk {
+  using ull = unsigned long long;
+  std::vector<ull> begin; //!< Offsets of the first operand of each statement, plus the total number of operands.
+  std::vector<ull> indices; //!< Indices of the operands.
+  std::vector<double> diffs; //!< Partial derivatives w.r.t. the operands.
+  std::vector<ull> lhs; //!< Indices of the results, if stored explicitly.
+
+  TapeChunk() : begin(1,0) {}
+
+  //! Remove all statements.
+  void clear(){
+    begin.assign(1,0);
+    indices.clear();
+    diffs.clear();
+    lhs.clear();
+  }
+  //! Set the index of the result of the statement that is currently being appended.
+  void setLhs(ull index){
+    lhs.push_back(index);
+  }
+  //! Add an operand to the statement that is currently being appended.
+  void addOperand(ull index, double diff){
+    if(index!=0){
+      indices.push_back(index);
+      diffs.push_back(diff);
+    }
+  }
+  //! Finish the statement that is currently being appended.
+  void endStatement(){
+    begin.push_back(indices.size());
+  }
+  /*! Append count-many two-operand blocks (index1, index2, diff1, diff2) as found in raw tape files.
+   *
+   * The vectors are grown once per call, which keeps their capacity when the
+   * chunk is cleared and loaded again, and operands with index zero are
+   * skipped without branches.
+   */
+  void addBlocks(ull const* blocks, ull count){
+    ull n = indices.size(), nbegin = begin.size();
+    indices.resize(n+2*count);
+    diffs.resize(n+2*count);
+    begin.resize(nbegin+count);
+    ull* ind = indices.data();
+    double* d = diffs.data();
+    ull* beg = begin.data()+nbegin;
+    for(ull b=0; b<count; b++){
+      ull const* block = blocks+4*b;
+      ind[n] = block[0];
+      std::memcpy(d+n, block+2, sizeof(double));
+      n += (block[0]!=0);
+      ind[n] = block[1];
+      std::memcpy(d+n, block+3, sizeof(double));
+      n += (block[1]!=0);
+      beg[b] = n;
+    }
+    indices.resize(n);
+    diffs.resize(n);
+  }
+};
+
+/*! Tape evaluator.
+ *
+ * \tparam bufsize Default number of statements loaded at once, see set_chunk_size.
+ * \tparam loadfun_t Type of the function loading statements.
+ * \tparam eventhandler Optional handler for performance measurements.
+ */
 template<unsigned long long bufsize, typename loadfun_t, void(*eventhandler)(TapefileEvent)=nullptr>
 class Tapefile {
   using ull = unsigned long long;
-  ull number_of_blocks; //!< Number of blocks on the tape.
-  ull tape_buf[4*bufsize]; //!< Buffers one "chunk", i.e. bufsize-many blocks of the tape.
-  loadfun_t loadfun; //!< Tapefile members call loadfun(i,count,tape_buf) to load count-many blocks, starting at index i.
+  ull number_of_blocks; //!< Number of blocks (i.e. statements) on the tape.
+  ull chunksize = bufsize; //!< Number of statements loaded at once.
+  ull read_ahead = 0; //!< Number of chunks a reader thread loads ahead of the evaluation, or 0 to load them in the evaluating thread.
+  TapeChunk chunk; //!< Buffers one "chunk", i.e. chunksize-many statements of the tape.
+  loadfun_t loadfun; //!< Tapefile members call loadfun(i,count,chunk) to append count-many statements, starting at index i, to the chunk.
+  bool explicit_lhs; //!< Whether indices are assigned multiple times, so results must be overwritten rather than accumulated.
+  ull first_index; //!< Index of the result of the statement at position 0.
 
 private:
+  /*! Call fun for all statements of a loaded chunk, in forward or backward order.
+   */
+  template<typename fun_t, bool forward>
+  void iterate_chunk(TapeChunk const& chunk, ull chunk_begin, ull chunk_count, fun_t& fun){
+    if(eventhandler) eventhandler(EvaluateChunkBegin);
+    for(long long block_in_chunk= (forward ? 0 : chunk_count-1);
+        forward ? (block_in_chunk<chunk_count) : (block_in_chunk>=0); 
+        block_in_chunk += (forward ? 1 : -1)) {
+      ull first = chunk.begin[block_in_chunk];
+      ull n = chunk.begin[block_in_chunk+1] - first;
+      ull index = chunk.lhs.empty() ? first_index+chunk_begin+block_in_chunk : chunk.lhs[block_in_chunk];
+      fun(index, n, chunk.indices.data()+first, chunk.diffs.data()+first);
+    }
+    if(eventhandler) eventhandler(EvaluateChunkEnd);
+  }
+
   /*! Implementation of iterate(..), information if forward or backward order is template argument.
    *
    */
   template<typename fun_t, bool forward>
   void iterate_impl(ull begin, ull end, fun_t fun){
+    iterate_chunks_impl<forward>(begin, end, [this,&fun](TapeChunk const& loaded, ull chunk_begin, ull chunk_count){
+      iterate_chunk<fun_t,forward>(loaded, chunk_begin, chunk_count, fun);
+    });
+  }
+
+  /*! Load the chunks between positions begin and end in forward or backward order,
+   * and call chunkfun(chunk, position of the first statement, number of statements) for each.
+   */
+  template<bool forward, typename chunkfun_t>
+  void iterate_chunks_impl(ull begin, ull end, chunkfun_t chunkfun){
     ull number_of_blocks_in_subtape = forward ? (end-begin+1) : (begin-end+1);
     // We divide the number_of_blocks_in_subtape many blocks into number_of_chunks_in_subtape many chunks.
     // These chunks are loaded at once, and then iterated through in the correct direction.
-    // Each chunk contains bufsize many blocks, except the last one, which contains 0,...,bufsize-1 many blocks.
-    ull number_of_chunks_in_subtape = number_of_blocks_in_subtape / bufsize + 1;
-    for(ull chunk=0; chunk<number_of_chunks_in_subtape; chunk++){
-      ull chunk_count = (chunk==number_of_chunks_in_subtape-1) ? (number_of_blocks_in_subtape - (number_of_chunks_in_subtape-1)*bufsize) : bufsize;
-      ull chunk_begin = forward ? (begin+chunk*bufsize) : (begin-chunk*bufsize-chunk_count+1);
-      loadfun(chunk_begin, chunk_count, tape_buf);
-      if(eventhandler) eventhandler(EvaluateChunkBegin);
-      for(long long block_in_chunk= (forward ? 0 : chunk_count-1);
-          forward ? (block_in_chunk<chunk_count) : (block_in_chunk>=0); 
-          block_in_chunk += (forward ? 1 : -1)) {
-        ull index1 = tape_buf[4*block_in_chunk];
-        ull index2 = tape_buf[4*block_in_chunk+1];
-        double diff1 = *reinterpret_cast<double*>(&tape_buf[4*block_in_chunk+2]);
-        double diff2 = *reinterpret_cast<double*>(&tape_buf[4*block_in_chunk+3]);
-        ull index = forward ? (begin+chunk*bufsize+block_in_chunk) : (begin-chunk*bufsize-chunk_count+block_in_chunk+1);
-        fun(index, index1, index2, diff1, diff2);
+    // Each chunk contains chunksize many blocks, except the last one, which contains 0,...,chunksize-1 many blocks.
+    ull number_of_chunks_in_subtape = number_of_blocks_in_subtape / chunksize + 1;
+    auto chunk_count = [this,number_of_blocks_in_subtape,number_of_chunks_in_subtape](ull chunk_nr) -> ull {
+      return (chunk_nr==number_of_chunks_in_subtape-1) ? (number_of_blocks_in_subtape - (number_of_chunks_in_subtape-1)*chunksize) : chunksize;
+    };
+    auto chunk_begin = [this,begin,&chunk_count](ull chunk_nr) -> ull {
+      return forward ? (begin+chunk_nr*chunksize) : (begin-chunk_nr*chunksize-chunk_count(chunk_nr)+1);
+    };
+    if(read_ahead==0 || number_of_chunks_in_subtape==1){
+      for(ull chunk_nr=0; chunk_nr<number_of_chunks_in_subtape; chunk_nr++){
+        chunk.clear();
+        loadfun(chunk_begin(chunk_nr), chunk_count(chunk_nr), chunk);
+        chunkfun(chunk, chunk_begin(chunk_nr), chunk_count(chunk_nr));
       }
-      if(eventhandler) eventhandler(EvaluateChunkEnd);
+      return;
     }
+    // A reader thread loads, and possibly decodes, the next read_ahead-many chunks
+    // into a ring of buffers while the current chunk is evaluated.
+    std::vector<TapeChunk> ring(read_ahead+1);
+    std::mutex mutex;
+    std::condition_variable cv;
+    ull loaded = 0, evaluated = 0; // number of chunks
+    std::thread reader([&](){
+      for(ull chunk_nr=0; chunk_nr<number_of_chunks_in_subtape; chunk_nr++){
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&]{ return loaded-evaluated < ring.size(); });
+        }
+        TapeChunk& buffer = ring[chunk_nr % ring.size()];
+        buffer.clear();
+        loadfun(chunk_begin(chunk_nr), chunk_count(chunk_nr), buffer);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          loaded++;
+        }
+        cv.notify_all();
+      }
+    });
+    for(ull chunk_nr=0; chunk_nr<number_of_chunks_in_subtape; chunk_nr++){
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]{ return loaded > chunk_nr; });
+      }
+      chunkfun(ring[chunk_nr % ring.size()], chunk_begin(chunk_nr), chunk_count(chunk_nr));
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        evaluated++;
+      }
+      cv.notify_all();
+    }
+    reader.join();
+  }
+
+  /*! Implementation of evaluateBackwardVector(..), with the width fixed at compile time unless W==0.
+   */
+  template<ull W>
+  void evaluateBackwardVector_impl(double* derivativevec, ull width){
+    const ull w = W ? W : width;
+    bool reset = explicit_lhs;
+    std::vector<double> saved(reset ? w : 0); // bar values of a reset index
+    iterate(number_of_blocks-1, 0, [derivativevec,w,reset,&saved](ull index, ull n, ull const* indices, double const* diffs){
+      double* bar = derivativevec + index*w;
+      bool nonzero = false;
+      for(ull k=0; k<w; k++){
+        nonzero |= (bar[k]!=0);
+      }
+      // the index might have been used for another variable before this statement
+      if(reset && n>0){
+        for(ull k=0; k<w; k++){
+          saved[k] = bar[k];
+          bar[k] = 0;
+        }
+        bar = saved.data();
+      }
+      if(nonzero){
+        for(ull j=0; j<n; j++){
+          if(indices[j] < 0x8000000000000000){
+            double* operandbar = derivativevec + indices[j]*w;
+            double diff = diffs[j];
+            for(ull k=0; k<w; k++){
+              operandbar[k] += bar[k] * diff;
+            }
+          }
+        }
+      }
+    });
+  }
+
+  /*! Implementation of evaluateForwardVector(..), with the width fixed at compile time unless W==0.
+   */
+  template<ull W>
+  void evaluateForwardVector_impl(double* derivativevec, ull width){
+    const ull w = W ? W : width;
+    bool reset = explicit_lhs;
+    std::vector<double> sum(w); // dot values of the result
+    iterate(0, number_of_blocks-1, [derivativevec,w,reset,&sum](ull index, ull n, ull const* indices, double const* diffs){
+      // statements without operands are inputs, whose dot values have been set
+      if(reset && n==0) return;
+      double* dot = derivativevec + index*w;
+      for(ull k=0; k<w; k++){
+        sum[k] = reset ? 0. : dot[k];
+      }
+      for(ull j=0; j<n; j++){
+        if(indices[j] < 0x8000000000000000){
+          double const* operanddot = derivativevec + indices[j]*w;
+          double diff = diffs[j];
+          for(ull k=0; k<w; k++){
+            sum[k] += operanddot[k] * diff;
+          }
+        }
+      }
+      for(ull k=0; k<w; k++){
+        dot[k] = sum[k];
+      }
+    });
   }
 
 public:
 
-  Tapefile(loadfun_t& loadfun, ull number_of_blocks) : loadfun(loadfun), number_of_blocks(number_of_blocks) {}
+  /*! \param loadfun Function loading statements into a TapeChunk.
+   * \param number_of_blocks Number of statements on the tape.
+   * \param explicit_lhs Whether the tape has been recorded with --index-reuse=yes.
+   * \param first_index Index of the result of the first statement, e.g. the thread offset of a tape recorded with --per-thread-tapes=yes.
+   */
+  Tapefile(loadfun_t& loadfun, ull number_of_blocks, bool explicit_lhs=false, ull first_index=0) : loadfun(loadfun), number_of_blocks(number_of_blocks), explicit_lhs(explicit_lhs), first_index(first_index) {}
+
+  //! Set the number of statements loaded at once. Larger chunks need more memory, but fewer calls to loadfun.
+  void set_chunk_size(ull n){
+    chunksize = n>0 ? n : 1;
+  }
+
+  /*! Let a reader thread call loadfun for the next n chunks while a chunk is evaluated,
+   *  so loading and decoding the tape overlap with the evaluation. n=0 disables the reader thread.
+   */
+  void set_read_ahead(ull n){
+    read_ahead = n;
+  }
+
+  //! Number of statements on the tape.
+  ull get_number_of_blocks() const {
+    return number_of_blocks;
+  }
+
+  //! Whether the results of the statements are stored explicitly, see the constructor.
+  bool get_explicit_lhs() const {
+    return explicit_lhs;
+  }
 
   /*! Iterate over sequence of consecutive blocks on the tape, either in forward or backward order.
    *
    * \param begin Index of first block included in the iteration.
    * \param end Index of last block included in the iteration.
-   * \param fun Function fun(index, index1, index2, diff1, diff2) called for each block.
+   * \param fun Function fun(index, n, indices, diffs) called for each block, where index is the
+   *   index of the result and the n-many non-zero operand indices and partial derivatives are passed
+   *   as pointers.
    */
   template<typename fun_t>
   void iterate(ull begin, ull end, fun_t fun){
@@ -108,57 +356,143 @@ public:
       iterate_impl<fun_t,false>(begin,end,fun);
   }
 
+  /*! Iterate over the loaded chunks between two positions, either in forward or backward order.
+   *
+   * Chunks are passed in the order of the iteration, but the statements within a chunk are always
+   * stored in forward order.
+   *
+   * \param begin Index of first block included in the iteration.
+   * \param end Index of last block included in the iteration.
+   * \param chunkfun Function chunkfun(chunk, index, count) called for each chunk of count-many statements,
+   *   where index is the index of the result of the first statement if the chunk does not store them explicitly.
+   */
+  template<typename chunkfun_t>
+  void iterateChunks(ull begin, ull end, chunkfun_t chunkfun){
+    auto fun = [this,&chunkfun](TapeChunk const& loaded, ull chunk_begin, ull chunk_count){
+      if(eventhandler) eventhandler(EvaluateChunkBegin);
+      chunkfun(loaded, first_index+chunk_begin, chunk_count);
+      if(eventhandler) eventhandler(EvaluateChunkEnd);
+    };
+    if(end >= begin)
+      iterate_chunks_impl<true>(begin,end,fun);
+    else
+      iterate_chunks_impl<false>(begin,end,fun);
+  }
+
   /*! Reverse evaluation of the tape.
    *
-   * \param derivativevec Vector of bar values ("adjoint vector") with the signature of a double[number_of_blocks]. Must be a initialized with zeros and output bar values before calling this function.
+   * \param derivativevec Vector of bar values ("adjoint vector") with the signature of a double[number_of_indices]. Must be a initialized with zeros and output bar values before calling this function.
    */
   template<typename derivativevec_t>
   void evaluateBackward(derivativevec_t& derivativevec){
-    iterate(number_of_blocks-1, 0, [&derivativevec](ull index, ull index1, ull index2, double diff1, double diff2){
-      if(derivativevec[index]!=0) {
-        if(index1!=0 && index1 < 0x8000000000000000) derivativevec[index1] += derivativevec[index] * diff1;
-        if(index2!=0 && index2 < 0x8000000000000000) derivativevec[index2] += derivativevec[index] * diff2;
+    evaluateBackward(derivativevec, number_of_blocks-1, 0);
+  }
+
+  /*! Reverse evaluation of the statements from position begin down to position end.
+   */
+  template<typename derivativevec_t>
+  void evaluateBackward(derivativevec_t& derivativevec, ull begin, ull end){
+    bool reset = explicit_lhs;
+    iterate(begin, end, [&derivativevec,reset](ull index, ull n, ull const* indices, double const* diffs){
+      double bar = derivativevec[index];
+      // the index might have been used for another variable before this statement
+      if(reset && n>0) derivativevec[index] = 0;
+      if(bar!=0) {
+        for(ull j=0; j<n; j++){
+          if(indices[j] < 0x8000000000000000) derivativevec[indices[j]] += bar * diffs[j];
+        }
       }
     });
   }
 
+  /*! Vector-mode reverse evaluation of the tape, for several output seeds at once.
+   *
+   * Every statement is loaded once for all seeds.
+   *
+   * \param derivativevec Bar values of number_of_indices many indices, with the width-many bar values of
+   *   every index stored contiguously. Must be initialized with zeros and output bar values before calling this function.
+   * \param width Number of bar values per index.
+   */
+  void evaluateBackwardVector(double* derivativevec, ull width){
+    switch(width){ // unrolled loops for common widths
+      case 1: evaluateBackwardVector_impl<1>(derivativevec, width); break;
+      case 2: evaluateBackwardVector_impl<2>(derivativevec, width); break;
+      case 4: evaluateBackwardVector_impl<4>(derivativevec, width); break;
+      case 8: evaluateBackwardVector_impl<8>(derivativevec, width); break;
+      case 16: evaluateBackwardVector_impl<16>(derivativevec, width); break;
+      default: evaluateBackwardVector_impl<0>(derivativevec, width); break;
+    }
+  }
+
   /*! Forward evaluation of the tape.
    *
-   * \param derivativevec Vector of dot values (compare to "adjoint vector") with the signature of a double[number_of_blocks]. Must be a initialized with zeros and input dot values before calling this function.
+   * \param derivativevec Vector of dot values (compare to "adjoint vector") with the signature of a double[number_of_indices]. Must be a initialized with zeros and input dot values before calling this function.
    */
   template<typename derivativevec_t>
   void evaluateForward(derivativevec_t& derivativevec){
-    iterate(0, number_of_blocks-1, [&derivativevec](ull index, ull index1, ull index2, double diff1, double diff2){
-      if(index1!=0 && index1 < 0x8000000000000000 && derivativevec[index1]!=0){
-        derivativevec[index] += derivativevec[index1] * diff1;
-      }
-      if(index2!=0 && index2 < 0x8000000000000000 && derivativevec[index2]!=0){
-        derivativevec[index] += derivativevec[index2] * diff2;
+    evaluateForward(derivativevec, 0, number_of_blocks-1);
+  }
+
+  /*! Forward evaluation of the statements from position begin up to position end.
+   *
+   * The dot value of every statement is summed up in the type of the entries of derivativevec.
+   */
+  template<typename derivativevec_t>
+  void evaluateForward(derivativevec_t& derivativevec, ull begin, ull end){
+    using entry_t = std::decay_t<decltype(derivativevec[0])>;
+    bool reset = explicit_lhs;
+    iterate(begin, end, [&derivativevec,reset](ull index, ull n, ull const* indices, double const* diffs){
+      // statements without operands are inputs, whose dot values have been set
+      if(reset && n==0) return;
+      entry_t dot = derivativevec[index];
+      if(reset) dot = 0.;
+      for(ull j=0; j<n; j++){
+        if(indices[j] < 0x8000000000000000 && derivativevec[indices[j]]!=0){
+          dot += derivativevec[indices[j]] * diffs[j];
+        }
       }
+      derivativevec[index] = dot;
     });
   }
 
+  /*! Vector-mode forward evaluation of the tape, for several input directions at once.
+   *
+   * \param derivativevec Dot values of number_of_indices many indices, with the width-many dot values of
+   *   every index stored contiguously. Must be initialized with zeros and input dot values before calling this function.
+   * \param width Number of dot values per index.
+   */
+  void evaluateForwardVector(double* derivativevec, ull width){
+    switch(width){ // unrolled loops for common widths
+      case 1: evaluateForwardVector_impl<1>(derivativevec, width); break;
+      case 2: evaluateForwardVector_impl<2>(derivativevec, width); break;
+      case 4: evaluateForwardVector_impl<4>(derivativevec, width); break;
+      case 8: evaluateForwardVector_impl<8>(derivativevec, width); break;
+      case 16: evaluateForwardVector_impl<16>(derivativevec, width); break;
+      default: evaluateForwardVector_impl<0>(derivativevec, width); break;
+    }
+  }
+
   /*! Get tape statistics.
    *
-   * \param nZero Number of blocks with two times a zero index, i.e., input variables plus one.
-   * \param nOne Number of blocks with one zero and one non-zero index.
-   * \param nTwo Number of blocks with two non-zero indices.
+   * \param nZero Number of blocks without non-zero index, i.e., input variables plus one.
+   * \param nOne Number of blocks with one non-zero index.
+   * \param nTwo Number of blocks with two or more non-zero indices.
    */
   void stats(ull& nZero, ull& nOne, ull& nTwo){
     nZero = nOne = nTwo = 0;
-    iterate(0,number_of_blocks-1, [&nZero,&nOne,&nTwo](ull index, ull index1, ull index2, double diff1, double diff2){
-      if(index1==0 && index2==0){
+    iterate(0,number_of_blocks-1, [&nZero,&nOne,&nTwo](ull index, ull n, ull const* indices, double const* diffs){
+      if(n==0){
         nZero++;
-      } else if(index1!=0 && index2!=0){
-        nTwo++;
-      } else {
+      } else if(n==1){
         nOne++;
+      } else {
+        nTwo++;
       }
     });
   }
 
   /*! Scan the tape for variables that influence the result, but were not recognized as the result of a floating-point operation.
-   * 
+   *
    * When Derivgrind is running with --typegrind=yes, it emits an index larger or equal 0x80..0 for the result of all operations that it does not recognize as real arithmetic.
    * The existence of such operations is not necessarily problematic. Only if such a result is used to compute the output to be differentiated, Derivgrind might overlook
    * some real-arithmetic dependency. This function proceeds like a tape evaluation to find out which indices can influence the output, and notifies the caller with a callback
@@ -169,11 +503,16 @@ public:
    */
   template<typename influencervec_t, typename callback_t>
   void evaluate_for_typegrind(influencervec_t& influencervec, callback_t callback){
-    iterate(number_of_blocks-1, 0, [&influencervec,&callback](ull index, ull index1, ull index2, double diff1, double diff2){
+    iterate(number_of_blocks-1, 0, [&influencervec,&callback](ull index, ull n, ull const* indices, double const* diffs){
       if(influencervec[index]==1){
-        if(index1 >= 0x8000000000000000) influencervec[index1] = 1;
-        if(index2 >= 0x8000000000000000) influencervec[index2] = 1;
-        if(index1>=0x8000000000000000 || index2>=0x8000000000000000){
+        bool unrecognized = false;
+        for(ull j=0; j<n; j++){
+          if(indices[j] >= 0x8000000000000000){
+            influencervec[indices[j]] = 1;
+            unrecognized = true;
+          }
+        }
+        if(unrecognized){
           callback(index);
           return;
         }
@@ -182,3 +521,4 @@ public:
   }
 };
 
+#endif
@@ -0,0 +1,197 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_jacobian.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_jacobian.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_JACOBIAN_HPP
+#define DG_BAR_TAPE_JACOBIAN_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "dg_bar_tape_eval.hpp"
+
+/*! \file dg_bar_tape_jacobian.hpp
+ * Jacobians of the outputs with respect to the inputs.
+ *
+ * SparseJacobian first determines the sparsity pattern of the Jacobian by
+ * propagating, for every index, the set of inputs it depends on through
+ * the tape. Columns (inputs) that do not share a row are given the same
+ * color, and likewise rows (outputs) that do not share a column. Whichever
+ * coloring needs fewer colors determines whether a single vector-mode
+ * forward or reverse evaluation is run, with a seed direction per color.
+ */
+
+/*! Non-zero entries of a Jacobian, with rows for outputs and columns for inputs.
+ */
+struct JacobianEntries {
+  using ull = unsigned long long;
+  ull nrows, ncols; //!< Number of outputs and inputs.
+  std::vector<ull> rows, cols; //!< Positions of the non-zero entries in the output and input lists, sorted by row.
+  std::vector<double> values; //!< Values of the non-zero entries.
+
+  JacobianEntries(ull nrows, ull ncols) : nrows(nrows), ncols(ncols) {}
+
+  //! Write the Jacobian in the Matrix Market coordinate format.
+  void writeMatrixMarket(std::string filename) const {
+    std::ofstream file(filename);
+    file << "%%MatrixMarket matrix coordinate real general\n";
+    file << nrows << " " << ncols << " " << values.size() << "\n";
+    for(ull k=0; k<values.size(); k++){
+      file << rows[k]+1 << " " << cols[k]+1 << " " << std::setprecision(16) << values[k] << "\n";
+    }
+  }
+};
+
+/*! Sparse Jacobian computed with compressed seeds.
+ *
+ * \tparam tape_t Tapefile type.
+ */
+template<typename tape_t>
+class SparseJacobian : public JacobianEntries {
+
+  /*! Greedy coloring such that entries of the same color do not share a neighbour.
+   * \param pattern Neighbours of every entry to be colored.
+   * \param transposed Entries that are neighbours of each neighbour.
+   * \param colors Set to the color of every entry.
+   * \returns Number of colors.
+   */
+  static ull color(std::vector<std::vector<ull>> const& pattern, std::vector<std::vector<ull>> const& transposed, std::vector<ull>& colors){
+    colors.assign(pattern.size(), ull(-1));
+    std::vector<ull> forbidden; // forbidden[c]==e if color c is used by an entry conflicting with e
+    ull ncolors = 0;
+    for(ull e=0; e<pattern.size(); e++){
+      for(ull neighbour : pattern[e]){
+        for(ull f : transposed[neighbour]){
+          if(colors[f]!=ull(-1)) forbidden[colors[f]] = e;
+        }
+      }
+      ull c = 0;
+      while(c<ncolors && forbidden[c]==e) c++;
+      if(c==ncolors){
+        ncolors++;
+        forbidden.push_back(ull(-1));
+      }
+      colors[e] = c;
+    }
+    return ncolors;
+  }
+
+public:
+  bool forward; //!< Whether the Jacobian has been computed by a forward evaluation.
+  ull ncolors; //!< Number of seed directions.
+
+  /*! Compute the Jacobian.
+   *
+   * \param tape Tape to be differentiated.
+   * \param number_of_blocks Number of statements on the tape.
+   * \param number_of_indices Size of the derivative vector.
+   * \param explicit_lhs Whether the tape has been recorded with --index-reuse=yes.
+   * \param inputindices Indices of the inputs.
+   * \param outputindices Indices of the outputs.
+   */
+  SparseJacobian(tape_t& tape, ull number_of_blocks, ull number_of_indices, bool explicit_lhs, std::vector<ull> const& inputindices, std::vector<ull> const& outputindices)
+    : JacobianEntries(outputindices.size(), inputindices.size()) {
+    // sets of inputs every index depends on, propagated like dot values
+    std::vector<std::vector<ull>> sets(number_of_indices);
+    for(ull j=0; j<ncols; j++){
+      if(validIndex(inputindices[j])) sets[inputindices[j]].push_back(j);
+    }
+    std::vector<ull> merged;
+    bool reset = explicit_lhs;
+    tape.iterate(0, number_of_blocks-1, [&sets,&merged,reset](ull index, ull n, ull const* indices, double const* diffs){
+      if(reset && n==0) return;
+      std::vector<ull> result;
+      if(!reset) result.swap(sets[index]);
+      for(ull j=0; j<n; j++){
+        if(!validIndex(indices[j]) || sets[indices[j]].empty()) continue;
+        merged.clear();
+        std::set_union(result.begin(), result.end(), sets[indices[j]].begin(), sets[indices[j]].end(), std::back_inserter(merged));
+        result.swap(merged);
+      }
+      sets[index].swap(result);
+    });
+    std::vector<std::vector<ull>> rowpattern(nrows), colpattern(ncols);
+    for(ull i=0; i<nrows; i++){
+      if(validIndex(outputindices[i])) rowpattern[i] = sets[outputindices[i]];
+      for(ull j : rowpattern[i]) colpattern[j].push_back(i);
+    }
+    sets.clear();
+    sets.shrink_to_fit();
+
+    std::vector<ull> colcolors, rowcolors;
+    ull ncolcolors = color(colpattern, rowpattern, colcolors);
+    ull nrowcolors = color(rowpattern, colpattern, rowcolors);
+    forward = ncolcolors < nrowcolors;
+    ncolors = forward ? ncolcolors : nrowcolors;
+    if(ncolors==0) return;
+
+    std::vector<double> derivativevec(number_of_indices*ncolors, 0.);
+    if(forward){
+      for(ull j=0; j<ncols; j++){
+        if(validIndex(inputindices[j])) derivativevec[inputindices[j]*ncolors+colcolors[j]] = 1.;
+      }
+      tape.evaluateForwardVector(derivativevec.data(), ncolors);
+    } else {
+      for(ull i=0; i<nrows; i++){
+        if(validIndex(outputindices[i])) derivativevec[outputindices[i]*ncolors+rowcolors[i]] += 1.;
+      }
+      tape.evaluateBackwardVector(derivativevec.data(), ncolors);
+    }
+    for(ull i=0; i<nrows; i++){
+      for(ull j : rowpattern[i]){
+        rows.push_back(i);
+        cols.push_back(j);
+        values.push_back(forward ? derivativevec[outputindices[i]*ncolors+colcolors[j]]
+                                 : derivativevec[inputindices[j]*ncolors+rowcolors[i]]);
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,294 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_levels.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_levels.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_LEVELS_HPP
+#define DG_BAR_TAPE_LEVELS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dg_bar_tape_cache.hpp"
+#include "dg_bar_tape_eval.hpp"
+
+/*! \file dg_bar_tape_levels.hpp
+ * Multi-threaded evaluation of a single tape.
+ *
+ * The level of a statement is zero if it has no operands, and one plus
+ * the maximal level of its operands otherwise. Statements of the same
+ * level do not depend on each other, so every level is evaluated
+ * concurrently by a pool of threads, which pick up ranges of statements
+ * until the level is exhausted. Recorded tapes mostly consist of long
+ * chains of dependent statements, whose levels are too narrow to be worth
+ * the synchronization. Runs of such levels are therefore evaluated by a
+ * single thread, level by level, and the threads only wait for each other
+ * before and after levels that are shared among them.
+ *
+ * Every statement only writes to the derivative of its own result:
+ * In forward direction, it gathers the dot values of its operands. In
+ * reverse direction, it gathers the bar values of the statements using
+ * its result as an operand, on a transposed copy of the tape. Therefore,
+ * no locks or atomic updates of the derivative vector are needed.
+ *
+ * The statements are held in memory, and tapes recorded with
+ * --index-reuse=yes are not supported.
+ */
+
+/*! Statements of a tape sorted by level, for concurrent evaluation.
+ */
+class LevelScheduledTape {
+  using ull = unsigned long long;
+  static constexpr ull magic = 0x534c4556454c4744; //!< Identifies a dg-tape-levels file.
+  static constexpr ull grain = 256; //!< Number of statements a thread picks up at once.
+
+  ull number_of_blocks;
+  unsigned nthreads;
+  std::vector<ull> begin, indices; //!< Operands of the statement at position k in indices[begin[k]], ..., indices[begin[k+1]-1].
+  std::vector<double> diffs;
+  std::vector<ull> tbegin, tindices; //!< Statements using the result at position k, in tindices[tbegin[k]], ..., tindices[tbegin[k+1]-1].
+  std::vector<double> tdiffs;
+  std::vector<ull> order; //!< Statement positions sorted by level.
+  std::vector<ull> level_begin; //!< Offsets of the levels in order, plus the number of blocks.
+  std::vector<ull> segment_begin; //!< Offsets of the segments in order, plus the number of blocks.
+  std::vector<char> segment_shared; //!< Whether a segment is a wide level shared among the threads, or a run of narrow levels.
+
+  //! Compute the levels of all statements in a pass over the tape, and sort them by level.
+  template<typename tape_t>
+  void analyse(tape_t& tape){
+    std::vector<ull> level(number_of_blocks, 0);
+    ull number_of_levels = number_of_blocks>0 ? 1 : 0;
+    tape.iterate(0, number_of_blocks-1, [&level,&number_of_levels](ull k, ull n, ull const* operands, double const*){
+      for(ull j=0; j<n; j++){
+        if(operands[j] < 0x8000000000000000) level[k] = std::max(level[k], level[operands[j]]+1);
+      }
+      number_of_levels = std::max(number_of_levels, level[k]+1);
+    });
+    level_begin.assign(number_of_levels+1, 0);
+    for(ull k=0; k<number_of_blocks; k++) level_begin[level[k]+1]++;
+    for(ull l=0; l<number_of_levels; l++) level_begin[l+1] += level_begin[l];
+    std::vector<ull> pos(level_begin.begin(), level_begin.end()-1);
+    order.resize(number_of_blocks);
+    for(ull k=0; k<number_of_blocks; k++) order[pos[level[k]]++] = k;
+  }
+
+  //! Read the level schedule from a cache file, see dg_bar_tape_cache.hpp.
+  bool readCache(std::string const& cachepath, std::string const& tapepath){
+    std::ifstream cachefile;
+    if(!openTapeCache(cachefile, cachepath, tapepath, {magic, number_of_blocks})) return false;
+    ull number_of_levels;
+    if(!cachefile.read(reinterpret_cast<char*>(&number_of_levels), sizeof(ull))) return false;
+    level_begin.resize(number_of_levels+1);
+    cachefile.read(reinterpret_cast<char*>(level_begin.data()), level_begin.size()*sizeof(ull));
+    segment();
+    // the order is only needed for a concurrent evaluation
+    if(number_of_shared_levels()>0){
+      order.resize(number_of_blocks);
+      cachefile.read(reinterpret_cast<char*>(order.data()), order.size()*sizeof(ull));
+    }
+    return bool(cachefile);
+  }
+
+  void writeCache(std::string const& cachepath, std::string const& tapepath){
+    std::ofstream cachefile;
+    createTapeCache(cachefile, cachepath, tapepath, {magic, number_of_blocks});
+    ull number_of_levels = level_begin.size()-1;
+    cachefile.write(reinterpret_cast<char const*>(&number_of_levels), sizeof(ull));
+    cachefile.write(reinterpret_cast<char const*>(level_begin.data()), level_begin.size()*sizeof(ull));
+    cachefile.write(reinterpret_cast<char const*>(order.data()), order.size()*sizeof(ull));
+  }
+
+  //! Build the transposed tape, on the first reverse evaluation.
+  void transpose(){
+    if(!tbegin.empty()) return;
+    tbegin.assign(number_of_blocks+1, 0);
+    for(ull j=0; j<indices.size(); j++) tbegin[indices[j]+1]++;
+    for(ull k=0; k<number_of_blocks; k++) tbegin[k+1] += tbegin[k];
+    std::vector<ull> pos(tbegin.begin(), tbegin.end()-1);
+    tindices.resize(indices.size());
+    tdiffs.resize(indices.size());
+    for(ull k=0; k<number_of_blocks; k++){
+      for(ull j=begin[k]; j<begin[k+1]; j++){
+        tindices[pos[indices[j]]] = k;
+        tdiffs[pos[indices[j]]++] = diffs[j];
+      }
+    }
+  }
+
+  /*! Group the levels into segments.
+   *
+   * Every level with at least grain*nthreads statements forms a shared segment.
+   * Consecutive narrower levels are merged into a single segment.
+   */
+  void segment(){
+    ull number_of_levels = level_begin.size()-1;
+    segment_begin.clear();
+    segment_shared.clear();
+    for(ull l=0; l<number_of_levels; l++){
+      bool shared = nthreads>1 && level_begin[l+1]-level_begin[l] >= grain*nthreads;
+      if(shared || segment_shared.empty() || segment_shared.back()){
+        segment_begin.push_back(level_begin[l]);
+        segment_shared.push_back(shared);
+      }
+    }
+    segment_begin.push_back(number_of_blocks);
+  }
+
+  /*! Call fun(k) for the statement at every position k, level by level.
+   *
+   * Shared segments are evaluated by all threads, other segments by a single
+   * thread. The threads wait for each other at the end of every segment.
+   */
+  template<typename fun_t>
+  void evaluate(bool forward, fun_t fun){
+    ull number_of_segments = segment_shared.size();
+    std::unique_ptr<std::atomic<ull>[]> next(new std::atomic<ull>[number_of_segments]);
+    for(ull s=0; s<number_of_segments; s++) next[s] = segment_begin[s];
+    std::atomic<ull> finished(0); // number of segments finished, summed over all threads
+    auto worker = [this,forward,number_of_segments,&next,&finished,&fun](bool main){
+      for(ull i=0; i<number_of_segments; i++){
+        ull s = forward ? i : number_of_segments-1-i;
+        if(segment_shared[s]){
+          while(true){
+            ull first = next[s].fetch_add(grain, std::memory_order_relaxed);
+            if(first>=segment_begin[s+1]) break;
+            ull last = std::min(first+grain, segment_begin[s+1]);
+            for(ull p=first; p<last; p++) fun(order[p]);
+          }
+        } else if(main){
+          // statements are sorted by level, so their order respects the dependencies
+          if(forward){
+            for(ull p=segment_begin[s]; p<segment_begin[s+1]; p++) fun(order[p]);
+          } else {
+            for(ull p=segment_begin[s+1]; p-->segment_begin[s]; ) fun(order[p]);
+          }
+        }
+        finished.fetch_add(1, std::memory_order_acq_rel);
+        while(finished.load(std::memory_order_acquire) < (i+1)*nthreads) std::this_thread::yield();
+      }
+    };
+    std::vector<std::thread> workers;
+    for(unsigned t=1; t<nthreads; t++) workers.emplace_back(worker, false);
+    worker(true);
+    for(std::thread& w : workers) w.join();
+  }
+
+public:
+  /*! Determine the levels of the statements of a tape, and load them if the tape has levels wide enough to be shared.
+   *
+   * If there are no such levels, no statements are loaded, and the tape should be evaluated
+   * sequentially instead, see number_of_shared_levels.
+   *
+   * \param tape Tape without explicitly stored results.
+   * \param number_of_blocks Number of statements on the tape.
+   * \param nthreads Number of evaluation threads.
+   * \param cachepath If not empty, the level schedule is read from or written to this file.
+   * \param tapepath Tape file, used to check whether the cache is up to date.
+   */
+  template<typename tape_t>
+  LevelScheduledTape(tape_t& tape, ull number_of_blocks, unsigned nthreads, std::string const& cachepath="", std::string const& tapepath="")
+    : number_of_blocks(number_of_blocks), nthreads(nthreads>0 ? nthreads : 1) {
+    if(cachepath.empty() || !readCache(cachepath, tapepath)){
+      analyse(tape);
+      segment();
+      if(!cachepath.empty()) writeCache(cachepath, tapepath);
+    }
+    if(number_of_shared_levels()==0) return;
+    begin.reserve(number_of_blocks+1);
+    begin.push_back(0);
+    tape.iterate(0, number_of_blocks-1, [this](ull index, ull n, ull const* operands, double const* partials){
+      for(ull j=0; j<n; j++){
+        // operands produced by unrecognized operations do not carry derivatives
+        if(operands[j] < 0x8000000000000000){
+          indices.push_back(operands[j]);
+          diffs.push_back(partials[j]);
+        }
+      }
+      begin.push_back(indices.size());
+    });
+  }
+
+  //! Number of levels, i.e. the length of the longest chain of dependent statements.
+  ull number_of_levels() const { return level_begin.size()-1; }
+
+  //! Number of levels wide enough to be shared among the threads. If zero, the tape cannot be evaluated by this class.
+  ull number_of_shared_levels() const { return std::count(segment_shared.begin(), segment_shared.end(), 1); }
+
+  /*! Concurrent reverse evaluation of the tape, which must have shared levels.
+   *
+   * \param derivativevec Vector of bar values, see Tapefile::evaluateBackward.
+   */
+  void evaluateBackward(double* derivativevec){
+    transpose();
+    evaluate(false, [this,derivativevec](ull k){
+      double bar = derivativevec[k];
+      for(ull j=tbegin[k]; j<tbegin[k+1]; j++){
+        // like Tapefile::evaluateBackward, skip zero bar values times infinite partial derivatives
+        if(derivativevec[tindices[j]]!=0) bar += derivativevec[tindices[j]] * tdiffs[j];
+      }
+      derivativevec[k] = bar;
+    });
+  }
+
+  /*! Concurrent forward evaluation of the tape, which must have shared levels.
+   *
+   * \param derivativevec Vector of dot values, see Tapefile::evaluateForward.
+   */
+  void evaluateForward(double* derivativevec){
+    evaluate(true, [this,derivativevec](ull k){
+      double dot = derivativevec[k];
+      for(ull j=begin[k]; j<begin[k+1]; j++){
+        if(derivativevec[indices[j]]!=0) dot += derivativevec[indices[j]] * diffs[j];
+      }
+      derivativevec[k] = dot;
+    });
+  }
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_mapping.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_mapping.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_MAPPING_HPP
+#define DG_BAR_TAPE_MAPPING_HPP
+
+#include <algorithm>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dg_bar_tape_eval.hpp"
+
+/*! \file dg_bar_tape_mapping.hpp
+ * Memory-mapped access to raw tapes.
+ *
+ * Raw tapes are mapped instead of being read chunk by chunk, so the
+ * evaluation does not issue a seek and a read per chunk.
+ *
+ * With --tape-in-ram=yes --tape-fd=n, Derivgrind records the tape directly
+ * into the pages of the inherited file descriptor n, which is typically
+ * created by memfd_create. The evaluator maps the same pages, so the tape
+ * is neither copied nor written to the file system.
+ */
+
+/*! Path under which a tape passed as a file descriptor can be opened.
+ */
+inline std::string tapePathFromFd(int fd){
+  return "/proc/self/fd/" + std::to_string(fd);
+}
+
+/*! Read-only mapping of a raw tape.
+ *
+ * The kernel's read-ahead only works in forward direction, so load(..)
+ * asks for the next chunk in the direction of the sweep to be paged in
+ * while the current chunk is evaluated.
+ */
+class MappedTape {
+  using ull = unsigned long long;
+  void* addr;
+  ull size; //!< Size of the mapping in bytes.
+  ull last_begin; //!< First block of the most recently loaded chunk.
+
+  void map(int fd, std::string const& what, bool hugepages){
+    struct stat st;
+    if(fstat(fd, &st)!=0){
+      std::cerr << "Cannot determine size of " << what << "." << std::endl;
+      exit(1);
+    }
+    size = st.st_size;
+    if(size>0){
+      addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if(addr==MAP_FAILED){
+        std::cerr << "Cannot map " << what << "." << std::endl;
+        exit(1);
+      }
+      #ifdef MADV_HUGEPAGE
+      // only effective for tapes on tmpfs or in a memfd, so failures are ignored
+      if(hugepages) madvise(addr, size, MADV_HUGEPAGE);
+      #endif
+    }
+  }
+
+  //! Ask the kernel to page in the given blocks.
+  void prefetch(ull begin, ull end){
+    static const ull pagesize = sysconf(_SC_PAGESIZE);
+    ull first = (begin*32) / pagesize * pagesize;
+    ull last = std::min(end*32, size);
+    if(last>first) madvise(static_cast<char*>(addr)+first, last-first, MADV_WILLNEED);
+  }
+
+public:
+  //! Map a tape passed as a file descriptor.
+  MappedTape(int fd, bool hugepages=false) : addr(nullptr), size(0), last_begin(0) {
+    map(fd, "tape passed as file descriptor "+std::to_string(fd), hugepages);
+  }
+  //! Map a tape file.
+  MappedTape(std::string const& path, bool hugepages=false) : addr(nullptr), size(0), last_begin(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd<0){
+      std::cerr << "Cannot open tape file '" << path << "'." << std::endl;
+      exit(1);
+    }
+    map(fd, "tape file '"+path+"'", hugepages);
+    close(fd); // the mapping stays valid
+  }
+  MappedTape(MappedTape const&) = delete;
+  MappedTape& operator=(MappedTape const&) = delete;
+  ~MappedTape(){
+    if(addr) munmap(addr, size);
+  }
+
+  //! Blocks of the raw tape, 4 ULongs each.
+  ull const* blocks() const { return static_cast<ull const*>(addr); }
+  ull number_of_blocks() const { return size/32; }
+
+  /*! Append count-many blocks starting at block i to a chunk, see Tapefile.
+   */
+  void load(ull i, ull count, TapeChunk& chunk){
+    if(i<last_begin){ // backward sweep
+      prefetch(i>count ? i-count : 0, i);
+    } else {
+      prefetch(i+count, i+2*count);
+    }
+    last_begin = i;
+    chunk.addBlocks(blocks()+4*i, count);
+  }
+};
+
+#endif
@@ -0,0 +1,263 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_outofcore.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_outofcore.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_OUTOFCORE_HPP
+#define DG_BAR_TAPE_OUTOFCORE_HPP
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "dg_bar_tape_cache.hpp"
+#include "dg_bar_tape_eval.hpp"
+
+/*! \file dg_bar_tape_outofcore.hpp
+ * Evaluation of tapes whose derivative vector does not fit into memory.
+ *
+ * The full derivative vector is kept in a memory-mapped scratch file, so
+ * the kernel can write its pages back to disk and evict them. The tape is
+ * split into segments of consecutive statements. A statement only
+ * accesses the derivatives of its result and of its operands, which are
+ * mostly results of recent statements. Before a segment is evaluated, a
+ * window from the smallest operand index of the segment, but at most one
+ * segment size below its first statement, up to its last statement is
+ * copied from the scratch file into memory, and it is written back
+ * afterwards. Operands below the window, like inputs used throughout the
+ * tape, are accessed in the scratch file directly. Hence, the memory
+ * needed for the window and the cost of copying it are bounded by twice
+ * the segment size.
+ *
+ * The smallest operand index of every segment is determined in a pass
+ * over the tape, and stored beside the tape. Tapes recorded with
+ * --index-reuse=yes are not supported.
+ */
+
+/*! Zero-initialized vector of doubles in a memory-mapped scratch file.
+ *
+ * The file is removed right after it has been created, so it disappears
+ * once the vector is destroyed or the program exits.
+ */
+class ScratchVector {
+  using ull = unsigned long long;
+  double* addr;
+  ull size; //!< Size of the mapping in bytes.
+  int fd;
+
+public:
+  /*! Create the scratch file.
+   *
+   * \param filename Path of the scratch file.
+   * \param n Number of doubles.
+   */
+  ScratchVector(std::string const& filename, ull n) : addr(nullptr), size(n*sizeof(double)) {
+    fd = open(filename.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0600);
+    if(fd<0){
+      std::cerr << "Cannot create scratch file '" << filename << "'." << std::endl;
+      exit(1);
+    }
+    unlink(filename.c_str());
+    if(ftruncate(fd, size)!=0){
+      std::cerr << "Cannot resize scratch file '" << filename << "'." << std::endl;
+      exit(1);
+    }
+    if(size>0){
+      void* p = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+      if(p==MAP_FAILED){
+        std::cerr << "Cannot map scratch file '" << filename << "'." << std::endl;
+        exit(1);
+      }
+      addr = static_cast<double*>(p);
+    }
+  }
+  ScratchVector(ScratchVector const&) = delete;
+  ScratchVector& operator=(ScratchVector const&) = delete;
+  ~ScratchVector(){
+    if(addr) munmap(addr, size);
+    close(fd);
+  }
+
+  double* data() { return addr; }
+};
+
+/*! Window of a derivative vector held in memory.
+ *
+ * The indices lo, ..., hi-1 are held in memory, all other indices only
+ * in the full derivative vector. Indices below lo are accessed in the full
+ * derivative vector, indices from hi onwards must not be accessed.
+ */
+class DerivativeWindow {
+  using ull = unsigned long long;
+  double* full; //!< Full derivative vector.
+  std::vector<double> buf, nextbuf; //!< Current window, and buffer for the next one.
+  ull lo, hi;
+
+public:
+  DerivativeWindow(double* full) : full(full), lo(0), hi(0) {}
+  DerivativeWindow(DerivativeWindow const&) = delete;
+  DerivativeWindow& operator=(DerivativeWindow const&) = delete;
+  ~DerivativeWindow(){
+    slide(0,0);
+  }
+
+  double& operator[](ull index){ return index>=lo ? buf[index-lo] : full[index]; }
+
+  /*! Hold the indices newlo, ..., newhi-1 in memory.
+   *
+   * Indices that are not held anymore are written back to the full
+   * derivative vector, and indices that were not held before are read from it.
+   */
+  void slide(ull newlo, ull newhi){
+    nextbuf.resize(newhi-newlo);
+    ull overlap_lo = std::max(lo,newlo), overlap_hi = std::min(hi,newhi);
+    if(overlap_lo<overlap_hi){
+      std::copy(buf.begin(), buf.begin()+(overlap_lo-lo), full+lo);
+      std::copy(buf.begin()+(overlap_hi-lo), buf.end(), full+overlap_hi);
+      std::copy(buf.begin()+(overlap_lo-lo), buf.begin()+(overlap_hi-lo), nextbuf.begin()+(overlap_lo-newlo));
+      std::copy(full+newlo, full+overlap_lo, nextbuf.begin());
+      std::copy(full+overlap_hi, full+newhi, nextbuf.begin()+(overlap_hi-newlo));
+    } else {
+      std::copy(buf.begin(), buf.end(), full+lo);
+      std::copy(full+newlo, full+newhi, nextbuf.begin());
+    }
+    buf.swap(nextbuf);
+    lo = newlo;
+    hi = newhi;
+  }
+};
+
+/*! Tape split into segments, for evaluation with a window of the derivative vector.
+ */
+class SegmentedTape {
+  using ull = unsigned long long;
+  static constexpr ull magic = 0x544e4d4745534744; //!< Identifies a dg-tape-segments file.
+
+  ull number_of_blocks;
+  ull segment_size; //!< Number of statements per segment.
+  std::vector<ull> minindex; //!< Smallest index accessed by every segment.
+
+  //! Read the smallest indices from a cache file, see dg_bar_tape_cache.hpp.
+  bool readCache(std::string const& cachepath, std::string const& tapepath){
+    std::ifstream cachefile;
+    if(!openTapeCache(cachefile, cachepath, tapepath, {magic, number_of_blocks, segment_size})) return false;
+    cachefile.read(reinterpret_cast<char*>(minindex.data()), minindex.size()*sizeof(ull));
+    return bool(cachefile);
+  }
+
+  void writeCache(std::string const& cachepath, std::string const& tapepath){
+    std::ofstream cachefile;
+    createTapeCache(cachefile, cachepath, tapepath, {magic, number_of_blocks, segment_size});
+    cachefile.write(reinterpret_cast<char const*>(minindex.data()), minindex.size()*sizeof(ull));
+  }
+
+  //! Smallest index of the window of a segment.
+  ull windowBegin(ull s) const {
+    ull first = s*segment_size;
+    return std::max(minindex[s], first>segment_size ? first-segment_size : 0);
+  }
+
+public:
+  /*! Determine the smallest index accessed by every segment.
+   *
+   * \param tape Tape without explicitly stored results.
+   * \param number_of_blocks Number of statements on the tape.
+   * \param segment_size Number of statements per segment.
+   * \param cachepath If not empty, the smallest indices are read from or written to this file.
+   * \param tapepath Tape file, used to check whether the cache is up to date.
+   */
+  template<typename tape_t>
+  SegmentedTape(tape_t& tape, ull number_of_blocks, ull segment_size, std::string const& cachepath="", std::string const& tapepath="")
+    : number_of_blocks(number_of_blocks), segment_size(segment_size>0 ? segment_size : 1) {
+    minindex.resize((number_of_blocks+this->segment_size-1)/this->segment_size);
+    if(cachepath.empty() || !readCache(cachepath, tapepath)){
+      for(ull s=0; s<minindex.size(); s++) minindex[s] = s*this->segment_size;
+      tape.iterate(0, number_of_blocks-1, [this](ull index, ull n, ull const* indices, double const* diffs){
+        ull& m = minindex[index/this->segment_size];
+        for(ull j=0; j<n; j++){
+          if(indices[j] < 0x8000000000000000) m = std::min(m, indices[j]);
+        }
+      });
+      if(!cachepath.empty()) writeCache(cachepath, tapepath);
+    }
+  }
+
+  /*! Reverse evaluation of the tape, segment by segment.
+   *
+   * \param tape The tape passed to the constructor.
+   * \param derivativevec Full vector of bar values, see Tapefile::evaluateBackward.
+   */
+  template<typename tape_t>
+  void evaluateBackward(tape_t& tape, double* derivativevec){
+    DerivativeWindow window(derivativevec);
+    for(ull s=minindex.size(); s-->0; ){
+      ull first = s*segment_size, last = std::min(first+segment_size, number_of_blocks)-1;
+      window.slide(windowBegin(s), last+1);
+      tape.evaluateBackward(window, last, first);
+    }
+  }
+
+  /*! Forward evaluation of the tape, segment by segment.
+   *
+   * \param tape The tape passed to the constructor.
+   * \param derivativevec Full vector of dot values, see Tapefile::evaluateForward.
+   */
+  template<typename tape_t>
+  void evaluateForward(tape_t& tape, double* derivativevec){
+    DerivativeWindow window(derivativevec);
+    for(ull s=0; s<minindex.size(); s++){
+      ull first = s*segment_size, last = std::min(first+segment_size, number_of_blocks)-1;
+      window.slide(windowBegin(s), last+1);
+      tape.evaluateForward(window, first, last);
+    }
+  }
+};
+
+#endif
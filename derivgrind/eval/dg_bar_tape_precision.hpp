@@ -0,0 +1,161 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_precision.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_precision.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_PRECISION_HPP
+#define DG_BAR_TAPE_PRECISION_HPP
+
+#include <string>
+
+/*! \file dg_bar_tape_precision.hpp
+ * Alternative types for the entries of the derivative vector.
+ *
+ * Tapefile::evaluateBackward and Tapefile::evaluateForward accept any
+ * vector whose entries can be converted to double, assigned a double,
+ * and incremented by a double. Partial derivatives and the products of
+ * bar values with partial derivatives stay in double precision, while the
+ * type of the entries determines how the contributions of all statements
+ * using a variable are summed up in reverse evaluation, and how the
+ * contributions of the operands of a statement are summed up in forward
+ * evaluation:
+ * - float halves the memory traffic for the derivative vector, at the
+ *   price of single-precision sums,
+ * - KahanSum and DoubleDouble reduce the rounding errors of long sums,
+ * - long double sums with the 64-bit mantissa of the x87 format.
+ */
+
+/*! Double with compensated (Kahan) summation.
+ *
+ * The rounding error of every addition is kept in a second double and
+ * subtracted from the next summand.
+ */
+struct KahanSum {
+  double sum = 0.;
+  double c = 0.; //!< Negative rounding error of the sum.
+
+  KahanSum& operator=(double x){
+    sum = x;
+    c = 0.;
+    return *this;
+  }
+  KahanSum& operator+=(double x){
+    double y = x - c;
+    double t = sum + y;
+    c = (t - sum) - y;
+    sum = t;
+    return *this;
+  }
+  operator double() const { return sum - c; }
+};
+
+/*! Unevaluated sum hi+lo of two doubles with |lo| <= ulp(hi)/2.
+ *
+ * Unlike KahanSum, the addition is also accurate if the summand is
+ * larger than the sum.
+ */
+struct DoubleDouble {
+  double hi = 0.;
+  double lo = 0.;
+
+  DoubleDouble& operator=(double x){
+    hi = x;
+    lo = 0.;
+    return *this;
+  }
+  DoubleDouble& operator+=(double x){
+    // two-sum: s+e == hi+x exactly
+    double s = hi + x;
+    double b = s - hi;
+    double e = (hi - (s - b)) + (x - b);
+    e += lo;
+    // renormalize
+    hi = s + e;
+    lo = e - (hi - s);
+    return *this;
+  }
+  operator double() const { return hi + lo; }
+};
+
+/*! \enum DerivativePrecision
+ * Type of the entries of the derivative vector.
+ */
+enum DerivativePrecision {
+  DoublePrecision,
+  FloatPrecision,
+  KahanPrecision,
+  LongDoublePrecision,
+  DoubleDoublePrecision
+};
+
+/*! Parse the name of a DerivativePrecision.
+ *
+ * \param name One of double, float, kahan, long-double, double-double.
+ * \param precision Set to the corresponding precision.
+ * \returns False if the name is unknown.
+ */
+inline bool parsePrecision(std::string const& name, DerivativePrecision& precision){
+  if(name=="double") precision = DoublePrecision;
+  else if(name=="float") precision = FloatPrecision;
+  else if(name=="kahan") precision = KahanPrecision;
+  else if(name=="long-double") precision = LongDoublePrecision;
+  else if(name=="double-double") precision = DoubleDoublePrecision;
+  else return false;
+  return true;
+}
+
+/*! Call fun(T()) with the type T of the entries of the derivative vector.
+ */
+template<typename fun_t>
+void dispatchPrecision(DerivativePrecision precision, fun_t fun){
+  switch(precision){
+    case FloatPrecision: fun(float()); break;
+    case KahanPrecision: fun(KahanSum()); break;
+    case LongDoublePrecision: fun((long double)0.); break;
+    case DoubleDoublePrecision: fun(DoubleDouble()); break;
+    default: fun(double()); break;
+  }
+}
+
+#endif
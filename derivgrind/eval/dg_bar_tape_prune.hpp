@@ -0,0 +1,169 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_prune.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_prune.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_PRUNE_HPP
+#define DG_BAR_TAPE_PRUNE_HPP
+
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+#include "dg_bar_tape_eval.hpp"
+
+/*! \file dg_bar_tape_prune.hpp
+ * Removal of statements that do not contribute to derivatives of the
+ * outputs with respect to the inputs.
+ *
+ * A forward sweep marks the results of statements that depend on an input
+ * as active. A backward sweep then marks active results as useful if they
+ * are an output or an operand of a useful statement. The pruned tape
+ * consists of the useful statements and all inputs, with consecutive
+ * indices, in the raw format. Outputs that do not depend on any input
+ * get the index 0.
+ */
+
+/*! Writes statements with consecutive indices to a raw tape.
+ */
+class RawTapeWriter {
+  using ull = unsigned long long;
+  std::ostream& tapefile;
+  std::vector<ull> blocks; //!< Blocks that have not been written yet.
+  ull nextindex = 1;
+
+  ull addBlock(ull index1, ull index2, double diff1, double diff2){
+    ull bits1, bits2;
+    std::memcpy(&bits1, &diff1, sizeof(double));
+    std::memcpy(&bits2, &diff2, sizeof(double));
+    blocks.push_back(index1);
+    blocks.push_back(index2);
+    blocks.push_back(bits1);
+    blocks.push_back(bits2);
+    if(blocks.size() >= 4*4096) flush();
+    return nextindex++;
+  }
+
+public:
+  //! Write the dummy block.
+  RawTapeWriter(std::ostream& tapefile) : tapefile(tapefile), blocks(4, 0) {}
+  ~RawTapeWriter(){ flush(); }
+
+  void flush(){
+    tapefile.write(reinterpret_cast<char const*>(blocks.data()), blocks.size()*sizeof(ull));
+    blocks.clear();
+  }
+
+  /*! Append a statement, split into a chain of two-operand blocks if necessary.
+   * \returns Index of the result.
+   */
+  ull addStatement(ull n, ull const* indices, double const* diffs){
+    ull result = addBlock(n>0 ? indices[0] : 0, n>1 ? indices[1] : 0, n>0 ? diffs[0] : 0., n>1 ? diffs[1] : 0.);
+    for(ull j=2; j<n; j++){
+      result = addBlock(result, indices[j], 1., diffs[j]);
+    }
+    return result;
+  }
+
+  //! Number of blocks, including the dummy block.
+  ull number_of_blocks() const { return nextindex; }
+};
+
+/*! Write a pruned copy of a tape.
+ *
+ * \param tape Tape whose statements produce the index of their position,
+ *   i.e. not recorded with --index-reuse=yes or --per-thread-tapes=yes.
+ * \param number_of_blocks Number of statements on the tape.
+ * \param inputindices Indices of the inputs, replaced by their indices on the pruned tape.
+ * \param outputindices Indices of the outputs, replaced by their indices on the pruned tape.
+ * \param tapefile Stream to which the pruned raw tape is written.
+ * \returns Number of blocks of the pruned tape, including the dummy block.
+ */
+template<typename tape_t>
+unsigned long long pruneTape(tape_t& tape, unsigned long long number_of_blocks, std::vector<unsigned long long>& inputindices, std::vector<unsigned long long>& outputindices, std::ostream& tapefile){
+  using ull = unsigned long long;
+  std::vector<char> active(number_of_blocks, 0), useful(number_of_blocks, 0);
+  for(ull index : inputindices){
+    if(validIndex(index)) active[index] = useful[index] = 1;
+  }
+  tape.iterate(0, number_of_blocks-1, [&active](ull index, ull n, ull const* indices, double const* diffs){
+    for(ull j=0; j<n; j++){
+      if(validIndex(indices[j]) && active[indices[j]]) active[index] = 1;
+    }
+  });
+  for(ull index : outputindices){
+    if(validIndex(index) && active[index]) useful[index] = 1;
+  }
+  tape.iterate(number_of_blocks-1, 0, [&active,&useful](ull index, ull n, ull const* indices, double const* diffs){
+    if(!useful[index]) return;
+    for(ull j=0; j<n; j++){
+      if(validIndex(indices[j]) && active[indices[j]]) useful[indices[j]] = 1;
+    }
+  });
+
+  // write the useful statements
+  std::vector<ull> newindex(number_of_blocks, 0);
+  RawTapeWriter writer(tapefile);
+  std::vector<ull> operands;
+  std::vector<double> partials;
+  tape.iterate(0, number_of_blocks-1, [&](ull index, ull n, ull const* indices, double const* diffs){
+    if(!useful[index]) return;
+    operands.clear();
+    partials.clear();
+    for(ull j=0; j<n; j++){
+      if(validIndex(indices[j]) && useful[indices[j]]){
+        operands.push_back(newindex[indices[j]]);
+        partials.push_back(diffs[j]);
+      }
+    }
+    newindex[index] = writer.addStatement(operands.size(), operands.data(), partials.data());
+  });
+  writer.flush();
+
+  for(ull& index : inputindices) index = validIndex(index) ? newindex[index] : 0;
+  for(ull& index : outputindices) index = validIndex(index) ? newindex[index] : 0;
+  return writer.number_of_blocks();
+}
+
+#endif
@@ -0,0 +1,223 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_renumber.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_renumber.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_RENUMBER_HPP
+#define DG_BAR_TAPE_RENUMBER_HPP
+
+#include <fstream>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "dg_bar_tape_eval.hpp"
+#include "dg_bar_tape_compact.hpp"
+
+/*! \file dg_bar_tape_renumber.hpp
+ * Renumbering of indices, so that the derivative vector only needs to
+ * hold the variables that are live at the same time.
+ *
+ * A reverse sweep determines, for every operand, whether the statement
+ * is its last use, and whether a result is never used. A forward sweep
+ * then assigns new indices like a register allocator: The index of a
+ * variable is released after its last use and handed out to the next
+ * result. Inputs get the indices 1, 2, ... and outputs keep their index
+ * until the end of the tape. The renumbered tape is written in the
+ * compact format with the DG_TAPE_FLAG_EXPLICIT_LHS flag, as if it had
+ * been recorded with --index-reuse=yes.
+ *
+ * Both sweeps stream the tape. Besides the live variables, one bit per
+ * statement and a scratch file with one byte per operand and statement
+ * are needed.
+ */
+
+/*! Scratch file of bytes that are read back in reverse order.
+ */
+class ReversedByteFile {
+  using ull = unsigned long long;
+  static constexpr ull buffersize = 1ull<<20;
+  std::fstream file;
+  std::vector<unsigned char> buffer;
+  ull size = 0; //!< Number of bytes written to the file.
+  ull readpos; //!< Number of bytes in the file that have not been read yet.
+
+public:
+  //! Create the file, which is removed right away.
+  ReversedByteFile(std::string const& filename){
+    file.open(filename, std::ios::in|std::ios::out|std::ios::trunc|std::ios::binary);
+    if(!file.good()){
+      std::cerr << "Cannot create scratch file '" << filename << "'." << std::endl;
+      exit(1);
+    }
+    unlink(filename.c_str());
+  }
+
+  void write(unsigned char byte){
+    buffer.push_back(byte);
+    if(buffer.size()==buffersize){
+      file.write(reinterpret_cast<char const*>(buffer.data()), buffer.size());
+      size += buffer.size();
+      buffer.clear();
+    }
+  }
+
+  //! Return the bytes that have been written, starting with the last one.
+  unsigned char read(){
+    if(buffer.empty()){
+      ull count = std::min(buffersize, readpos);
+      readpos -= count;
+      buffer.resize(count);
+      file.seekg(readpos, std::ios::beg);
+      file.read(reinterpret_cast<char*>(buffer.data()), count);
+    }
+    unsigned char byte = buffer.back();
+    buffer.pop_back();
+    return byte;
+  }
+
+  //! Switch from writing to reading.
+  void rewind(){
+    readpos = size;
+  }
+};
+
+/*! Write a copy of a tape with renumbered indices.
+ *
+ * \param tape Tape whose statements produce the index of their position,
+ *   i.e. not recorded with --index-reuse=yes or --per-thread-tapes=yes.
+ * \param number_of_blocks Number of statements on the tape.
+ * \param inputindices Indices of the inputs, replaced by their indices on the new tape.
+ * \param outputindices Indices of the outputs, replaced by their indices on the new tape.
+ * \param tapefile Stream to which the new compact tape is written.
+ * \param scratchpath Path of a temporary scratch file.
+ * \returns Number of indices of the new tape, i.e. size of the derivative vector.
+ */
+template<typename tape_t>
+unsigned long long renumberTape(tape_t& tape, unsigned long long number_of_blocks, std::vector<unsigned long long>& inputindices, std::vector<unsigned long long>& outputindices, std::ostream& tapefile, std::string const& scratchpath){
+  using ull = unsigned long long;
+  std::unordered_set<ull> inputs, outputs;
+  for(ull index : inputindices){
+    if(validIndex(index)) inputs.insert(index);
+  }
+  for(ull index : outputindices){
+    if(validIndex(index)) outputs.insert(index);
+  }
+
+  // For every statement, store whether its result is unused, and for every
+  // operand whether this is its last use. Inputs do not depend on their operands.
+  ReversedByteFile lastuse(scratchpath);
+  std::vector<bool> used(number_of_blocks, false);
+  tape.iterate(number_of_blocks-1, 0, [&](ull index, ull n, ull const* indices, double const* diffs){
+    bool unused = !used[index] && outputs.count(index)==0;
+    bool input = inputs.count(index)>0;
+    for(ull j=n; j-->0; ){
+      bool last = !input && validIndex(indices[j]) && !used[indices[j]];
+      if(last) used[indices[j]] = true;
+      lastuse.write(last);
+    }
+    lastuse.write(unused);
+  });
+  lastuse.rewind();
+
+  std::unordered_map<ull,ull> newindex; // for live variables
+  std::vector<ull> released;
+  ull nextindex = 1;
+  for(ull index : inputindices){
+    if(validIndex(index) && newindex.count(index)==0) newindex[index] = nextindex++;
+  }
+  CompactTapeWriter writer(tapefile, true);
+  std::vector<ull> operands, releasing;
+  std::vector<double> partials;
+  tape.iterate(0, number_of_blocks-1, [&](ull index, ull n, ull const* indices, double const* diffs){
+    bool unused = lastuse.read();
+    operands.clear();
+    partials.clear();
+    releasing.clear();
+    bool input = inputs.count(index)>0;
+    for(ull j=0; j<n; j++){
+      bool last = lastuse.read();
+      if(input || !validIndex(indices[j])) continue;
+      auto it = newindex.find(indices[j]);
+      if(it==newindex.end()) continue; // result of a statement without operands
+      operands.push_back(it->second);
+      partials.push_back(diffs[j]);
+      if(last && inputs.count(indices[j])==0 && outputs.count(indices[j])==0) releasing.push_back(indices[j]);
+    }
+    for(ull old : releasing){
+      released.push_back(newindex[old]);
+      newindex.erase(old);
+    }
+    ull lhs;
+    if(input){
+      lhs = newindex[index];
+    } else if(operands.empty()){
+      lhs = 0; // the derivative of the result is zero
+    } else {
+      if(released.empty()){
+        lhs = nextindex++;
+      } else {
+        lhs = released.back();
+        released.pop_back();
+      }
+      if(unused) released.push_back(lhs);
+      else newindex[index] = lhs;
+    }
+    writer.addStatement(lhs, operands.size(), operands.data(), partials.data());
+  });
+  ull number_of_indices = writer.finish(nextindex);
+
+  for(ull& index : inputindices) index = validIndex(index) ? newindex[index] : 0;
+  for(ull& index : outputindices){
+    auto it = validIndex(index) ? newindex.find(index) : newindex.end();
+    index = (it!=newindex.end()) ? it->second : 0;
+  }
+  return number_of_indices;
+}
+
+#endif
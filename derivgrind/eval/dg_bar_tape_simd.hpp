@@ -0,0 +1,193 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_simd.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_simd.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_SIMD_HPP
+#define DG_BAR_TAPE_SIMD_HPP
+
+#include <string>
+#include <vector>
+
+#include "dg_bar_tape_eval.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DG_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/*! \file dg_bar_tape_simd.hpp
+ * Reverse evaluation with SIMD instructions.
+ *
+ * A loaded TapeChunk stores the operand indices and partial derivatives
+ * of consecutive statements in two separate arrays. The kernel proceeds
+ * in groups of consecutive statements, as many as fit into a vector
+ * register. If every statement of a group has two operands, they are
+ * loaded and deinterleaved into a vector of first and a vector of second
+ * operands. If furthermore no statement of the group uses the result of
+ * another one, the bar values of the group are loaded at once, multiplied
+ * with the partial derivatives, and added to the bar values of the
+ * operands. Otherwise, the group is evaluated statement by statement.
+ * Operands produced by unrecognized operations have indices larger than
+ * all results, so groups containing them take the latter path.
+ *
+ * The products are computed with AVX2 instructions and added one by one,
+ * in the same order as by the scalar code, so the results are identical.
+ * Scatters with AVX-512 were found to be slower than these additions.
+ * As the additions dominate and access the derivative vector at random,
+ * the kernel has not been found to be faster than the scalar code, and
+ * it is only used on request.
+ *
+ * Tapes recorded with --index-reuse=yes are not supported.
+ */
+
+/*! \enum SimdKernel
+ * Instruction set used by evaluateBackwardSimd.
+ */
+enum SimdKernel {
+  NoSimd,
+  Avx2Simd
+};
+
+/*! Whether the CPU supports a kernel.
+ */
+inline bool simdKernelSupported(SimdKernel kernel){
+#ifdef DG_SIMD_X86
+  if(kernel==Avx2Simd) return __builtin_cpu_supports("avx2");
+#endif
+  return kernel==NoSimd;
+}
+
+//! Reverse evaluation of the k-th statement of a chunk, like Tapefile::evaluateBackward.
+inline void evaluateStatementBackward(TapeChunk const& chunk, unsigned long long k, unsigned long long index, double* derivativevec){
+  double bar = derivativevec[index];
+  if(bar!=0){
+    for(unsigned long long j=chunk.begin[k]; j<chunk.begin[k+1]; j++){
+      if(chunk.indices[j] < 0x8000000000000000) derivativevec[chunk.indices[j]] += bar * chunk.diffs[j];
+    }
+  }
+}
+
+#ifdef DG_SIMD_X86
+/*! Reverse evaluation of count-many statements of a chunk, with AVX2.
+ *
+ * \param first Index of the result of the first statement.
+ */
+__attribute__((target("avx2")))
+inline void evaluateChunkBackwardAvx2(TapeChunk const& chunk, unsigned long long first, unsigned long long count, double* derivativevec){
+  const __m256i sign = _mm256_set1_epi64x(0x8000000000000000);
+  const __m256i two = _mm256_set1_epi64x(2);
+  alignas(32) unsigned long long operands1[4], operands2[4];
+  alignas(32) double bars[4], products1[4], products2[4];
+  unsigned long long const* begin = chunk.begin.data();
+  unsigned long long k = count;
+  while(k>=4){
+    unsigned long long g = k-4, lo = first+g;
+    // all statements have two operands
+    __m256i n = _mm256_sub_epi64(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(begin+g+1)), _mm256_loadu_si256(reinterpret_cast<__m256i const*>(begin+g)));
+    bool grouped = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(n, two)))==0xf;
+    __m256i i1, i2;
+    if(grouped){
+      unsigned long long const* p = chunk.indices.data()+begin[g];
+      __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+      __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p+4));
+      i1 = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xd8);
+      i2 = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xd8);
+      // no operand is the result of a statement of the group; unsigned comparison by flipping the sign bits
+      __m256i bound = _mm256_xor_si256(_mm256_set1_epi64x(lo), sign);
+      __m256i independent = _mm256_and_si256(_mm256_cmpgt_epi64(bound, _mm256_xor_si256(i1, sign)), _mm256_cmpgt_epi64(bound, _mm256_xor_si256(i2, sign)));
+      grouped = _mm256_movemask_pd(_mm256_castsi256_pd(independent))==0xf;
+    }
+    if(!grouped){
+      for(unsigned long long l=4; l-->0; ) evaluateStatementBackward(chunk, g+l, lo+l, derivativevec);
+      k = g;
+      continue;
+    }
+    double const* q = chunk.diffs.data()+begin[g];
+    __m256d a = _mm256_loadu_pd(q), b = _mm256_loadu_pd(q+4);
+    __m256d d1 = _mm256_permute4x64_pd(_mm256_unpacklo_pd(a, b), 0xd8);
+    __m256d d2 = _mm256_permute4x64_pd(_mm256_unpackhi_pd(a, b), 0xd8);
+    __m256d bar = _mm256_loadu_pd(derivativevec+lo);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(operands1), i1);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(operands2), i2);
+    _mm256_store_pd(bars, bar);
+    _mm256_store_pd(products1, _mm256_mul_pd(bar, d1));
+    _mm256_store_pd(products2, _mm256_mul_pd(bar, d2));
+    for(unsigned long long l=4; l-->0; ){
+      if(bars[l]==0) continue;
+      derivativevec[operands1[l]] += products1[l];
+      derivativevec[operands2[l]] += products2[l];
+    }
+    k = g;
+  }
+  while(k>0){
+    k--;
+    evaluateStatementBackward(chunk, k, first+k, derivativevec);
+  }
+}
+
+#endif
+
+/*! Reverse evaluation of a tape with SIMD instructions.
+ *
+ * \param tape Tape without explicitly stored results.
+ * \param number_of_blocks Number of statements on the tape.
+ * \param derivativevec Vector of bar values, see Tapefile::evaluateBackward.
+ * \param kernel Instruction set, which must be supported by the CPU.
+ */
+template<typename tape_t>
+void evaluateBackwardSimd(tape_t& tape, unsigned long long number_of_blocks, double* derivativevec, SimdKernel kernel){
+  using ull = unsigned long long;
+  tape.iterateChunks(number_of_blocks-1, 0, [derivativevec,kernel](TapeChunk const& chunk, ull first, ull count){
+    switch(kernel){
+#ifdef DG_SIMD_X86
+      case Avx2Simd: evaluateChunkBackwardAvx2(chunk, first, count, derivativevec); break;
+#endif
+      default:
+        for(ull k=count; k-->0; ) evaluateStatementBackward(chunk, k, first+k, derivativevec);
+    }
+  });
+}
+
+#endif
@@ -0,0 +1,258 @@
+/*
+   ----------------------------------------------------------------
+   Notice that the following MIT license applies to this one file
+   (dg_bar_tape_threads.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+
+   This file is part of Derivgrind, an automatic differentiation
+   tool applicable to compiled programs.
+
+   Copyright (C) 2022, Chair for Scientific Computing, TU Kaiserslautern
+   Copyright (C) since 2023, Chair for Scientific Computing, University of Kaiserslautern-Landau
+   Homepage: https://www.scicomp.uni-kl.de
+   Contact: Prof. Nicolas R. Gauger (derivgrind@projects.rptu.de)
+
+   Lead developer: Max Aehle
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+   ----------------------------------------------------------------
+   Notice that the above MIT license applies to this one file
+   (dg_bar_tape_threads.hpp) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+   ----------------------------------------------------------------
+*/
+
+#ifndef DG_BAR_TAPE_THREADS_HPP
+#define DG_BAR_TAPE_THREADS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../bar/dg_bar_tape_format.h"
+#include "dg_bar_tape_eval.hpp"
+#include "dg_bar_tape_mapping.hpp"
+
+/*! \file dg_bar_tape_threads.hpp
+ * Evaluation of tapes recorded with --per-thread-tapes=yes.
+ *
+ * Every recorded thread has its own raw tape, and dg-tape-order splits
+ * the recording into segments of statements of a single thread. Segments
+ * of different threads whose adjoints or dot values do not overlap are
+ * evaluated concurrently, one evaluation thread per recorded thread.
+ */
+
+/*! Derivative vector for indices recorded with --per-thread-tapes=yes.
+ *
+ * The indices of each thread are stored contiguously. Index 0 can always
+ * be accessed, even if no statements have been recorded.
+ */
+class ThreadIndexedVector {
+  using ull = unsigned long long;
+  std::vector<ull> base; //!< Offset of the indices of thread t at position t-1.
+  std::vector<ull> sizes; //!< Number of indices of thread t at position t-1.
+  std::vector<double> data;
+
+public:
+  //! \param sizes Number of indices of thread t at position t-1.
+  ThreadIndexedVector(std::vector<ull> const& sizes) : base(std::max<std::size_t>(sizes.size(), 1), 0), sizes(sizes) {
+    ull total = 0;
+    for(ull t=0; t<sizes.size(); t++){
+      base[t] = total;
+      total += sizes[t];
+    }
+    data.assign(std::max<ull>(total, 1), 0.);
+  }
+  //! Whether the index belongs to a statement of a recorded thread.
+  bool contains(ull index) const {
+    ull t = index>>DG_TAPE_THREAD_SHIFT;
+    return t<sizes.size() && (index & DG_TAPE_THREAD_MASK)<sizes[t];
+  }
+  double& operator[](ull index){
+    return data[base[index>>DG_TAPE_THREAD_SHIFT] + (index & DG_TAPE_THREAD_MASK)];
+  }
+  double const& operator[](ull index) const {
+    return data[base[index>>DG_TAPE_THREAD_SHIFT] + (index & DG_TAPE_THREAD_MASK)];
+  }
+};
+
+/*! Loads blocks from the mapped raw tape of a single thread.
+ */
+struct RawTapeLoader {
+  using ull = unsigned long long;
+  MappedTape* mapped;
+  void operator()(ull i, ull count, TapeChunk& chunk){
+    mapped->load(i, count, chunk);
+  }
+};
+
+/*! Tapes of all threads of a recording, and the order of their segments.
+ */
+template<unsigned long long bufsize>
+class ThreadTapes {
+  using ull = unsigned long long;
+  using tape_t = Tapefile<bufsize,RawTapeLoader>;
+
+  //! Consecutive statements recorded by a single thread.
+  struct Segment {
+    ull thread; //!< Position of the thread in tapes.
+    ull begin, end; //!< Block positions on the thread's tape, end excluded.
+    ull bits; //!< Bit t%64 is set for every thread t whose derivatives are accessed.
+  };
+
+  std::vector<ull> tids; //!< Valgrind thread numbers of the recorded threads.
+  std::vector<std::unique_ptr<MappedTape>> mappings;
+  std::vector<std::unique_ptr<tape_t>> tapes;
+  std::vector<ull> sizes; //!< Number of blocks of thread t at position t-1.
+  std::vector<Segment> segments; //!< In recording order.
+
+  /*! For every segment and every other thread, determine the segment of that
+   *  thread that must be evaluated before, or -1.
+   *
+   * Segments conflict if their bits overlap. A thread evaluates its segments
+   * in order, so it suffices to wait for the nearest conflicting segment.
+   */
+  std::vector<ull> dependencies(bool forward) const {
+    ull nthreads = tids.size(), nsegments = segments.size();
+    std::vector<ull> deps(nsegments*nthreads, ull(-1));
+    // nearest[u*64+b] is the nearest segment of thread u with bit b seen so far
+    std::vector<ull> nearest(nthreads*64, ull(-1));
+    for(ull k=0; k<nsegments; k++){
+      ull s = forward ? k : nsegments-1-k;
+      Segment const& seg = segments[s];
+      for(ull u=0; u<nthreads; u++){
+        if(u==seg.thread) continue;
+        ull dep = ull(-1);
+        for(ull b=0; b<64; b++){
+          if(!(seg.bits & (1ull<<b))) continue;
+          ull cand = nearest[u*64+b];
+          if(cand!=ull(-1) && (dep==ull(-1) || (forward ? cand>dep : cand<dep))) dep = cand;
+        }
+        deps[s*nthreads+u] = dep;
+      }
+      for(ull b=0; b<64; b++){
+        if(seg.bits & (1ull<<b)) nearest[seg.thread*64+b] = s;
+      }
+    }
+    return deps;
+  }
+
+  template<typename fun_t>
+  void evaluate(bool forward, fun_t fun){
+    ull nthreads = tids.size(), nsegments = segments.size();
+    std::vector<ull> deps = dependencies(forward);
+    std::unique_ptr<std::atomic<bool>[]> done(new std::atomic<bool>[nsegments]);
+    for(ull s=0; s<nsegments; s++) done[s] = false;
+    std::vector<std::thread> workers;
+    for(ull t=0; t<nthreads; t++){
+      workers.emplace_back([this,t,forward,nthreads,nsegments,&deps,&done,&fun](){
+        for(ull k=0; k<nsegments; k++){
+          ull s = forward ? k : nsegments-1-k;
+          if(segments[s].thread!=t) continue;
+          for(ull u=0; u<nthreads; u++){
+            ull dep = deps[s*nthreads+u];
+            if(dep!=ull(-1)){
+              while(!done[dep].load(std::memory_order_acquire)) std::this_thread::yield();
+            }
+          }
+          fun(*tapes[t], segments[s]);
+          done[s].store(true, std::memory_order_release);
+        }
+      });
+    }
+    for(std::thread& worker : workers) worker.join();
+  }
+
+public:
+  //! Check whether a recording has been made with --per-thread-tapes=yes.
+  static bool exists(std::string const& path){
+    return std::ifstream(path+"/dg-tape-order").good();
+  }
+
+  /*! \param path Recording directory.
+   * \param chunksize Number of statements loaded at once, see Tapefile::set_chunk_size.
+   * \param hugepages Whether to ask for transparent huge pages for the mapped tapes.
+   */
+  ThreadTapes(std::string const& path, ull chunksize=bufsize, bool hugepages=false){
+    std::ifstream orderfile(path+"/dg-tape-order", std::ios::binary);
+    ull record[4];
+    std::vector<ull> position; // position of tid in tids, or -1
+    while(orderfile.read(reinterpret_cast<char*>(record), sizeof(record))){
+      ull tid = record[0];
+      if(tid>=position.size()) position.resize(tid+1, ull(-1));
+      if(position[tid]==ull(-1)){
+        position[tid] = tids.size();
+        tids.push_back(tid);
+      }
+      segments.push_back({position[tid], record[1], record[2], record[3] | (1ull<<(tid%64))});
+    }
+    sizes.assign(position.size()>0 ? position.size()-1 : 0, 0);
+    for(ull t=0; t<tids.size(); t++){
+      std::string tapepath = path + (tids[t]==1 ? "/dg-tape" : "/dg-tape-"+std::to_string(tids[t]));
+      mappings.emplace_back(new MappedTape(tapepath, hugepages));
+      ull number_of_blocks = mappings.back()->number_of_blocks();
+      sizes[tids[t]-1] = number_of_blocks;
+      RawTapeLoader loader{mappings.back().get()};
+      tapes.emplace_back(new tape_t(loader, number_of_blocks, false, (tids[t]-1)<<DG_TAPE_THREAD_SHIFT));
+      tapes.back()->set_chunk_size(chunksize);
+    }
+  }
+
+  //! Derivative vector covering the indices of all threads, initialized with zeros.
+  ThreadIndexedVector derivativeVector() const {
+    return ThreadIndexedVector(sizes);
+  }
+
+  //! Reverse evaluation of all tapes.
+  void evaluateBackward(ThreadIndexedVector& derivativevec){
+    evaluate(false, [&derivativevec](tape_t& tape, Segment const& seg){
+      tape.evaluateBackward(derivativevec, seg.end-1, seg.begin);
+    });
+  }
+
+  //! Forward evaluation of all tapes.
+  void evaluateForward(ThreadIndexedVector& derivativevec){
+    evaluate(true, [&derivativevec](tape_t& tape, Segment const& seg){
+      tape.evaluateForward(derivativevec, seg.begin, seg.end-1);
+    });
+  }
+
+  //! Tape statistics summed over all threads, see Tapefile::stats.
+  void stats(ull& nZero, ull& nOne, ull& nTwo){
+    nZero = nOne = nTwo = 0;
+    for(auto& tape : tapes){
+      ull z, o, t;
+      tape->stats(z, o, t);
+      nZero += z; nOne += o; nTwo += t;
+    }
+  }
+};
+
+#endif
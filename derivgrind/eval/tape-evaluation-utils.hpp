@@ -52,6 +52,9 @@
 #include <string>
 #include <vector>
 #include <iomanip>
+#include <sstream>
+
+#include "../bar/dg_bar_tape_format.h"
 
 using ull = unsigned long long;
 
@@ -92,15 +95,72 @@ void writeToTextFile(std::string filename, std::vector<T> data){
   }
 }
 
+/*! Check whether a file is stored in the binary format of --index-format=binary,
+ *  see dg_bar_tape_format.h.
+ *  \param filename Relative or absolute path.
+ */
+inline bool isBinaryFile(std::string filename){
+  std::ifstream file(filename, std::ios::binary);
+  ull magic = 0;
+  file.read(reinterpret_cast<char*>(&magic), sizeof(ull));
+  return file.good() && magic==DG_BINARY_MAGIC;
+}
+
+/*! Read vector of 8-byte scalars from binary file.
+ *  \param filename Relative or absolute path.
+ *  \param columns If not null, the number of columns stored in the header is returned here.
+ *  \returns Vector of scalars stored in the binary file.
+ */
+template<typename T>
+std::vector<T> readFromBinaryFile(std::string filename, ull* columns=nullptr){
+  static_assert(sizeof(T)==8, "Binary files store 8-byte scalars.");
+  std::ifstream file(filename, std::ios::binary|std::ios::ate);
+  WARNING(!file.good(), "Error: while opening '"<<filename<<"'.")
+  ull size = file.tellg();
+  ull header[2] = {0,0};
+  file.seekg(0, std::ios::beg);
+  file.read(reinterpret_cast<char*>(header), DG_BINARY_HEADERSIZE);
+  WARNING(!file.good() || header[0]!=DG_BINARY_MAGIC, "Error: '"<<filename<<"' is not a binary index or derivative file.")
+  if(columns) *columns = header[1];
+  std::vector<T> result((size-DG_BINARY_HEADERSIZE)/sizeof(T));
+  file.read(reinterpret_cast<char*>(result.data()), result.size()*sizeof(T));
+  return result;
+}
+
+/*! Write vector of 8-byte scalars to binary file.
+ *  \param filename Relative or absolute path.
+ *  \param data Vector of scalars, with columns-many scalars per row.
+ *  \param columns Number of columns.
+ */
+template<typename T>
+void writeToBinaryFile(std::string filename, std::vector<T> const& data, ull columns){
+  static_assert(sizeof(T)==8, "Binary files store 8-byte scalars.");
+  std::ofstream file(filename, std::ios::binary);
+  WARNING(!file.good(), "Error: while opening '"<<filename<<"'.")
+  ull header[2] = {DG_BINARY_MAGIC, columns};
+  file.write(reinterpret_cast<char const*>(header), DG_BINARY_HEADERSIZE);
+  file.write(reinterpret_cast<char const*>(data.data()), data.size()*sizeof(T));
+}
+
+/*! Read vector of scalars from text or binary file.
+ *  \param filename Relative or absolute path.
+ *  \returns Vector of scalars stored in the file.
+ */
+template<typename T>
+std::vector<T> readFromFile(std::string filename){
+  return isBinaryFile(filename) ? readFromBinaryFile<T>(filename) : readFromTextFile<T>(filename);
+}
+
 /*! Read indices and gradients from text files and seed the gradient vector accordingly.
+ *  Each file may also be stored in the binary format, see isBinaryFile.
  *  \param filename_indices Relative or absolute path to text file containing indices.
  *  \param filename_gradients Relative or absolute path to text file containing dot or bar values.
  *  \param gradient_vector Gradient vector to be seeded.
  */
 template<typename Vector>
 void seedGradientVectorFromTextFile(std::string filename_indices, std::string filename_gradients, Vector& gradient_vector){
-  std::vector<ull> indices = readFromTextFile<ull>(filename_indices);
-  std::vector<double> gradients = readFromTextFile<double>(filename_gradients);
+  std::vector<ull> indices = readFromFile<ull>(filename_indices);
+  std::vector<double> gradients = readFromFile<double>(filename_gradients);
   WARNING(indices.size()!=gradients.size(),
           "Error: Sizes of '"<<filename_indices<<"' and '"<<filename_gradients<<"' mismatch.")
   for(unsigned int i=0; i<indices.size(); i++){
@@ -110,18 +170,91 @@ void seedGradientVectorFromTextFile(std::string filename_indices, std::string fi
 
 /*! Read indices from a text file, extract the corresponding derivatives
  *  from the gradient vector, and write them to another text file.
+ *  If the indices are stored in a binary file, the derivatives are written in binary as well.
  *  \param filename_indices Relative or absolute path to text file containing indices.
  *  \param filename_gradients Relative or absolute path to text file in which gradients are to be stored.
  *  \param gradient_vector Gradient vector from which derivatives are to be extracted.
  */
 template<typename Vector>
 void readGradientVectorToTextFile(std::string filename_indices, std::string filename_gradients, Vector const& gradient_vector){
-  std::vector<ull> indices = readFromTextFile<ull>(filename_indices);
+  std::vector<ull> indices = readFromFile<ull>(filename_indices);
   std::vector<double> gradients(indices.size());
   for(unsigned int i=0; i<indices.size(); i++){
     gradients[i] = gradient_vector[indices[i]];
   }
-  writeToTextFile(filename_gradients, gradients);
+  if(isBinaryFile(filename_indices)){
+    writeToBinaryFile(filename_gradients, gradients, 1);
+  } else {
+    writeToTextFile(filename_gradients, gradients);
+  }
+}
+
+/*! Count the scalars in the first line of a text file, or read the number of columns from a binary file.
+ *  \param filename Relative or absolute path.
+ *  \returns Number of columns of the matrix stored in the text file.
+ */
+inline ull columnsOfTextFile(std::string filename){
+  if(isBinaryFile(filename)){
+    ull columns;
+    readFromBinaryFile<double>(filename, &columns);
+    return columns;
+  }
+  std::ifstream file(filename);
+  WARNING(!file.good(), "Error: while opening '"<<filename<<"'.")
+  std::string line;
+  std::getline(file, line);
+  std::istringstream linestream(line);
+  ull columns = 0;
+  double data;
+  while(linestream >> data) columns++;
+  return columns;
+}
+
+/*! Read indices and rows of gradients from text files and seed the gradient vector accordingly.
+ *  \param filename_indices Relative or absolute path to text file containing indices.
+ *  \param filename_gradients Relative or absolute path to text file containing a row of width-many dot or bar values per index.
+ *  \param gradient_vector Gradient vector to be seeded, storing width-many entries per index contiguously.
+ *  \param width Number of columns.
+ */
+inline void seedGradientMatrixFromTextFile(std::string filename_indices, std::string filename_gradients, double* gradient_vector, ull width){
+  std::vector<ull> indices = readFromFile<ull>(filename_indices);
+  std::vector<double> gradients = readFromFile<double>(filename_gradients);
+  WARNING(indices.size()*width!=gradients.size(),
+          "Error: Sizes of '"<<filename_indices<<"' and '"<<filename_gradients<<"' mismatch.")
+  for(unsigned int i=0; i<indices.size(); i++){
+    for(ull k=0; k<width; k++){
+      gradient_vector[indices[i]*width+k] += gradients[i*width+k];
+    }
+  }
+}
+
+/*! Read indices from a text file, extract the corresponding rows of derivatives
+ *  from the gradient vector, and write them to another text file.
+ *  If the indices are stored in a binary file, the derivatives are written in binary as well.
+ *  \param filename_indices Relative or absolute path to text file containing indices.
+ *  \param filename_gradients Relative or absolute path to text file in which gradients are to be stored.
+ *  \param gradient_vector Gradient vector storing width-many entries per index contiguously.
+ *  \param width Number of columns.
+ */
+inline void readGradientMatrixToTextFile(std::string filename_indices, std::string filename_gradients, double const* gradient_vector, ull width){
+  std::vector<ull> indices = readFromFile<ull>(filename_indices);
+  if(isBinaryFile(filename_indices)){
+    std::vector<double> gradients(indices.size()*width);
+    for(unsigned int i=0; i<indices.size(); i++){
+      for(ull k=0; k<width; k++){
+        gradients[i*width+k] = gradient_vector[indices[i]*width+k];
+      }
+    }
+    writeToBinaryFile(filename_gradients, gradients, width);
+    return;
+  }
+  std::ofstream file(filename_gradients);
+  WARNING(!file.good(), "Error: while opening '"<<filename_gradients<<"'.")
+  for(unsigned int i=0; i<indices.size(); i++){
+    for(ull k=0; k<width; k++){
+      file << std::setprecision(16) << gradient_vector[indices[i]*width+k] << (k+1<width ? " " : "\n");
+    }
+  }
 }
 
 #endif // TAPEEVALUATIONUTILS_HPP
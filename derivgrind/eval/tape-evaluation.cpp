@@ -62,13 +62,32 @@
  */
 
 #include "dg_bar_tape_eval.hpp"
+#include "dg_bar_tape_compact.hpp"
+#include "dg_bar_tape_mapping.hpp"
+#include "dg_bar_tape_threads.hpp"
+#include "dg_bar_tape_levels.hpp"
+#include "dg_bar_tape_prune.hpp"
+#include "dg_bar_tape_collapse.hpp"
+#include "dg_bar_tape_jacobian.hpp"
+#include "dg_bar_tape_elimination.hpp"
+#include "dg_bar_tape_outofcore.hpp"
+#include "dg_bar_tape_precision.hpp"
+#include "dg_bar_tape_renumber.hpp"
+#include "dg_bar_tape_simd.hpp"
+#include "dg_bar_tape_codipack.hpp"
 #include "tape-evaluation-utils.hpp"
 
-// Chunks with bufsize-many blocks are loaded from the tape file into the heap.
-static constexpr ull bufsize = 100;
+// --codipack is available if Derivgrind has been configured with --enable-codipack.
+#ifdef DG_WITH_CODIPACK
+#include <codi.hpp>
+#endif
+
+// Chunks with bufsize-many blocks are loaded from the tape file into the heap,
+// unless another chunk size is specified with --chunk-size=n.
+static constexpr ull bufsize = 4096;
 
 // In order to run a performance measurement, set measure_evaluation_time
-// to true and make bufsize large enough so only a single chunk is loaded.
+// to true and make the chunk size large enough so only a single chunk is loaded.
 static constexpr bool measure_evaluation_time = false;
 static std::chrono::steady_clock::time_point tbegin;
 static std::chrono::steady_clock::time_point tend = tbegin;
@@ -93,21 +112,121 @@ int main(int argc, char* argv[]){
 
   // open tape file
   if(argc<2){ // too few arguments
-    std::cerr << "Usage: " << argv[0] << " path [--stats|--forward|--print]" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " path [--stats|--forward|--print|--prune newpath|--collapse newpath|--renumber newpath|--sparse-jacobian|--jacobian[=markowitz|=forward|=reverse]] [--tape-fd=n] [--chunk-size=n] [--huge-pages] [--threads=n] [--read-ahead=n] [--out-of-core[=n]] [--precision=float|double|kahan|long-double|double-double] [--simd] [--codipack]" << std::endl;
     return 1;
   }
   std::string path = argv[1];
-  std::ifstream tapefile(path+"/dg-tape",std::ios::binary);
-  WARNING(!tapefile.good(), "Cannot open tape file '"<<argv[1]<<"/dg-tape'.")
-  tapefile.seekg(0,std::ios::end);
-  ull number_of_blocks = tapefile.tellg() / 32; // number of entries
-
-  auto loadfun = [&tapefile](ull i, ull count, ull* tape_buf) -> void {
-    tapefile.seekg(i*4*sizeof(double), std::ios::beg);
-    tapefile.read(reinterpret_cast<char*>(tape_buf), count*4*sizeof(double));
+  // a tape passed as an inherited file descriptor replaces path/dg-tape
+  int tapefd = -1;
+  ull chunksize = bufsize;
+  bool hugepages = false; // ask for transparent huge pages for the mapped tape
+  unsigned nthreads = 1; // number of threads evaluating the levels of the tape
+  ull read_ahead = 0; // number of chunks loaded ahead of the evaluation by a reader thread
+  ull segment_size = 0; // if non-zero, keep the derivative vector in a scratch file and evaluate segments of this size
+  DerivativePrecision precision = DoublePrecision; // type of the entries of the derivative vector
+  SimdKernel simd = NoSimd; // instruction set for the reverse evaluation
+  bool codipack = false; // convert the tape into a CoDiPack tape and let CoDiPack evaluate it
+  for(int i=2; i<argc; i++){
+    std::string arg = argv[i];
+    if(arg.rfind("--tape-fd=",0)==0){
+      tapefd = std::stoi(arg.substr(10));
+    } else if(arg.rfind("--chunk-size=",0)==0){
+      chunksize = std::stoull(arg.substr(13));
+    } else if(arg=="--huge-pages"){
+      hugepages = true;
+    } else if(arg.rfind("--threads=",0)==0){
+      nthreads = std::stoul(arg.substr(10));
+    } else if(arg.rfind("--read-ahead=",0)==0){
+      read_ahead = std::stoull(arg.substr(13));
+    } else if(arg=="--out-of-core"){
+      segment_size = 1048576;
+    } else if(arg.rfind("--out-of-core=",0)==0){
+      segment_size = std::stoull(arg.substr(14));
+    } else if(arg.rfind("--precision=",0)==0){
+      WARNING(!parsePrecision(arg.substr(12), precision), "Unknown precision '"<<arg.substr(12)<<"'.")
+    } else if(arg=="--simd"){
+      simd = Avx2Simd;
+      WARNING(!simdKernelSupported(simd), "The CPU does not support AVX2.")
+    } else if(arg=="--codipack"){
+#ifndef DG_WITH_CODIPACK
+      WARNING(true, "tape-evaluation has been compiled without CoDiPack.")
+#endif
+      codipack = true;
+    } else {
+      continue;
+    }
+    for(int j=i; j<argc-1; j++) argv[j] = argv[j+1];
+    argc--; i--;
+  }
+  bool forward = false; // if true, perform forward evaluation of tape instead of reverse evaluation
+  if(argc>=3 && std::string(argv[2])=="--forward"){
+    forward = true;
+  }
+
+  // tapes recorded with --per-thread-tapes=yes are evaluated concurrently
+  if(tapefd<0 && ThreadTapes<bufsize>::exists(path)){
+    ThreadTapes<bufsize> tapes(path, chunksize, hugepages);
+    if(argc>=3 && std::string(argv[2])=="--stats"){
+      unsigned long long nZero, nOne, nTwo;
+      tapes.stats(nZero,nOne,nTwo);
+      std::cout << nZero << " " << nOne << " " << nTwo << std::endl;
+      exit(0);
+    }
+    WARNING(argc>=3 && (std::string(argv[2])=="--print" || std::string(argv[2])=="--prune" || std::string(argv[2])=="--collapse" || std::string(argv[2])=="--renumber" || std::string(argv[2])=="--sparse-jacobian" || std::string(argv[2]).rfind("--jacobian",0)==0), "Printing, pruning, collapsing or renumbering per-thread tapes and their Jacobians are not supported.")
+    WARNING(segment_size>0, "Out-of-core evaluation of per-thread tapes is not supported.")
+    WARNING(precision!=DoublePrecision, "Evaluating per-thread tapes with another precision is not supported.")
+    WARNING(simd!=NoSimd, "SIMD evaluation of per-thread tapes is not supported.")
+    WARNING(codipack, "Converting per-thread tapes into CoDiPack tapes is not supported.")
+    WARNING(columnsOfTextFile(path+(forward ? "/dg-input-dots" : "/dg-output-bars"))>1, "Several columns of seeds are not supported for per-thread tapes.")
+    ThreadIndexedVector derivativevec = tapes.derivativeVector();
+    for(std::string file : {"/dg-input-indices", "/dg-output-indices"}){
+      for(ull index : readFromFile<ull>(path+file)){
+        WARNING(index!=0 && !derivativevec.contains(index), "Index "<<index<<" in '"<<path+file<<"' does not belong to a recorded thread.")
+      }
+    }
+    if(forward){
+      seedGradientVectorFromTextFile(path+"/dg-input-indices", path+"/dg-input-dots", derivativevec);
+      tapes.evaluateForward(derivativevec);
+      readGradientVectorToTextFile(path+"/dg-output-indices", path+"/dg-output-dots", derivativevec);
+    } else {
+      seedGradientVectorFromTextFile(path+"/dg-output-indices", path+"/dg-output-bars", derivativevec);
+      tapes.evaluateBackward(derivativevec);
+      readGradientVectorToTextFile(path+"/dg-input-indices", path+"/dg-input-bars", derivativevec);
+    }
+    return 0;
+  }
+
+  std::string tapepath = (tapefd>=0) ? tapePathFromFd(tapefd) : path+"/dg-tape";
+  std::ifstream tapefile(tapepath,std::ios::binary);
+  WARNING(!tapefile.good(), "Cannot open tape file '"<<tapepath<<"'.")
+  // tapes recorded with --tape-format=compact are decoded on the fly
+  CompactTapeReader* compact = CompactTapeReader::isCompact(tapefile) ? new CompactTapeReader(tapefile) : nullptr;
+  // raw tapes are mapped
+  MappedTape* mapped = nullptr;
+  if(!compact){
+    mapped = (tapefd>=0) ? new MappedTape(tapefd, hugepages) : new MappedTape(tapepath, hugepages);
+  }
+  ull number_of_blocks; // number of entries
+  ull number_of_indices; // size of the derivative vector
+  if(compact){
+    number_of_blocks = compact->number_of_blocks();
+    number_of_indices = compact->number_of_indices();
+  } else {
+    number_of_blocks = mapped->number_of_blocks();
+    number_of_indices = number_of_blocks;
+  }
+
+  auto loadfun = [compact,mapped](ull i, ull count, TapeChunk& chunk) -> void {
+    if(compact){
+      compact->load(i, count, chunk);
+    } else {
+      mapped->load(i, count, chunk);
+    }
   };
 
-  Tapefile<bufsize,decltype(loadfun),eventhandler>* tape = new Tapefile<bufsize,decltype(loadfun),eventhandler>(loadfun, number_of_blocks);
+  Tapefile<bufsize,decltype(loadfun),eventhandler>* tape = new Tapefile<bufsize,decltype(loadfun),eventhandler>(loadfun, number_of_blocks, compact && compact->explicit_lhs());
+  tape->set_chunk_size(chunksize);
+  tape->set_read_ahead(read_ahead);
 
   if(argc>=3 && std::string(argv[2])=="--stats"){
     unsigned long long nZero, nOne, nTwo;
@@ -116,56 +235,238 @@ int main(int argc, char* argv[]){
     exit(0);
   }
 
+  // write a tape without the statements that do not connect inputs and outputs,
+  // or with chains of statements collapsed, to newpath
+  if(argc>=4 && (std::string(argv[2])=="--prune" || std::string(argv[2])=="--collapse" || std::string(argv[2])=="--renumber")){
+    std::string mode = argv[2];
+    WARNING(compact && compact->explicit_lhs(), "Pruning, collapsing or renumbering tapes recorded with --index-reuse=yes is not supported.")
+    std::string newpath = argv[3];
+    std::vector<ull> inputindices = readFromFile<ull>(path+"/dg-input-indices");
+    std::vector<ull> outputindices = readFromFile<ull>(path+"/dg-output-indices");
+    std::ofstream newtapefile(newpath+"/dg-tape", std::ios::binary);
+    WARNING(!newtapefile.good(), "Cannot open tape file '"<<newpath<<"/dg-tape'.")
+    ull number_of_new_blocks = 0, number_of_new_indices = 0;
+    if(mode=="--prune"){
+      number_of_new_blocks = pruneTape(*tape, number_of_blocks, inputindices, outputindices, newtapefile);
+    } else if(mode=="--collapse"){
+      number_of_new_blocks = collapseTape(*tape, number_of_blocks, inputindices, outputindices, newtapefile);
+    } else {
+      number_of_new_indices = renumberTape(*tape, number_of_blocks, inputindices, outputindices, newtapefile, newpath+"/dg-renumber-scratch");
+    }
+    for(std::string name : {"/dg-input-indices", "/dg-output-indices"}){
+      std::vector<ull> const& indices = (name=="/dg-input-indices") ? inputindices : outputindices;
+      if(isBinaryFile(path+name)){
+        writeToBinaryFile(newpath+name, indices, 1);
+      } else {
+        writeToTextFile(newpath+name, indices);
+      }
+    }
+    if(mode=="--renumber"){
+      std::cout << "Renumbered tape has " << number_of_new_indices << " of " << number_of_indices << " indices." << std::endl;
+    } else {
+      std::cout << (mode=="--prune" ? "Pruned" : "Collapsed") << " tape has " << number_of_new_blocks << " of " << number_of_blocks << " blocks." << std::endl;
+    }
+    exit(0);
+  }
+
+  // detect the sparsity pattern and compute the Jacobian with compressed seeds
+  if(argc>=3 && std::string(argv[2])=="--sparse-jacobian"){
+    SparseJacobian<Tapefile<bufsize,decltype(loadfun),eventhandler>> jacobian(*tape, number_of_blocks, number_of_indices, compact && compact->explicit_lhs(),
+      readFromFile<ull>(path+"/dg-input-indices"), readFromFile<ull>(path+"/dg-output-indices"));
+    jacobian.writeMatrixMarket(path+"/dg-jacobian.mtx");
+    std::cout << jacobian.values.size() << " non-zero entries, " << jacobian.ncolors << " " << (jacobian.forward ? "forward" : "reverse") << " seeds." << std::endl;
+    exit(0);
+  }
+
+  // accumulate the Jacobian by vertex elimination, in forward tape order if there are at most as many
+  // inputs as outputs and in reverse tape order otherwise, unless the order is specified
+  if(argc>=3 && std::string(argv[2]).rfind("--jacobian",0)==0){
+    std::string arg = argv[2];
+    WARNING(arg!="--jacobian" && arg!="--jacobian=markowitz" && arg!="--jacobian=forward" && arg!="--jacobian=reverse", "Unknown elimination order '"<<arg.substr(11)<<"'.")
+    WARNING(compact && compact->explicit_lhs(), "Vertex elimination on tapes recorded with --index-reuse=yes is not supported.")
+    EliminationOrder order = (arg=="--jacobian=markowitz") ? MarkowitzOrder : (arg=="--jacobian=forward") ? ForwardOrder : (arg=="--jacobian=reverse") ? ReverseOrder : DefaultOrder;
+    EliminatedJacobian jacobian(*tape, number_of_blocks, readFromFile<ull>(path+"/dg-input-indices"), readFromFile<ull>(path+"/dg-output-indices"), order);
+    jacobian.writeMatrixMarket(path+"/dg-jacobian.mtx");
+    std::cout << jacobian.values.size() << " non-zero entries, " << jacobian.number_of_eliminations << " of " << jacobian.number_of_vertices << " vertices eliminated." << std::endl;
+    exit(0);
+  }
+
   if(argc>=3 && std::string(argv[2])=="--print"){
-    std::vector<ull> inputindices_vec = readFromTextFile<ull>(path+"/dg-input-indices");
+    std::vector<ull> inputindices_vec = readFromFile<ull>(path+"/dg-input-indices");
     std::set<ull> inputindices_set(inputindices_vec.begin(), inputindices_vec.end());
-    std::vector<ull> outputindices_vec = readFromTextFile<ull>(path+"/dg-output-indices");
+    std::vector<ull> outputindices_vec = readFromFile<ull>(path+"/dg-output-indices");
     std::set<ull> outputindices_set(outputindices_vec.begin(), outputindices_vec.end());
 
-    tape->iterate(0,number_of_blocks-1, [&inputindices_set,&outputindices_set](ull index, ull index1, ull index2, double diff1, double diff2){
-      std::cout << "|------------------|------------------|------------------|\n";
-      std::cout << "| " << std::setfill(' ') << std::setw(16) << std::hex << index;
-      std::cout << " | " << std::setfill(' ') << std::setw(16) << std::hex << index1;
-      std::cout << " | " << std::setfill(' ') << std::setw(16) << std::hex << index2 << " |\n";
-      bool is_input = inputindices_set.count(index);
-      bool is_output = outputindices_set.count(index);
-      if(index==0){
-        std::cout << "|            dummy | ";
-      } else if(is_input && is_output){
-        std::cout << "|     input/output | ";
-      } else if (is_input) {
-        std::cout << "|            input | ";
-      } else if (is_output) {
-        std::cout << "|           output | ";
-      } else {
-        std::cout << "|                  | ";
+    tape->iterate(0,number_of_blocks-1, [&inputindices_set,&outputindices_set](ull index, ull n, ull const* indices, double const* diffs){
+      // statements with more than two operands take several rows
+      for(ull j=0; j==0 || j<n; j+=2){
+        ull index1 = j<n ? indices[j] : 0, index2 = j+1<n ? indices[j+1] : 0;
+        double diff1 = j<n ? diffs[j] : 0., diff2 = j+1<n ? diffs[j+1] : 0.;
+        std::cout << "|------------------|------------------|------------------|\n";
+        if(j==0){
+          std::cout << "| " << std::setfill(' ') << std::setw(16) << std::hex << index;
+        } else {
+          std::cout << "|                 ";
+        }
+        std::cout << " | " << std::setfill(' ') << std::setw(16) << std::hex << index1;
+        std::cout << " | " << std::setfill(' ') << std::setw(16) << std::hex << index2 << " |\n";
+        bool is_input = inputindices_set.count(index);
+        bool is_output = outputindices_set.count(index);
+        if(j>0){
+          std::cout << "|                  | ";
+        } else if(index==0){
+          std::cout << "|            dummy | ";
+        } else if(is_input && is_output){
+          std::cout << "|     input/output | ";
+        } else if (is_input) {
+          std::cout << "|            input | ";
+        } else if (is_output) {
+          std::cout << "|           output | ";
+        } else {
+          std::cout << "|                  | ";
+        }
+        std::cout << std::setfill(' ') << std::setw(16) << std::scientific << diff1;
+        std::cout << " | " << std::setfill(' ') << std::setw(16) << std::scientific << diff2 << " |\n";
       }
-      std::cout << std::setfill(' ') << std::setw(16) << std::scientific << diff1;
-      std::cout << " | " << std::setfill(' ') << std::setw(16) << std::scientific << diff2 << " |\n";
     });
     std::cout << "|------------------|------------------|------------------|" << std::endl;
     exit(0);
   }
 
-  bool forward = false; // if true, perform forward evaluation of tape instead of reverse evaluation
-  if(argc>=3 && std::string(argv[2])=="--forward"){
-    forward = true;
+  // If dg-output-bars or dg-input-dots has several columns, evaluate for all of them at once.
+  ull width = columnsOfTextFile(path+(forward ? "/dg-input-dots" : "/dg-output-bars"));
+  if(width>1){
+    WARNING(segment_size>0, "Out-of-core evaluation with several columns of seeds is not supported.")
+    WARNING(precision!=DoublePrecision, "Evaluating several columns of seeds with another precision is not supported.")
+    WARNING(simd!=NoSimd, "SIMD evaluation with several columns of seeds is not supported.")
+    WARNING(codipack, "CoDiPack evaluation with several columns of seeds is not supported.")
+    double* derivativevec = new double[number_of_indices*width];
+    for(ull i=0; i<number_of_indices*width; i++){
+      derivativevec[i] = 0.;
+    }
+    if(forward){
+      seedGradientMatrixFromTextFile(path+"/dg-input-indices", path+"/dg-input-dots", derivativevec, width);
+      tape->evaluateForwardVector(derivativevec, width);
+      readGradientMatrixToTextFile(path+"/dg-output-indices", path+"/dg-output-dots", derivativevec, width);
+    } else {
+      seedGradientMatrixFromTextFile(path+"/dg-output-indices", path+"/dg-output-bars", derivativevec, width);
+      tape->evaluateBackwardVector(derivativevec, width);
+      readGradientMatrixToTextFile(path+"/dg-input-indices", path+"/dg-input-bars", derivativevec, width);
+    }
+    delete[] derivativevec;
+    delete compact;
+    delete mapped;
+    return 0;
+  }
+
+#ifdef DG_WITH_CODIPACK
+  // With --codipack, the statements are pushed onto a CoDiPack Jacobian tape, which is evaluated by CoDiPack.
+  if(codipack){
+    WARNING(nthreads>1 || segment_size>0 || precision!=DoublePrecision || simd!=NoSimd, "Multi-threaded, out-of-core, SIMD evaluation or another precision are not supported with CoDiPack.")
+    using Type = codi::RealReverse;
+    Type::Tape& codiTape = Type::getTape();
+    codiTape.setActive();
+    CoDiPackTape<Type> converted(*tape, number_of_blocks, number_of_indices, readFromFile<ull>(path+"/dg-input-indices"));
+    codiTape.setPassive();
+    if(forward){
+      seedGradientVectorFromTextFile(path+"/dg-input-indices", path+"/dg-input-dots", converted);
+      codiTape.evaluateForward();
+      readGradientVectorToTextFile(path+"/dg-output-indices", path+"/dg-output-dots", converted);
+    } else {
+      seedGradientVectorFromTextFile(path+"/dg-output-indices", path+"/dg-output-bars", converted);
+      codiTape.evaluate();
+      readGradientVectorToTextFile(path+"/dg-input-indices", path+"/dg-input-bars", converted);
+    }
+    delete compact;
+    delete mapped;
+    return 0;
+  }
+#endif
+
+  // With --precision, the derivative vector has entries of another type than double.
+  if(precision!=DoublePrecision){
+    WARNING(nthreads>1 || segment_size>0 || simd!=NoSimd, "Multi-threaded, out-of-core or SIMD evaluation with another precision is not supported.")
+    dispatchPrecision(precision, [&](auto zero){
+      std::vector<decltype(zero)> derivativevec(number_of_indices, zero);
+      if(forward){
+        seedGradientVectorFromTextFile(path+"/dg-input-indices", path+"/dg-input-dots", derivativevec);
+        tape->evaluateForward(derivativevec);
+        readGradientVectorToTextFile(path+"/dg-output-indices", path+"/dg-output-dots", derivativevec);
+      } else {
+        seedGradientVectorFromTextFile(path+"/dg-output-indices", path+"/dg-output-bars", derivativevec);
+        tape->evaluateBackward(derivativevec);
+        readGradientVectorToTextFile(path+"/dg-input-indices", path+"/dg-input-bars", derivativevec);
+      }
+    });
+    delete compact;
+    delete mapped;
+    return 0;
+  }
+
+  // With --threads=n, statements of the same level are evaluated concurrently.
+  // The levels are cached in dg-tape-levels. If all levels are too narrow to be
+  // shared among the threads, the tape is evaluated by the sequential sweep.
+  LevelScheduledTape* levels = nullptr;
+  if(nthreads>1){
+    WARNING(compact && compact->explicit_lhs(), "Multi-threaded evaluation of tapes recorded with --index-reuse=yes is not supported.")
+    levels = new LevelScheduledTape(*tape, number_of_blocks, nthreads, tapefd<0 ? path+"/dg-tape-levels" : "", tapepath);
+    if(levels->number_of_shared_levels()==0){
+      delete levels;
+      levels = nullptr;
+    }
+  }
+
+  // With --simd, the reverse evaluation processes independent statements with vector instructions.
+  if(simd!=NoSimd){
+    WARNING(compact && compact->explicit_lhs(), "SIMD evaluation of tapes recorded with --index-reuse=yes is not supported.")
+    WARNING(forward || nthreads>1 || segment_size>0, "SIMD evaluation is only supported for single-threaded in-memory reverse evaluation.")
+  }
+
+  // With --out-of-core=n, only the part of the derivative vector accessed by the current
+  // segment of n statements is held in memory. The segments are cached in dg-tape-segments.
+  SegmentedTape* segments = nullptr;
+  if(segment_size>0){
+    WARNING(compact && compact->explicit_lhs(), "Out-of-core evaluation of tapes recorded with --index-reuse=yes is not supported.")
+    WARNING(nthreads>1, "Out-of-core evaluation with several threads is not supported.")
+    segments = new SegmentedTape(*tape, number_of_blocks, segment_size, tapefd<0 ? path+"/dg-tape-segments" : "", tapepath);
   }
 
   // Initialize the derivative vector ("adjoint vector") storing the bar values, 
   // or dot values if the user specified --forward.
-  double* derivativevec = new double[number_of_blocks];
-  for(ull index=0; index<number_of_blocks; index++){
-    derivativevec[index] = 0.;
+  // For out-of-core evaluation, it is mapped from a scratch file.
+  ScratchVector* scratch = nullptr;
+  double* derivativevec;
+  if(segments){
+    scratch = new ScratchVector(path+"/dg-derivatives-scratch", number_of_indices);
+    derivativevec = scratch->data();
+  } else {
+    derivativevec = new double[number_of_indices];
+    for(ull index=0; index<number_of_indices; index++){
+      derivativevec[index] = 0.;
+    }
   }
 
   if(forward){
     seedGradientVectorFromTextFile(path+"/dg-input-indices", path+"/dg-input-dots", derivativevec);
-    tape->evaluateForward(derivativevec);
+    if(levels){
+      levels->evaluateForward(derivativevec);
+    } else if(segments){
+      segments->evaluateForward(*tape, derivativevec);
+    } else {
+      tape->evaluateForward(derivativevec);
+    }
     readGradientVectorToTextFile(path+"/dg-output-indices", path+"/dg-output-dots", derivativevec);
   } else {
     seedGradientVectorFromTextFile(path+"/dg-output-indices", path+"/dg-output-bars", derivativevec);
-    tape->evaluateBackward(derivativevec);
+    if(levels){
+      levels->evaluateBackward(derivativevec);
+    } else if(segments){
+      segments->evaluateBackward(*tape, derivativevec);
+    } else if(simd!=NoSimd){
+      evaluateBackwardSimd(*tape, number_of_blocks, derivativevec, simd);
+    } else {
+      tape->evaluateBackward(derivativevec);
+    }
     readGradientVectorToTextFile(path+"/dg-input-indices", path+"/dg-input-bars", derivativevec);
   }
 
@@ -175,6 +476,14 @@ int main(int argc, char* argv[]){
     timefile << time/1e6 << std::endl;
   }
 
-  delete[] derivativevec;
+  if(scratch){
+    delete scratch;
+  } else {
+    delete[] derivativevec;
+  }
+  delete segments;
+  delete levels;
+  delete compact;
+  delete mapped;
 }
 
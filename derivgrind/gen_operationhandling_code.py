@@ -246,8 +246,10 @@ def createBarCode(op, inputs, floatinputs, partials, value, fpsize,simdsize,llo)
     @param simdsize - Number of components, 1, 2, 4 or 8.
     @param llo - Whether it is a lowest-lane-only operation, boolean.
   """
-  # createBarCode calls applyComponentwisely with the proper input and output vectors and type conversions.
   assert(len(inputs) in [1,2,3])
+  if simdsize>1 and not llo:
+    return createBarCodeLanes(op, inputs, floatinputs, partials, value, fpsize, simdsize)
+  # createBarCode calls applyComponentwisely with the proper input and output vectors and type conversions.
   input_names = {}
   for i in inputs:
     input_names[f"arg{i}"] = f"arg{i}_part"
@@ -267,9 +269,11 @@ def createBarCode(op, inputs, floatinputs, partials, value, fpsize,simdsize,llo)
     bodyLowest += f'  IRExpr** indexIntHiLo_part = dg_bar_writeToTape(diffenv,i{inputs[0]}Lo_part,i{inputs[0]}Hi_part,IRExpr_Const(IRConst_U64(0)),IRExpr_Const(IRConst_U64(0)), {partials[0]}, IRExpr_Const(IRConst_F64(0.)), {value});\n  IRExpr* indexIntLo_part = indexIntHiLo_part[0];\n  IRExpr* indexIntHi_part = indexIntHiLo_part[1];\n'
   elif len(inputs)==2:
     bodyLowest += f'  IRExpr** indexIntHiLo_part = dg_bar_writeToTape(diffenv,i{inputs[0]}Lo_part,i{inputs[0]}Hi_part,i{inputs[1]}Lo_part,i{inputs[1]}Hi_part, {partials[0]}, {partials[1]}, {value});\n  IRExpr* indexIntLo_part = indexIntHiLo_part[0];\n  IRExpr* indexIntHi_part = indexIntHiLo_part[1];\n'
-  elif len(inputs)==3: # add two tape entries to combine three inputs
-    bodyLowest += f'  IRExpr** indexIntermediateIntHiLo_part = dg_bar_writeToTape(diffenv,i{inputs[0]}Lo_part,i{inputs[0]}Hi_part,i{inputs[1]}Lo_part,i{inputs[1]}Hi_part, {partials[0]}, {partials[1]}, IRExpr_Const(IRConst_F64(0.)));\n  IRExpr* indexIntermediateIntLo_part = indexIntermediateIntHiLo_part[0];\n  IRExpr* indexIntermediateIntHi_part = indexIntermediateIntHiLo_part[1];\n'
-    bodyLowest += f'  IRExpr** indexIntHiLo_part = dg_bar_writeToTape(diffenv,indexIntermediateIntLo_part,indexIntermediateIntHi_part,i{inputs[2]}Lo_part,i{inputs[2]}Hi_part, IRExpr_Const(IRConst_F64(1.)), {partials[2]}, {value});\n  IRExpr* indexIntLo_part = indexIntHiLo_part[0];\n  IRExpr* indexIntHi_part = indexIntHiLo_part[1];\n'
+  elif len(inputs)==3: # pass operands via staging buffer, as a dirty call takes at most six arguments
+    bodyLowest += f'  IRExpr* indexLoArray_part[3] = {{i{inputs[0]}Lo_part, i{inputs[1]}Lo_part, i{inputs[2]}Lo_part}};\n'
+    bodyLowest += f'  IRExpr* indexHiArray_part[3] = {{i{inputs[0]}Hi_part, i{inputs[1]}Hi_part, i{inputs[2]}Hi_part}};\n'
+    bodyLowest += f'  IRExpr* diffArray_part[3] = {{{partials[0]}, {partials[1]}, {partials[2]}}};\n'
+    bodyLowest += f'  IRExpr** indexIntHiLo_part = dg_bar_writeToTapeN(diffenv,3,indexLoArray_part,indexHiArray_part,diffArray_part, {value});\n  IRExpr* indexIntLo_part = indexIntHiLo_part[0];\n  IRExpr* indexIntHi_part = indexIntHiLo_part[1];\n'
   if llo:
     bodyNonLowest = f'  IRExpr* indexIntLo_part = i{inputs[0]}Lo_part;\n  IRExpr* indexIntHi_part = i{inputs[0]}Hi_part;\n'
   else:
@@ -281,6 +285,34 @@ def createBarCode(op, inputs, floatinputs, partials, value, fpsize,simdsize,llo)
   return barcode
 
 
+def createBarCodeLanes(op, inputs, floatinputs, partials, value, fpsize, simdsize):
+  """
+    Create C code that records all components of a SIMD operation on the tape with a single
+    dirty call, see dg_bar_writeToTapeLanes. Parameters are as for createBarCode.
+
+    Only the values of the operands are split into components, to compute the partial
+    derivatives; the index vectors are passed and returned as a whole.
+  """
+  n = len(inputs)
+  s = f"IRExpr* diffLanes[{n*simdsize}];\nIRExpr* valueLanes[{simdsize}];\n"
+  for component in range(simdsize):
+    s += "{\n"
+    for i in sorted(set(inputs)|set(floatinputs)):
+      s += f"  IRExpr* arg{i}_part = getSIMDComponent(arg{i},{fpsize},{simdsize},{component},diffenv);\n"
+      if fpsize==4:
+        s += f'  IRExpr* arg{i}_part_f = IRExpr_Unop(Iop_F32toF64,IRExpr_Unop(Iop_ReinterpI32asF32,arg{i}_part));\n'
+      else:
+        s += f'  IRExpr* arg{i}_part_f = IRExpr_Unop(Iop_ReinterpI64asF64,arg{i}_part);\n'
+    for k in range(n):
+      s += f"  diffLanes[{component*n+k}] = {partials[k]};\n"
+    s += f"  valueLanes[{component}] = {value};\n"
+    s += "}\n"
+  s += f"IRExpr* indexLoLanes[{n}] = {{{', '.join(f'i{i}Lo' for i in inputs)}}};\n"
+  s += f"IRExpr* indexHiLanes[{n}] = {{{', '.join(f'i{i}Hi' for i in inputs)}}};\n"
+  s += f"IRExpr** indexHiLo = dg_bar_writeToTapeLanes(diffenv,{n},{fpsize},{simdsize},typeOfIRExpr(diffenv->sb_out->tyenv,{op.apply()}),indexLoLanes,indexHiLanes,diffLanes,valueLanes);\n"
+  s += "IRExpr* indexLo = indexHiLo[0];\nIRExpr* indexHi = indexHiLo[1];\n"
+  return s
+
 def createTrickCode(op, activityinputs, floatinputs, resultIsDiscrete, fpsize,simdsize,llo):
   """
     Create C code that propagates bit-trick-finding flags separately 
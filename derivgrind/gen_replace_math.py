@@ -109,13 +109,13 @@ __attribute__((optimize("O0")))
       DG_SET_DOTVALUE(&ret, &ret_d, {self.size});
       DG_DISABLE(0,1);
     }} else if(DG_GET_MODE=='b') {{ /* recording mode */
-      unsigned long long x_i, y_i=0;
+      unsigned long long x_i;
       DG_GET_INDEX(&x, &x_i);
-      double x_pdiff, y_pdiff=0.;
+      double x_pdiff;
       x_pdiff = ({self.deriv});
       unsigned long long ret_i;
       DG_DISABLE(0,1);
-      DG_NEW_INDEX(&x_i,&y_i,&x_pdiff,&y_pdiff,&ret_i,&ret_d);
+      DG_NEW_INDEX_N(1,&x_i,&x_pdiff,&ret_i,&ret_d);
       DG_SET_INDEX(&ret,&ret_i);
     }} else if(DG_GET_MODE=='t') {{ /* bit-trick-finding mode */
       DG_DISABLE(0,1);
@@ -160,15 +160,15 @@ __attribute__((optimize("O0")))
       DG_SET_DOTVALUE(&ret, &ret_d, {self.size});
       DG_DISABLE(0,1);
     }} else if(DG_GET_MODE=='b') {{ /* recording mode */
-      unsigned long long x_i, y_i;
-      DG_GET_INDEX(&x,&x_i);
-      DG_GET_INDEX(&y,&y_i);
-      double x_pdiff, y_pdiff;
-      x_pdiff = ({self.derivX});
-      y_pdiff = ({self.derivY});
+      unsigned long long xy_i[2];
+      DG_GET_INDEX(&x,&xy_i[0]);
+      DG_GET_INDEX(&y,&xy_i[1]);
+      double xy_pdiff[2];
+      xy_pdiff[0] = ({self.derivX});
+      xy_pdiff[1] = ({self.derivY});
       unsigned long long ret_i;
       DG_DISABLE(0,1);
-      DG_NEW_INDEX(&x_i,&y_i,&x_pdiff,&y_pdiff,&ret_i,&ret_d);
+      DG_NEW_INDEX_N(2,xy_i,xy_pdiff,&ret_i,&ret_d);
       DG_SET_INDEX(&ret,&ret_i);
     }} else if(DG_GET_MODE=='t') {{ /* bit-trick-finding mode */
       DG_DISABLE(0,1);
@@ -216,13 +216,13 @@ __attribute__((optimize("O0")))
       DG_SET_DOTVALUE(&ret, &ret_d, {self.size});
       DG_DISABLE(0,1);
     }} else if(DG_GET_MODE=='b') {{ /* recording mode */
-      unsigned long long x_i, y_i=0;
+      unsigned long long x_i;
       DG_GET_INDEX(&x, &x_i);
-      double x_pdiff, y_pdiff=0.;
+      double x_pdiff;
       x_pdiff = ({self.deriv});
       unsigned long long ret_i;
       DG_DISABLE(0,1);
-      DG_NEW_INDEX(&x_i,&y_i,&x_pdiff,&y_pdiff,&ret_i,&ret_d);
+      DG_NEW_INDEX_N(1,&x_i,&x_pdiff,&ret_i,&ret_d);
       DG_SET_INDEX(&ret,&ret_i);
     }} else if(DG_GET_MODE=='t') {{ /* bit-trick-finding mode */
       DG_DISABLE(0,1);
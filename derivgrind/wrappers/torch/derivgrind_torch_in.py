@@ -125,12 +125,13 @@ def derivgrind(library,functionname,arch='amd64'):
       with open(tempdir.name+"/dg-libcaller-inputs", "wb") as input_buf:
         input.numpy().tofile(input_buf)
 
-      forward_process = subprocess.run([bin_path+"/valgrind", "--quiet", "--tool=derivgrind", "--record="+tempdir.name, libexec_path+"/valgrind/derivgrind-library-caller-"+arch+"_linux", library, functionname, fptype, str(len(params)), str(len(input)), str(noutput), tempdir.name])
+      # the tape is recorded into a memfd and never touches the file system
+      tapefd = os.memfd_create("dg-tape")
+      forward_process = subprocess.run([bin_path+"/valgrind", "--quiet", "--tool=derivgrind", "--record="+tempdir.name, "--tape-in-ram=yes", "--tape-fd="+str(tapefd), "--index-format=binary", libexec_path+"/valgrind/derivgrind-library-caller-"+arch+"_linux", library, functionname, fptype, str(len(params)), str(len(input)), str(noutput), tempdir.name], pass_fds=(tapefd,))
       
       with open(tempdir.name+"/dg-libcaller-outputs",'rb') as output_buf:
         output = torch.tensor(np.fromfile(output_buf, dtype=input.numpy().dtype, count=noutput))
-      with open(tempdir.name+"/dg-tape",'rb') as tape_buf:
-        ctx.tape = tape_buf.read()
+      ctx.tape = open(tapefd,'rb') # closes the memfd once it is no longer referenced
       with open(tempdir.name+"/dg-input-indices",'rb') as inputindices_buf:
         ctx.inputindices = inputindices_buf.read()
       with open(tempdir.name+"/dg-output-indices",'rb') as outputindices_buf:
@@ -147,26 +148,28 @@ def derivgrind(library,functionname,arch='amd64'):
 #      os.mkfifo(tempdir.name+"/dg-output-indices")
 #      os.mkfifo(tempdir.name+"/dg-input-bars")
 #      os.mkfifo(tempdir.name+"/dg-output-bars")
-      with open(tempdir.name+"/dg-tape","wb") as tape_buf:
-        tape_buf.write(ctx.tape)
       with open(tempdir.name+"/dg-input-indices","wb") as inputindices_buf:
         inputindices_buf.write(ctx.inputindices)
       with open(tempdir.name+"/dg-output-indices","wb") as outputindices_buf:
         outputindices_buf.write(ctx.outputindices)
       
-      with open(tempdir.name+"/dg-output-bars","w") as outputbars_buf:
-        outputbars_buf.writelines([str(float(bar))+"\n" for bar in grad_output])
+      # seeds and gradients are exchanged in the binary format, like the indices
+      with open(tempdir.name+"/dg-output-bars","wb") as outputbars_buf:
+        np.array([binary_magic,1],dtype=np.uint64).tofile(outputbars_buf)
+        np.asarray(grad_output.numpy(),dtype=np.float64).tofile(outputbars_buf)
 
-      backward_process = subprocess.run([bin_path+"/tape-evaluation", tempdir.name])
+      backward_process = subprocess.run([bin_path+"/tape-evaluation", tempdir.name, "--tape-fd="+str(ctx.tape.fileno())], pass_fds=(ctx.tape.fileno(),))
 
-      grad_input = torch.empty(ctx.ninput,dtype=grad_output.dtype)
-      with open(tempdir.name+"/dg-input-bars","r") as inputbars_buf:
-        for i in range(ctx.ninput):
-          grad_input[i] = float( inputbars_buf.readline().strip() )
+      with open(tempdir.name+"/dg-input-bars","rb") as inputbars_buf:
+        inputbars_buf.seek(binary_headersize)
+        grad_input = torch.tensor(np.fromfile(inputbars_buf, dtype=np.float64, count=ctx.ninput), dtype=grad_output.dtype)
         
       return (None,grad_input,None)
   
   return DerivgrindLibraryCaller
 
+# header of binary index and derivative files, see dg_bar_tape_format.h
+binary_magic = 0x3152414e49424744
+binary_headersize = 16
 bin_path = os.path.dirname(__file__)+"/../../../install/bin"
 libexec_path = os.path.dirname(__file__)+"/../../../install/libexec"